@@ -0,0 +1,163 @@
+#ifndef  ADMISSIONCONTROL_INC
+#define  ADMISSIONCONTROL_INC
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <sys/socket.h>
+#include "Types/ServerType.h"
+
+namespace sereno
+{
+    /* \brief A rate limit, 0 == unlimited. The read thread is charged before any framing : a read is one read() of a socket
+     * (or one SOCK_SEQPACKET record), which may hold several framed messages or a part of one. Bound the messages with bytesPerSecond */
+    struct RateLimit
+    {
+        double readsPerSecond = 0.0; /*!< The socket reads allowed per second*/
+        double bytesPerSecond = 0.0; /*!< The bytes allowed per second*/
+        double burstSeconds   = 1.0; /*!< The bucket capacity, in seconds of rate*/
+
+        /* \brief Is this limit enabled?
+         * \return true if at least one rate is limited */
+        bool isLimited() const {return readsPerSecond > 0.0 || bytesPerSecond > 0.0;}
+    };
+
+    /* \brief A token bucket. Not thread safe */
+    class TokenBucket
+    {
+        public:
+            /* \brief Set the bucket rate. The bucket starts full
+             * \param rate the tokens added per second. 0 == unlimited
+             * \param burst the bucket capacity
+             * \param now the current time (nanoseconds, see AdmissionControl::now) */
+            void configure(double rate, double burst, uint64_t now);
+
+            /* \brief Get the tokens available
+             * \param now the current time (nanoseconds)
+             * \return the tokens available. A huge value if unlimited */
+            double getTokens(uint64_t now);
+
+            /* \brief Consume tokens
+             * \param tokens the tokens to consume */
+            void consume(double tokens);
+        private:
+            double   m_rate   = 0.0; /*!< The tokens added per second. 0 == unlimited*/
+            double   m_burst  = 0.0; /*!< The bucket capacity*/
+            double   m_tokens = 0.0; /*!< The tokens available*/
+            uint64_t m_last   = 0;   /*!< The time of the last refill*/
+    };
+
+    /* \brief Admission control of a Server : global and per-IP connection caps checked in the accept path,
+     * and per-client and per-IP token buckets checked by the read thread before reading a socket.
+     * Over-limit sockets are not read (their data stays in the kernel, applying TCP back pressure) until tokens are available.
+     * Clients which are not AF_INET / AF_INET6 (e.g., UNIX domain sockets) are only subject to the global and per-client limits.
+     * The limits have to be set before launching the Server */
+    class AdmissionControl
+    {
+        public:
+            /* \brief Set the rate limit of each client
+             * \param limit the rate limit */
+            void setClientRateLimit(const RateLimit& limit) {m_clientLimit = limit;}
+
+            /* \brief Set the rate limit shared by every client of an IP address
+             * \param limit the rate limit */
+            void setIPRateLimit(const RateLimit& limit) {m_ipLimit = limit;}
+
+            /* \brief Set the maximum number of connected clients
+             * \param max the maximum number of clients. 0 == unlimited */
+            void setMaxConnections(uint32_t max) {m_maxConnections = max;}
+
+            /* \brief Set the maximum number of connected clients per IP address
+             * \param max the maximum number of clients per IP address. 0 == unlimited */
+            void setMaxConnectionsPerIP(uint32_t max) {m_maxConnectionsPerIP = max;}
+
+            /* \brief Is a rate limit set?
+             * \return true if the read thread has to check the token buckets */
+            bool isRateLimited() const {return m_clientLimit.isLimited() || m_ipLimit.isLimited();}
+
+            /* \brief Register a new client
+             * \param sock the client socket
+             * \param addr the client address
+             * \param enforceCaps should we check the connection caps?
+             * \return true if the client is admitted, false if a connection cap is reached */
+            bool admit(SOCKET sock, const struct sockaddr_storage& addr, bool enforceCaps = true);
+
+            /* \brief Unregister a client
+             * \param sock the client socket */
+            void release(SOCKET sock);
+
+            /* \brief Unregister every client */
+            void clear();
+
+            /* \brief Get the bytes a client can read now
+             * \param sock the client socket
+             * \param now the current time (nanoseconds)
+             * \return the bytes the client can read. 0 == throttled, UINT32_MAX == unlimited */
+            uint32_t getAllowance(SOCKET sock, uint64_t now);
+
+            /* \brief Charge a client for one socket read
+             * \param sock the client socket
+             * \param size the bytes read */
+            void consume(SOCKET sock, uint32_t size);
+
+            /* \brief Get the number of registered clients
+             * \return the number of clients */
+            uint32_t getNbConnections();
+
+            /* \brief Get the current time used by the token buckets
+             * \return the monotonic time in nanoseconds */
+            static uint64_t now();
+        private:
+            /* \brief The buckets of a rate limit */
+            struct Buckets
+            {
+                TokenBucket reads; /*!< The socket reads bucket*/
+                TokenBucket bytes; /*!< The bytes bucket*/
+
+                /* \brief Configure the buckets
+                 * \param limit the rate limit
+                 * \param now the current time (nanoseconds) */
+                void configure(const RateLimit& limit, uint64_t now);
+
+                /* \brief Get the bytes which can be read now
+                 * \param now the current time (nanoseconds)
+                 * \return the allowed bytes */
+                uint32_t getAllowance(uint64_t now);
+
+                /* \brief Consume one socket read
+                 * \param size the bytes read */
+                void consume(uint32_t size);
+            };
+
+            /* \brief The state of an IP address */
+            struct IPState
+            {
+                uint32_t nbConnections = 0; /*!< The clients connected from this address*/
+                Buckets  buckets;           /*!< The buckets shared by these clients*/
+            };
+
+            /* \brief The state of a client */
+            struct ClientState
+            {
+                std::string ip;      /*!< The client IP address (binary). Empty if not an IP client*/
+                Buckets     buckets; /*!< The client buckets*/
+            };
+
+            /* \brief Get the key of the IP address of a client
+             * \param addr the client address
+             * \return the IP address (binary), empty if not an IP address */
+            static std::string getIPKey(const struct sockaddr_storage& addr);
+
+            RateLimit                               m_clientLimit;             /*!< The per-client rate limit*/
+            RateLimit                               m_ipLimit;                 /*!< The per-IP rate limit*/
+            uint32_t                                m_maxConnections      = 0; /*!< The global connection cap. 0 == unlimited*/
+            uint32_t                                m_maxConnectionsPerIP = 0; /*!< The per-IP connection cap. 0 == unlimited*/
+            std::mutex                              m_mutex;                   /*!< Protect the states*/
+            std::unordered_map<SOCKET, ClientState> m_clients;                 /*!< The clients state*/
+            std::map<std::string, IPState>          m_ips;                     /*!< The IP addresses state*/
+    };
+}
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef  BUFFER_INC
+#define  BUFFER_INC
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <new>
+#include "ServerPolicies.h"
+
+namespace sereno
+{
+    /* \brief The header of the memory of a Buffer. Buffers allocate the header and the data at once : [BufferBlock][data] */
+    struct BufferBlock
+    {
+        std::atomic<uint32_t> refCount{1};                    /*!< The handles on this block*/
+        uint32_t              capacity = 0;                   /*!< The data capacity in bytes*/
+        uint8_t*              data     = NULL;                /*!< The data : right after the header, or an external memory (see Buffer::wrap)*/
+        void                (*release)(BufferBlock*) = NULL;  /*!< Free the block. Identifies the pool the block comes from*/
+    };
+
+    /* \brief The size of the header preceding the data of a Buffer (keeps the data 16 bytes aligned) */
+    static const uint32_t BUFFER_HEADER_SIZE = (sizeof(BufferBlock) + 15) & ~15u;
+
+    class Buffer;
+
+    /* \brief A move-only handle on a buffer : the only owner of its memory, which can hence be written.
+     * Call share() to turn it into a Buffer */
+    class UniqueBuffer
+    {
+        public:
+            UniqueBuffer() {}
+
+            UniqueBuffer(UniqueBuffer&& mvt) : m_block(mvt.m_block), m_size(mvt.m_size)
+            {
+                mvt.m_block = NULL;
+                mvt.m_size  = 0;
+            }
+
+            UniqueBuffer& operator=(UniqueBuffer&& mvt)
+            {
+                if(this != &mvt)
+                {
+                    reset();
+                    m_block     = mvt.m_block;
+                    m_size      = mvt.m_size;
+                    mvt.m_block = NULL;
+                    mvt.m_size  = 0;
+                }
+                return *this;
+            }
+
+            UniqueBuffer(const UniqueBuffer&) = delete;
+            UniqueBuffer& operator=(const UniqueBuffer&) = delete;
+
+            ~UniqueBuffer() {reset();}
+
+            /* \brief Allocate a buffer with malloc
+             * \param size the buffer size
+             * \return the buffer, empty if the allocation failed */
+            static UniqueBuffer allocate(uint32_t size) {return allocateFrom<MallocAllocator>(size);}
+
+            /* \brief Allocate a buffer from an allocator policy (see ServerPolicies.h). The header and the data are allocated at once,
+             * the buffer giving its memory back to this allocator with its last handle
+             * \param size the buffer size. At most maxSize<A>()
+             * \return the buffer, empty if the allocation failed */
+            template <typename A>
+            static UniqueBuffer allocateFrom(uint32_t size)
+            {
+                uint8_t* raw = A::allocate(BUFFER_HEADER_SIZE + size);
+                if(raw == NULL)
+                    return UniqueBuffer();
+
+                BufferBlock* block = new(raw) BufferBlock();
+                block->capacity    = size;
+                block->data        = raw + BUFFER_HEADER_SIZE;
+                block->release     = &releaseBlock<A>;
+                return UniqueBuffer(block, size);
+            }
+
+            /* \brief Get the largest buffer an allocator policy provides
+             * \return the maximum size of allocateFrom<A> */
+            template <typename A>
+            static constexpr uint32_t maxSize() {return A::maxSize() - BUFFER_HEADER_SIZE;}
+
+            /* \brief Change the buffer size, within its capacity
+             * \param size the new size
+             * \return false if size is larger than the capacity */
+            bool resize(uint32_t size)
+            {
+                if(m_block == NULL || size > m_block->capacity)
+                    return false;
+                m_size = size;
+                return true;
+            }
+
+            /* \brief Turn this handle into a shared one. This handle becomes empty
+             * \return the shared handle */
+            Buffer share();
+
+            /* \brief Free the buffer. The handle becomes empty */
+            void reset()
+            {
+                if(m_block)
+                    m_block->release(m_block);
+                m_block = NULL;
+                m_size  = 0;
+            }
+
+            /* \brief Was this buffer allocated by the allocator policy A?
+             * \return true if yes, false otherwise */
+            template <typename A>
+            bool isFrom() const {return m_block && m_block->release == &releaseBlock<A>;}
+
+            uint8_t* data() const     {return m_block ? m_block->data : NULL;}
+            uint32_t size() const     {return m_size;}
+            uint32_t capacity() const {return m_block ? m_block->capacity : 0;}
+            explicit operator bool() const {return m_block != NULL;}
+        private:
+            UniqueBuffer(BufferBlock* block, uint32_t size) : m_block(block), m_size(size) {}
+
+            /* \brief Give a block back to the allocator A */
+            template <typename A>
+            static void releaseBlock(BufferBlock* block)
+            {
+                block->~BufferBlock();
+                A::deallocate((uint8_t*)block);
+            }
+
+            BufferBlock* m_block = NULL; /*!< The block*/
+            uint32_t     m_size  = 0;    /*!< The buffer size*/
+
+            friend class Buffer;
+    };
+
+    /* \brief A shared handle on a (slice of a) buffer, with an intrusive reference count : copying it does not allocate.
+     * The memory is freed with its last handle. Move it wherever possible : copies are atomic operations */
+    class Buffer
+    {
+        public:
+            Buffer() {}
+
+            Buffer(const Buffer& copy) : m_block(copy.m_block), m_offset(copy.m_offset), m_size(copy.m_size)
+            {
+                if(m_block)
+                    m_block->refCount.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            Buffer(Buffer&& mvt) : m_block(mvt.m_block), m_offset(mvt.m_offset), m_size(mvt.m_size)
+            {
+                mvt.m_block  = NULL;
+                mvt.m_offset = 0;
+                mvt.m_size   = 0;
+            }
+
+            /* \brief Take the ownership of a UniqueBuffer */
+            Buffer(UniqueBuffer&& unique) : m_block(unique.m_block), m_size(unique.m_size)
+            {
+                unique.m_block = NULL;
+                unique.m_size  = 0;
+            }
+
+            Buffer& operator=(const Buffer& copy)
+            {
+                Buffer(copy).swap(*this);
+                return *this;
+            }
+
+            Buffer& operator=(Buffer&& mvt)
+            {
+                Buffer(std::move(mvt)).swap(*this);
+                return *this;
+            }
+
+            ~Buffer() {reset();}
+
+            /* \brief Share a memory owned by a std::shared_ptr. The block header is a separate allocation in this case
+             * \param data the memory
+             * \param size the memory size
+             * \return the buffer */
+            static Buffer wrap(std::shared_ptr<uint8_t> data, uint32_t size)
+            {
+                struct ExternalBlock : BufferBlock
+                {
+                    std::shared_ptr<uint8_t> owner; /*!< Keep the memory alive*/
+                };
+
+                ExternalBlock* block = new ExternalBlock();
+                block->capacity = size;
+                block->data     = data.get();
+                block->owner    = std::move(data);
+                block->release  = [](BufferBlock* b) {delete static_cast<ExternalBlock*>(b);};
+
+                Buffer buffer;
+                buffer.m_block = block;
+                buffer.m_size  = size;
+                return buffer;
+            }
+
+            /* \brief Get a view on a part of this buffer, sharing its memory
+             * \param offset the view offset in this buffer
+             * \param size the view size. Clamped to the end of this buffer
+             * \return the view */
+            Buffer slice(uint32_t offset, uint32_t size) const
+            {
+                Buffer view(*this);
+                view.m_offset += std::min(offset, m_size);
+                view.m_size    = std::min(size, m_size - std::min(offset, m_size));
+                return view;
+            }
+
+            /* \brief Drop this handle. The handle becomes empty */
+            void reset()
+            {
+                if(m_block && m_block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    m_block->release(m_block);
+                m_block  = NULL;
+                m_offset = 0;
+                m_size   = 0;
+            }
+
+            void swap(Buffer& other)
+            {
+                std::swap(m_block,  other.m_block);
+                std::swap(m_offset, other.m_offset);
+                std::swap(m_size,   other.m_size);
+            }
+
+            /* \brief Was this buffer allocated by the allocator policy A?
+             * \return true if yes, false otherwise */
+            template <typename A>
+            bool isFrom() const {return m_block && m_block->release == &UniqueBuffer::releaseBlock<A>;}
+
+            /* \brief Get the number of handles on the memory of this buffer (a relaxed load, for statistics)
+             * \return the number of handles, 0 if empty */
+            uint32_t getRefCount() const {return m_block ? m_block->refCount.load(std::memory_order_relaxed) : 0;}
+
+            /* \brief Is this buffer the only handle on its memory? The load acquires the releases of the other handles (see clear),
+             * so that their last reads happen before the caller writes the memory again. Use it, not getRefCount, to decide a reuse
+             * \return true if yes, false otherwise (or if empty) */
+            bool isUnique() const {return m_block && m_block->refCount.load(std::memory_order_acquire) == 1;}
+
+            uint8_t* data() const     {return m_block ? m_block->data + m_offset : NULL;}
+            uint32_t size() const     {return m_size;}
+            uint32_t offset() const   {return m_offset;}
+            uint32_t capacity() const {return m_block ? m_block->capacity : 0;}
+            explicit operator bool() const {return m_block != NULL;}
+        private:
+            BufferBlock* m_block  = NULL; /*!< The block*/
+            uint32_t     m_offset = 0;    /*!< The view offset in the block data*/
+            uint32_t     m_size   = 0;    /*!< The view size*/
+    };
+
+    inline Buffer UniqueBuffer::share()
+    {
+        return Buffer(std::move(*this));
+    }
+}
+
+#endif
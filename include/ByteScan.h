@@ -0,0 +1,24 @@
+#ifndef  BYTESCAN_INC
+#define  BYTESCAN_INC
+
+#include <cstdint>
+
+namespace sereno
+{
+    /* \brief Find the first occurrence of a byte, using the best kernel of the CPU (AVX2, SSE2 or scalar).
+     * Used by DelimiterFraming to find the record boundaries
+     * \param data the data to scan
+     * \param size the data size
+     * \param value the byte to find
+     * \return a pointer to the first occurrence, NULL if value is not in data */
+    const uint8_t* scanByte(const uint8_t* data, uint32_t size, uint8_t value);
+
+    /* \brief Find the first occurrence of a byte, without SIMD. See scanByte */
+    const uint8_t* scanByteScalar(const uint8_t* data, uint32_t size, uint8_t value);
+
+    /* \brief Get the kernel used by scanByte
+     * \return "avx2", "sse2" or "scalar" */
+    const char* scanByteKernel();
+}
+
+#endif
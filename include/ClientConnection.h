@@ -0,0 +1,187 @@
+#ifndef  CLIENTCONNECTION_INC
+#define  CLIENTCONNECTION_INC
+
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include "Types/ServerType.h"
+#include "SocketData.h"
+
+namespace sereno
+{
+    class ConnectionPool;
+
+    /* \brief Called with the response of a request. ok == false if the connection was closed before the response arrived */
+    typedef std::function<void(bool ok, const uint8_t* data, uint32_t size)> ResponseCallback;
+
+    /* \brief Called with the messages which do not answer a pending request (e.g., pushed by the Server) */
+    typedef std::function<void(uint32_t correlationID, const uint8_t* data, uint32_t size)> MessageCallback;
+
+    /* \brief The state of a ClientConnection */
+    enum ConnectionState
+    {
+        CONNECTION_CONNECTING, /*!< The non blocking connect is in progress*/
+        CONNECTION_CONNECTED,  /*!< The connection is established*/
+        CONNECTION_CLOSED      /*!< The connection failed or was closed*/
+    };
+
+    /* \brief An outbound connection to a Server, driven by the event loop of a ConnectionPool.
+     * Messages use the framing of LengthPrefixFraming (uint32_t size in host byte order) and start with a uint32_t correlation ID :
+     * [size][correlationID][payload], size counting the correlation ID and the payload.
+     * Requests are pipelined : several requests can be in flight, each response is matched to its request by its correlation ID */
+    class ClientConnection
+    {
+        public:
+            /* \brief Destructor. Close the socket */
+            ~ClientConnection();
+
+            /* \brief Send a request. Can be called from any thread, even while connecting (the request is then queued)
+             * \param data the request payload
+             * \param size the payload size
+             * \param callback the function called with the response, from the ConnectionPool thread
+             * \return the correlation ID of the request, 0 if the connection is closed */
+            uint32_t request(const uint8_t* data, uint32_t size, ResponseCallback callback);
+
+            /* \brief Send a message which does not expect any response
+             * \param correlationID the correlation ID to put in the message
+             * \param data the message payload
+             * \param size the payload size
+             * \return true on success, false if the connection is closed */
+            bool send(uint32_t correlationID, const uint8_t* data, uint32_t size);
+
+            /* \brief Set the function called with the messages not answering a pending request
+             * \param callback the function to call from the ConnectionPool thread */
+            void setMessageCallback(MessageCallback callback);
+
+            /* \brief Close the connection. The pending requests fail */
+            void close();
+
+            /* \brief Get the connection state
+             * \return the connection state */
+            ConnectionState getState() const {return m_state;}
+
+            /* \brief Get the number of requests waiting for their response
+             * \return the number of pending requests */
+            uint32_t getNbPending();
+
+            /* \brief Get the socket of this connection
+             * \return the socket */
+            SOCKET getSocket() const {return m_sock;}
+
+            /* \brief Build a message with the framing used by ClientConnection : [size][correlationID][payload].
+             * Servers can use it to build their responses
+             * \param correlationID the correlation ID
+             * \param data the payload
+             * \param size the payload size
+             * \param frameSize[out] the total message size, if not NULL
+             * \return the message */
+            static Buffer buildFrame(uint32_t correlationID, const uint8_t* data, uint32_t size, uint32_t* frameSize = NULL);
+        private:
+            friend class ConnectionPool;
+
+            /* \brief Constructor
+             * \param pool the pool driving this connection
+             * \param sock the (non blocking) socket */
+            ClientConnection(ConnectionPool* pool, SOCKET sock);
+
+            /* \brief Queue a message and try to write it
+             * \param frame the message, moved in the queue
+             * \return true on success, false if the connection is closed */
+            bool push(Buffer frame);
+
+            /* \brief Write as much queued data as possible. m_writeMutex must be locked
+             * \return false on socket error, true otherwise */
+            bool flush();
+
+            /* \brief Handle the end of the non blocking connect (ConnectionPool thread)
+             * \return true if connected, false otherwise */
+            bool onConnected();
+
+            /* \brief Read and dispatch the available messages (ConnectionPool thread)
+             * \return false if the connection is closed, true otherwise */
+            bool onReadable();
+
+            /* \brief Make room at the end of m_readBuffer for the next read : allocate it from the pool, move the pending message
+             * to its front, or grow it for a message larger than a pool block
+             * \return false if the pending message is invalid or the allocation failed, true otherwise */
+            bool reserveRead();
+
+            /* \brief Dispatch the complete messages of m_readBuffer, advancing m_readStart
+             * \return false if a message is invalid, true otherwise */
+            bool dispatch();
+
+            /* \brief Close the socket and fail the pending requests */
+            void shutdown();
+
+            ConnectionPool*                                m_pool;              /*!< The pool driving this connection*/
+            SOCKET                                         m_sock;              /*!< The socket*/
+            std::atomic<ConnectionState>                   m_state;             /*!< The connection state*/
+            std::mutex                                     m_writeMutex;        /*!< Protect the outbound queue*/
+            std::queue<SocketData>                         m_writeBuffer;       /*!< The outbound queue*/
+            uint32_t                                       m_writeOffset = 0;   /*!< The bytes already written of the front message*/
+            bool                                           m_wantWrite = false; /*!< Is EPOLLOUT armed?*/
+            std::mutex                                     m_pendingMutex;      /*!< Protect m_pending and m_messageCallback*/
+            std::unordered_map<uint32_t, ResponseCallback> m_pending;           /*!< The requests waiting for their response*/
+            MessageCallback                                m_messageCallback;   /*!< The callback of the other messages*/
+            uint32_t                                       m_nextID = 1;        /*!< The next correlation ID*/
+            UniqueBuffer                                   m_readBuffer;        /*!< The receive buffer, given back to the pool once dispatched*/
+            uint32_t                                       m_readStart = 0;     /*!< The first byte of m_readBuffer not yet dispatched*/
+            uint32_t                                       m_readEnd   = 0;     /*!< The end of the received bytes in m_readBuffer*/
+    };
+
+    /* \brief A shared event loop (epoll) driving thousands of outbound ClientConnection */
+    class ConnectionPool
+    {
+        public:
+            /* \brief Constructor */
+            ConnectionPool();
+
+            /* \brief Destructor. Close every connection and stop the event loop */
+            ~ConnectionPool();
+
+            /* \brief Start the event loop thread
+             * \return true on success, false otherwise */
+            bool launch();
+
+            /* \brief Stop the event loop and close every connection */
+            void close();
+
+            /* \brief Open a new connection (non blocking connect). Requests can be sent right away, they are written once connected
+             * \param addr the Server address
+             * \param addrLen the address length
+             * \return the new connection, NULL on error */
+            std::shared_ptr<ClientConnection> connect(const SOCKADDR* addr, socklen_t addrLen);
+
+            /* \brief Get the number of open connections
+             * \return the number of connections */
+            uint32_t getNbConnections();
+        private:
+            friend class ClientConnection;
+
+            /* \brief The event loop */
+            void loop();
+
+            /* \brief Update the events watched for a connection
+             * \param conn the connection
+             * \param wantWrite should we watch EPOLLOUT?*/
+            void watch(ClientConnection* conn, bool wantWrite);
+
+            /* \brief Remove a connection from the pool
+             * \param sock the connection socket */
+            void remove(SOCKET sock);
+
+            int                                                  m_epoll = -1;        /*!< The epoll instance*/
+            std::thread                                          m_thread;            /*!< The event loop thread*/
+            std::atomic<bool>                                    m_closeThread;       /*!< Should the event loop stop?*/
+            std::mutex                                           m_mutex;             /*!< Protect m_connections*/
+            std::map<SOCKET, std::shared_ptr<ClientConnection>>  m_connections;       /*!< The connections*/
+    };
+}
+
+#endif
@@ -6,13 +6,32 @@
 #include <mutex>              
 #include <condition_variable> 
 #include <queue>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <vector>
 #include <unistd.h>
 #include <pthread.h>
 #include "Types/ServerType.h"
 #include "SocketData.h"
+#include "SharedMemoryChannel.h"
+#include "PriorityLanes.h"
+#include "ThreadConfig.h"
+#include "Transport.h"
+#include "Compression.h"
 
 namespace sereno
 {
+    /* \brief The listener ID of the clients of the TCP port given to the Server constructor (see Server::addTCPListener) */
+    static const uint32_t DEFAULT_LISTENER_ID = 0;
+
+    /* \brief The maximum size of a chunk header written by a ChunkHeaderWriter */
+    static const uint32_t MAX_CHUNK_HEADER_SIZE = 64;
+
+    /* \brief Write the header of a chunk of a large message (see ClientSocket::pushChunked) so that each chunk is a message of
+     * the application protocol, e.g., headerWriter(header, offset, chunkSize, totalSize) -> header size (<= MAX_CHUNK_HEADER_SIZE) */
+    typedef std::function<uint32_t(uint8_t* header, uint32_t offset, uint32_t chunkSize, uint32_t totalSize)> ChunkHeaderWriter;
+
     /* \brief The ClientSocket class. Handles the client connected to the Server */
     class ClientSocket
     {
@@ -24,9 +43,92 @@ namespace sereno
             virtual ~ClientSocket();
 
             /** \brief  Push a packet to write to the socket
+             * \param data the data to write. Moved in the outbound queue : pass a copy to keep a handle
+             * \param priority the outbound lane (PacketPriority) of this packet */
+            void pushPacket(Buffer data, uint8_t priority = PRIORITY_NORMAL);
+
+            /** \brief  Push a packet to write to the socket, see pushPacket(Buffer, uint8_t)
              * \param data the data to write
-             * \param size the size of the data */
-            void pushPacket(std::shared_ptr<uint8_t>& data, uint32_t size);
+             * \param size the size of the data
+             * \param priority the outbound lane (PacketPriority) of this packet */
+            void pushPacket(std::shared_ptr<uint8_t>& data, uint32_t size, uint8_t priority = PRIORITY_NORMAL);
+
+            /** \brief  Push a large message split in chunks, so that packets of more urgent lanes are written between two chunks.
+             * Chunks reference the data without copying it. Each chunk is preceded by the header written by headerWriter,
+             * which has to make every chunk a complete message of the application protocol
+             * \param data the data to write. The chunks are slices of it
+             * \param chunkSize the maximum size of a chunk
+             * \param headerWriter the function writing each chunk header
+             * \param priority the outbound lane (PacketPriority) of the chunks */
+            void pushChunked(Buffer data, uint32_t chunkSize, ChunkHeaderWriter headerWriter, uint8_t priority = PRIORITY_BULK);
+
+            /** \brief  Push a large message split in chunks, see pushChunked(Buffer, uint32_t, ChunkHeaderWriter, uint8_t)
+             * \param data the data to write
+             * \param size the size of the data
+             * \param chunkSize the maximum size of a chunk
+             * \param headerWriter the function writing each chunk header
+             * \param priority the outbound lane (PacketPriority) of the chunks */
+            void pushChunked(std::shared_ptr<uint8_t> data, uint32_t size, uint32_t chunkSize, ChunkHeaderWriter headerWriter, uint8_t priority = PRIORITY_BULK);
+
+            /** \brief  Push a file segment to write to the socket with sendfile, without copying it in user space
+             * \param fd the file descriptor. It is duplicated : the caller keeps the ownership of fd
+             * \param offset the segment offset in the file
+             * \param size the segment size
+             * \param priority the outbound lane (PacketPriority) of this packet
+             * \return   true on success, false if fd could not be duplicated */
+            bool pushFile(int fd, off_t offset, uint32_t size, uint8_t priority = PRIORITY_BULK);
+
+            /** \brief  Push a large packet to write with MSG_ZEROCOPY : the kernel reads data directly, and data is kept alive until
+             * the kernel notifies the end of the transmission. Falls back to a normal write if the socket does not have SO_ZEROCOPY
+             * (see SocketOptions::zeroCopy). Only worth it for large packets (tens of KB and more)
+             * \param data the data to write. Do not modify it afterwards
+             * \param priority the outbound lane (PacketPriority) of this packet */
+            void pushZeroCopy(Buffer data, uint8_t priority = PRIORITY_BULK);
+
+            /** \brief  Push a large packet to write with MSG_ZEROCOPY, see pushZeroCopy(Buffer, uint8_t)
+             * \param data the data to write. Do not modify it afterwards
+             * \param size the size of the data
+             * \param priority the outbound lane (PacketPriority) of this packet */
+            void pushZeroCopy(std::shared_ptr<uint8_t>& data, uint32_t size, uint8_t priority = PRIORITY_BULK);
+
+            /** \brief  Compress the messages of this client from now on (see StreamCompressor). Both sides have to enable it at the same
+             * point of the stream, e.g., after a handshake of the application protocol : the Server framing has then to be a CompressedFraming,
+             * and the messages have to be sent with pushCompressed. Can be enabled once
+             * \param config the stream configuration
+             * \param headerWriter writes the framing header of each compressed message (headerWriter(header, 0, size, size), size counting
+             * the CompressionFlag byte), e.g., its length prefix. NULL == no header
+             * \return   true on success, false if compression is not available or already enabled */
+            bool enableCompression(const CompressionConfig& config = CompressionConfig(), ChunkHeaderWriter headerWriter = NULL);
+
+            /** \brief  Are the messages of this client compressed?
+             * \return   true if yes, false otherwise */
+            bool isCompressionEnabled() const {return m_compressionEnabled.load(std::memory_order_acquire);}
+
+            /** \brief  Push a message through the outbound compressed stream, on the lane of the CompressionConfig : the stream order is the
+             * write order. Small messages are not compressed and share data. Pushed with pushPacket if compression is not enabled
+             * \param data the message */
+            void pushCompressed(const Buffer& data);
+
+            /** \brief  Push a message through the outbound compressed stream, see pushCompressed(const Buffer&)
+             * \param data the message
+             * \param size the message size */
+            void pushCompressed(std::shared_ptr<uint8_t>& data, uint32_t size);
+
+            /** \brief  Decode a message of the inbound compressed stream (see CompressedFraming). Called by one thread at a time, in the stream order
+             * \param data the received message
+             * \param size the message size
+             * \param msg the decompressed message, valid until the next call (or as long as data)
+             * \param msgSize the decompressed message size
+             * \return   false if the message is corrupted, or if compression is not enabled */
+            bool decompress(uint8_t* data, uint32_t size, uint8_t*& msg, uint32_t& msgSize);
+
+            /** \brief  Get the counters of the compressed streams of this client
+             * \return   the counters, zeroed if compression is not enabled */
+            CompressionStats getCompressionStats() const;
+
+            /** \brief  Set the scheduling of the outbound lanes
+             * \param weights the bytes each lane can write per round (PRIORITY_COUNT values). Empty == strict-priority (default) */
+            void setWriteLaneWeights(const std::vector<uint32_t>& weights);
 
             /* \brief Add a message to read for this client
              *
@@ -35,31 +137,134 @@ namespace sereno
              * \param size the data size*/
             virtual bool feedMessage(uint8_t* data, uint32_t size);
 
+            /** \brief  Send the outbound data of this client through a shared memory channel instead of its socket
+             * \param channel the shared memory channel (server side) */
+            void setSharedMemoryChannel(std::shared_ptr<SharedMemoryChannel> channel);
+
+            /** \brief  Get the shared memory channel of this client
+             * \return   the shared memory channel, NULL if this client uses its socket */
+            std::shared_ptr<SharedMemoryChannel> getSharedMemoryChannel() {return m_shmChannel;}
+
+            /** \brief  Shut the socket down once the queued packets are written, e.g., after a closing message.
+             * The Server then sees the end of the stream and closes the client */
+            void shutdownAfterWrite();
+
             /** \brief  Close the client */
             void close();
 
             /** \brief  Is this client still open?
-             * \return  true if yes, false otherwise */
-            bool isConnected() const {return !m_close;}
+             * \return  true if yes, false otherwise (closed, or its close was requested) */
+            bool isConnected() const {return !m_close && !m_closeRequested;}
+
+            /** \brief  Mark this client to be closed by the Server (see Server::requestClose)
+             * \return  true for the first request, false if the close was already requested */
+            bool requestClose() {return !m_closeRequested.exchange(true);}
+
+            /** \brief  Get the writing thread of this client, e.g., to configure it (see ThreadConfig).
+             * The thread is started with the first packet pushed
+             * \return   the writing thread native handle, 0 if it is not started yet */
+            pthread_t getWriteThread() {return m_writeThread.joinable() ? m_writeThread.native_handle() : 0;}
 
             /** \brief  Gets the number of bytes being written to this client
              * \return   the number of bytes to write */
             uint32_t getBytesInWritting() const {return m_bytesInWriting;}
 
-            uint32_t    nbMessage   = 0;    /*!< The number of remaining message*/
+            /** \brief  Take a reference on this client. The Server keeps one reference while the client is registered
+             * and one per message queued for the handle messages threads */
+            void acquire() {m_refCount.fetch_add(1, std::memory_order_relaxed);}
+
+            /** \brief  Drop a reference. The client is deleted with its last reference, hence it must have been allocated with new
+             * \return   true if the client was deleted, false otherwise */
+            bool release()
+            {
+                if(m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    delete this;
+                    return true;
+                }
+                return false;
+            }
+
+            /** \brief  Get the number of references on this client
+             * \return   the number of references */
+            uint32_t getRefCount() const {return m_refCount.load(std::memory_order_relaxed);}
+
+            uint32_t    listenerID = DEFAULT_LISTENER_ID; /*!< The ID of the listener which accepted this client (Server information)*/
             uint32_t    bufferID;           /*!< The buffer ID which this client belongs to (Server information)*/
+            uint32_t    targetBufferID = 0; /*!< The buffer ID this client moves to once it has no queued message (Server information)*/
+            std::atomic<uint32_t> nbQueued{0}; /*!< The number of messages queued or being handled (Server information)*/
+            uint8_t     inboundPriority = PRIORITY_NORMAL; /*!< The handler queue lane (PacketPriority) of the messages of this client.
+                                                                Changing it while messages are queued may reorder them*/
+
+            std::shared_ptr<void> framingState; /*!< The per-client state of the Server framing policy (handle messages thread only)*/
 
             SOCKET      socket;             /*!< The Socket associated with this Client*/
-            SOCKADDR_IN sockAddr;           /*!< The Socket address information*/
+            int         domain = AF_INET;   /*!< The Socket domain (AF_INET, AF_INET6 or AF_UNIX)*/
+            SOCKADDR_IN sockAddr;           /*!< The Socket address information. Zeroed for non AF_INET clients*/
+            Transport*  transport = SocketTransport::get(); /*!< The I/O operations of the socket (Server information)*/
+            const ThreadConfig* threadConfig = NULL; /*!< Applied to the writing thread when it starts, if any (Server information)*/
         private:
+            /** \brief  Start the writing thread if it is not started yet. m_writeLock has to be locked */
+            void startWriteThread();
+
+            /** \brief  Start the writing thread if needed and wake it up. m_writeLock has to be locked */
+            void wakeWriteThread();
+
+            /** \brief  Write the whole data to the socket, waiting for it to be writable if needed
+             * \param data the data to write
+             * \param size the data size
+             * \return   true on success, false if the socket was closed or failed */
+            bool writeSocket(const uint8_t* data, uint32_t size);
+
+            /** \brief  Push a packet in an outbound queue
+             * \param packet the packet. Moved in the queue
+             * \param priority the outbound lane (PacketPriority) */
+            void pushSocketData(SocketData&& packet, uint8_t priority);
+
+            /** \brief  Write a packet (header and data) to the socket or the shared memory channel
+             * \param packet the packet to write
+             * \param channel the shared memory channel, if any
+             * \return   true on success, false if the socket or the channel was closed or failed before the end of the packet */
+            bool writePacket(const SocketData& packet, SharedMemoryChannel* channel);
+
+            /** \brief  Write a file segment to the socket with sendfile, or to the shared memory channel
+             * \param fd the file descriptor
+             * \param offset the segment offset
+             * \param size the segment size
+             * \param channel the shared memory channel, if any
+             * \return   true on success, false otherwise */
+            bool writeFile(int fd, off_t offset, uint32_t size, SharedMemoryChannel* channel);
+
+            /** \brief  Write the whole data with MSG_ZEROCOPY, keeping it until its completion notifications
+             * \param data the data to write
+             * \param size the data size
+             * \return   true on success, false if the socket was closed or failed */
+            bool writeZeroCopy(const Buffer& data, uint32_t size);
+
+            /** \brief  Release the zero copy buffers the kernel has finished to send (writing thread only) */
+            void reapZeroCopy();
+
             std::mutex              m_writeLock;     /*!< The lock of the writing thread*/
             std::condition_variable m_cond;          /*!< The condition variable used for synchronization*/
             std::mutex              m_condMutex;     /*!< The mutex used with the conditional variable*/
             std::thread             m_writeThread;   /*!< The writing thread.*/
 
-            std::queue<SocketData>  m_writeBuffer;   /*!< Queue data to send */
-            bool                    m_close = false; /*!< Is the client closed?*/
+            std::queue<SocketData>  m_writeBuffer[PRIORITY_COUNT]; /*!< Queue data to send, one per lane*/
+            LaneScheduler           m_writeScheduler; /*!< Choose the next lane to write*/
+            std::shared_ptr<SharedMemoryChannel> m_shmChannel; /*!< The shared memory channel, if any*/
+            std::atomic<bool>       m_close{false};  /*!< Is the client closed?*/
+            std::atomic<bool>       m_closeRequested{false}; /*!< Was the client asked to be closed? See requestClose*/
+            std::atomic<bool>       m_wakeUp{false}; /*!< Has something to be written since the writing thread went idle?*/
+            bool                    m_shutdownAfterWrite = false; /*!< Shut the socket down once the queues are empty?*/
+            std::atomic<uint32_t>   m_refCount{1};   /*!< The references on this client, see acquire and release*/
+            int                     m_zeroCopy = -1; /*!< Does the socket have SO_ZEROCOPY? -1 == unknown yet*/
+            uint32_t                m_zeroCopyID = 0; /*!< The ID of the next MSG_ZEROCOPY send*/
+            std::deque<std::pair<uint32_t, Buffer>> m_zeroCopyPending; /*!< The buffers waiting for their completion (writing thread only)*/
             uint32_t                m_bytesInWriting = 0; /*!< The number of bytes being written to that client*/
+            std::mutex              m_compressLock;  /*!< Keep the compressed stream order of pushCompressed*/
+            std::unique_ptr<StreamCompressor> m_compressor; /*!< The compressed streams, set once by enableCompression*/
+            ChunkHeaderWriter       m_compressHeaderWriter; /*!< The framing header of the compressed messages*/
+            std::atomic<bool>       m_compressionEnabled{false}; /*!< Is m_compressor set?*/
     };
 }
 
@@ -0,0 +1,161 @@
+#ifndef  COMPRESSION_INC
+#define  COMPRESSION_INC
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Buffer.h"
+#include "PriorityLanes.h"
+
+namespace sereno
+{
+    /* \brief The first byte of every message of a compressed stream */
+    enum CompressionFlag
+    {
+        COMPRESSION_RAW     = 0, /*!< The payload follows as is*/
+        COMPRESSION_DEFLATE = 1  /*!< The payload is the next deflate block of the stream*/
+    };
+
+    /* \brief The configuration of a compressed stream. Both sides must use the same windowBits */
+    struct CompressionConfig
+    {
+        int      level          = 6;         /*!< The zlib level (1 fastest .. 9 smallest)*/
+        uint32_t threshold      = 128;       /*!< Messages smaller than it (bytes) are sent raw*/
+        int      windowBits     = 15;        /*!< The history size, 2^windowBits bytes (9..15)*/
+        int      memLevel       = 8;         /*!< The zlib memory level (1..9)*/
+        uint32_t maxMessageSize = (1u << 26); /*!< The largest decompressed message. Larger ones fail*/
+        uint8_t  priority       = PRIORITY_NORMAL; /*!< The outbound lane (PacketPriority) of the compressed messages (see ClientSocket::pushCompressed)*/
+    };
+
+    /* \brief The counters of a StreamCompressor */
+    struct CompressionStats
+    {
+        uint64_t nbCompressed     = 0; /*!< The messages compressed*/
+        uint64_t nbRaw            = 0; /*!< The messages sent raw (below the threshold)*/
+        uint64_t inBytes          = 0; /*!< The bytes given to compress (raw messages included)*/
+        uint64_t outBytes         = 0; /*!< The bytes produced by compress (raw messages and flags included)*/
+        uint64_t compressNS       = 0; /*!< The CPU time spent compressing, in nanoseconds*/
+        uint64_t nbDecompressed   = 0; /*!< The messages decoded*/
+        uint64_t decompressedBytes = 0; /*!< The bytes produced by decode*/
+        uint64_t decompressNS     = 0; /*!< The CPU time spent decompressing, in nanoseconds*/
+
+        /* \brief Get the compression ratio of the outbound stream
+         * \return inBytes / outBytes, 1 if nothing was sent */
+        double ratio() const {return outBytes > 0 ? (double)inBytes/outBytes : 1.0;}
+    };
+
+    struct CompressionStreams;
+
+    /* \brief The deflate streams of one connection (zlib, when the library was built with it).
+     * The outbound and inbound streams keep their history between messages, so that repeated structure compresses well.
+     * Each message is flushed (Z_SYNC_FLUSH) and can be decoded as soon as it arrives : [CompressionFlag][payload].
+     * compress and decode can run concurrently, but each of them must be called by one thread at a time, in the stream order */
+    class StreamCompressor
+    {
+        public:
+            /* \brief Constructor. Check isValid
+             * \param config the stream configuration */
+            StreamCompressor(const CompressionConfig& config = CompressionConfig());
+
+            ~StreamCompressor();
+
+            /* \brief Was the library built with compression support (zlib)?
+             * \return true if yes, false otherwise */
+            static bool isAvailable();
+
+            /* \brief Are the streams initialized?
+             * \return true if yes, false otherwise */
+            bool isValid() const;
+
+            /* \brief Compress the payload of a message. Payloads below the threshold are not compressed and stay out of the history.
+             * The compressed payload comes from a pool
+             * \param data the payload
+             * \param size the payload size
+             * \param out the compressed payload (COMPRESSION_DEFLATE), empty otherwise
+             * \return the flag of the message. COMPRESSION_RAW : send data itself */
+            CompressionFlag compress(const uint8_t* data, uint32_t size, UniqueBuffer& out);
+
+            /* \brief Build a whole message : [CompressionFlag][payload]
+             * \param data the payload
+             * \param size the payload size
+             * \return the message */
+            UniqueBuffer encode(const uint8_t* data, uint32_t size);
+
+            /* \brief Decode a message built by encode (or its equivalent, see ClientSocket::pushCompressed)
+             * \param data the message. Raw payloads are returned in place
+             * \param size the message size
+             * \param msg the payload. Valid until the next call, or as long as data for raw messages
+             * \param msgSize the payload size
+             * \return false if the message is corrupted or too large */
+            bool decode(uint8_t* data, uint32_t size, uint8_t*& msg, uint32_t& msgSize);
+
+            /* \brief Get the counters of this compressor
+             * \return the counters */
+            CompressionStats getStats() const;
+
+            const CompressionConfig& getConfig() const {return m_config;}
+        private:
+            CompressionConfig                   m_config;  /*!< The configuration*/
+            std::unique_ptr<CompressionStreams> m_streams; /*!< The zlib streams, NULL if not available*/
+            std::vector<uint8_t>                m_inflated; /*!< The last decompressed payload*/
+            bool                                m_deflateBroken = false; /*!< Did deflate fail? Every message is then sent raw*/
+
+            std::atomic<uint64_t> m_nbCompressed{0};      /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_nbRaw{0};             /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_inBytes{0};           /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_outBytes{0};          /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_compressNS{0};        /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_nbDecompressed{0};    /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_decompressedBytes{0}; /*!< See CompressionStats*/
+            std::atomic<uint64_t> m_decompressNS{0};      /*!< See CompressionStats*/
+    };
+
+    /* \brief Decompress the messages of the clients having compression enabled (see ClientSocket::enableCompression)
+     * before they reach Server::onMessage : FramingIs<CompressedFraming<LengthPrefixFraming<>>>.
+     * Inner splits the received data into compressed messages and must deliver whole messages.
+     * A corrupted message closes the client
+     * \param Inner the framing of the compressed messages */
+    template <typename Inner>
+    struct CompressedFraming
+    {
+        template <typename C, typename F>
+        struct Sink
+        {
+            C* client;  /*!< The client*/
+            F& deliver; /*!< The next stage*/
+
+            void operator()(uint8_t* data, uint32_t size)
+            {
+                if(!client->isConnected())
+                    return;
+                if(!client->isCompressionEnabled())
+                {
+                    deliver(data, size);
+                    return;
+                }
+
+                uint8_t* msg;
+                uint32_t msgSize;
+                if(!client->decompress(data, size, msg, msgSize))
+                {
+                    deliver.close();
+                    return;
+                }
+                deliver(msg, msgSize);
+            }
+
+            /* \brief Close the client on a framing error of Inner */
+            void close() {deliver.close();}
+        };
+
+        /* \brief Feed the data received for a client. See RawFraming::feed */
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& deliver)
+        {
+            Inner::feed(client, data, size, Sink<C, F>{client, deliver});
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef  HANDLERPOOL_INC
+#define  HANDLERPOOL_INC
+
+#include <cstdint>
+#include <vector>
+
+namespace sereno
+{
+    /* \brief The adaptive sizing of the handle messages threads of a Server (see Server::setAdaptiveHandlers).
+     * The Server creates nbReadThread handler threads, but only the active ones receive clients : the others are parked.
+     * A handler is activated when the queues grow or the queueing delay rises, and the last one is parked once the pool stays idle */
+    struct AdaptiveHandlerConfig
+    {
+        uint32_t minHandlers     = 1;    /*!< The handler threads always active*/
+        uint32_t maxHandlers     = 0;    /*!< The maximum active handler threads. 0 or more than nbReadThread == nbReadThread*/
+        uint32_t queueDepthHigh  = 256;  /*!< Activate a handler when the messages queued per active handler exceed it*/
+        uint32_t queueDepthLow   = 8;    /*!< The pool is idle while the messages queued per active handler stay below it*/
+        uint32_t latencyHighUS   = 2000; /*!< Activate a handler when the queueing delay (average) of a handler exceeds it, in microseconds*/
+        uint32_t idleMS          = 2000; /*!< Park a handler once the pool has been idle for this long, in milliseconds*/
+        uint32_t checkIntervalMS = 50;   /*!< The period of the scaling decisions, in milliseconds*/
+    };
+
+    /* \brief The handler pool metrics, see Server::getHandlerPoolMetrics */
+    struct HandlerPoolMetrics
+    {
+        uint32_t              nbActive     = 0; /*!< The number of active handlers*/
+        uint64_t              nbScaleUp    = 0; /*!< The handlers activated since launch*/
+        uint64_t              nbScaleDown  = 0; /*!< The handlers parked since launch*/
+        uint64_t              nbMigrations = 0; /*!< The clients moved to another handler since launch*/
+        std::vector<bool>     active;           /*!< Is each handler active?*/
+        std::vector<uint32_t> queueDepths;      /*!< The messages queued for each handler*/
+        std::vector<double>   latenciesUS;      /*!< The queueing delay (average) of each handler, in microseconds*/
+    };
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef  LOGGER_INC
+#define  LOGGER_INC
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+//Compile-time log levels. Define SERENO_LOG_LEVEL (e.g., -DSERENO_LOG_LEVEL=SERENO_LOG_LEVEL_ERROR) to remove the lower levels
+#define SERENO_LOG_LEVEL_NONE    0
+#define SERENO_LOG_LEVEL_ERROR   1
+#define SERENO_LOG_LEVEL_WARNING 2
+#define SERENO_LOG_LEVEL_INFO    3
+
+#ifndef SERENO_LOG_LEVEL
+#define SERENO_LOG_LEVEL SERENO_LOG_LEVEL_INFO
+#endif
+
+namespace sereno
+{
+    /* \brief Asynchronous log backend of the INFO, WARNING and ERROR macros.
+     * Each thread formats its lines in a thread local stream and pushes them to its own lock-free (single producer, single consumer) staging ring.
+     * A background thread drains the rings to stdout (INFO, WARNING) and stderr (ERROR).
+     * Lines of one thread keep their order, lines of different threads may be interleaved differently.
+     * When a ring is full the line is dropped and counted : logging never blocks the caller */
+    class Logger
+    {
+        public:
+            /* \brief Push a formatted line to the staging ring of the calling thread
+             * \param level the line level (SERENO_LOG_LEVEL_*)
+             * \param line the line
+             * \param size the line size */
+            static void push(int level, const char* line, uint32_t size);
+
+            /* \brief Write every staged line now. Called at exit */
+            static void flush();
+
+            /* \brief Get the number of lines dropped because a staging ring was full
+             * \return the number of dropped lines */
+            static uint64_t getNbDropped();
+    };
+
+    /* \brief One log line being formatted. The line is pushed to the Logger when destroyed (end of the logging statement) */
+    class LogLine
+    {
+        public:
+            /* \brief Constructor. Write the line prefix
+             * \param level the line level (SERENO_LOG_LEVEL_*)
+             * \param file the source file name
+             * \param line the source line */
+            LogLine(int level, const char* file, int line);
+
+            /* \brief Destructor. Push the line to the Logger */
+            ~LogLine();
+
+            template <typename V>
+            LogLine& operator<<(const V& value)
+            {
+                m_stream << value;
+                return *this;
+            }
+
+            /* \brief Support the stream manipulators (e.g., std::endl) */
+            LogLine& operator<<(std::ostream& (*manipulator)(std::ostream&))
+            {
+                m_stream << manipulator;
+                return *this;
+            }
+        private:
+            int                 m_level;  /*!< The line level*/
+            std::ostringstream& m_stream; /*!< The thread local formatting stream*/
+    };
+
+    /* \brief Turn a logging statement into a void expression, for the log macros */
+    struct LogVoidify
+    {
+        void operator&(const LogLine&) {}
+    };
+
+    /* \brief Limit the logging rate of one call site (see INFO_RATE_LIMITED) */
+    class LogRateLimiter
+    {
+        public:
+            /* \brief Should the call site log now?
+             * \param periodMS the minimum delay between two lines, in milliseconds
+             * \return true if the line has to be logged. The next LogLine of this thread reports the suppressed lines */
+            bool allow(uint32_t periodMS);
+        private:
+            std::atomic<uint64_t> m_next{0};       /*!< The time (nanoseconds) from which the next line is allowed*/
+            std::atomic<uint32_t> m_suppressed{0}; /*!< The lines suppressed since the last one*/
+    };
+
+    /* \brief Get the offset of the file name in a path, at compile time (see __FILENAME__)
+     * \param path the path
+     * \return the offset of the character following the last '/' */
+    constexpr size_t logBasenameOffset(const char* path)
+    {
+        size_t offset = 0;
+        for(size_t i = 0; path[i] != '\0'; i++)
+            if(path[i] == '/')
+                offset = i+1;
+        return offset;
+    }
+}
+
+#define SERENO_LOG(level) \
+    !(SERENO_LOG_LEVEL >= (level)) ? (void)0 : sereno::LogVoidify() & sereno::LogLine((level), __FILENAME__, __LINE__)
+
+#define SERENO_LOG_RATE_LIMITED(level, periodMS) \
+    !(SERENO_LOG_LEVEL >= (level) && ([]() -> sereno::LogRateLimiter& {static sereno::LogRateLimiter limiter; return limiter;})().allow(periodMS)) ? \
+    (void)0 : sereno::LogVoidify() & sereno::LogLine((level), __FILENAME__, __LINE__)
+
+#endif
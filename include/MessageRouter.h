@@ -0,0 +1,185 @@
+#ifndef  MESSAGEROUTER_INC
+#define  MESSAGEROUTER_INC
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/* \brief Pin the wire offset of a field of a routed message, e.g., SERENO_MESSAGE_FIELD_AT(MoveMsg, x, 4) */
+#define SERENO_MESSAGE_FIELD_AT(Msg, field, offset) \
+    static_assert(offsetof(Msg, field) == (offset), #Msg "::" #field " is not at offset " #offset)
+
+namespace sereno
+{
+    /* \brief A typed view over a received message (see MessageRouter) : the fixed part is read in place, without copy.
+     * Valid during the handler call only, as the receive buffer */
+    template <typename T>
+    struct MessageView
+    {
+        const T*       msg;      /*!< The fixed part of the message*/
+        const uint8_t* tail;     /*!< The bytes following the fixed part (variable-size data), if any*/
+        uint32_t       tailSize; /*!< The tail size*/
+
+        const T* operator->() const {return msg;}
+        const T& operator*() const  {return *msg;}
+    };
+
+    /* \brief The compile-time checks of MessageRouter */
+    namespace routerDetail
+    {
+        template <typename T, typename... List>
+        struct Contains : std::false_type {};
+
+        template <typename T, typename Head, typename... List>
+        struct Contains<T, Head, List...> : std::conditional<std::is_same<T, Head>::value, std::true_type, Contains<T, List...>>::type {};
+
+        template <typename Id, typename... Msgs>
+        constexpr Id maxTypeID()
+        {
+            Id ids[] = {Msgs::TYPE_ID...};
+            Id max   = 0;
+            for(Id id : ids)
+                if(id > max)
+                    max = id;
+            return max;
+        }
+
+        template <typename Id, typename... Msgs>
+        constexpr bool uniqueTypeIDs()
+        {
+            Id ids[] = {Msgs::TYPE_ID...};
+            for(size_t i = 0; i < sizeof...(Msgs); i++)
+                for(size_t j = i+1; j < sizeof...(Msgs); j++)
+                    if(ids[i] == ids[j])
+                        return false;
+            return true;
+        }
+
+        /* \brief Can a received message be read through a const T* at any offset? */
+        template <typename T>
+        struct IsWireLayout : std::integral_constant<bool, std::is_standard_layout<T>::value && std::is_trivially_copyable<T>::value &&
+                                                           alignof(T) == 1> {};
+
+        template <typename... Msgs>
+        constexpr bool allWireLayout()
+        {
+            bool layouts[] = {IsWireLayout<Msgs>::value...};
+            for(bool layout : layouts)
+                if(!layout)
+                    return false;
+            return true;
+        }
+    }
+
+    /* \brief Dispatch the messages of an application protocol to typed handlers, in place of a switch over the message type in onMessage.
+     * A message is [Id type ID (host byte order)][fixed part : Msg][tail]. Each Msg is a packed (alignof == 1) standard layout struct
+     * with a static TYPE_ID, e.g.,
+     *     struct __attribute__((packed)) MoveMsg {static const uint16_t TYPE_ID = 3; uint32_t entity; float x, y, z;};
+     *
+     * The message list fixes the dispatch table at compile time : a dense array indexed by the type ID, the IDs being checked unique
+     * and the layouts readable in place (SERENO_MESSAGE_FIELD_AT pins the field offsets of the protocol). Handlers are registered with
+     * on<Msg>(handler) before the Server is launched, and are called from the handle messages threads with a MessageView over the
+     * receive buffer. Dispatching is one indirect call : a functor or lambda handler is inlined in its table entry
+     * \param C the client type
+     * \param Id the type ID type (uint8_t, uint16_t...). The table has maxTypeID+1 entries
+     * \param Msgs the message types */
+    template <typename C, typename Id, typename... Msgs>
+    class MessageRouter
+    {
+        static_assert(std::is_integral<Id>::value && std::is_unsigned<Id>::value, "The type ID has to be an unsigned integer");
+        static_assert(sizeof...(Msgs) > 0, "A MessageRouter needs at least one message type");
+        static_assert(routerDetail::uniqueTypeIDs<Id, Msgs...>(), "Two message types share a TYPE_ID");
+        static_assert(routerDetail::allWireLayout<Msgs...>(),
+                      "The message types have to be packed (alignof == 1), standard layout and trivially copyable structs");
+        static_assert(routerDetail::maxTypeID<Id, Msgs...>() < 4096, "The TYPE_IDs are too sparse for a dense dispatch table");
+
+        public:
+            /* \brief The number of entries of the dispatch table */
+            static const uint32_t TABLE_SIZE = routerDetail::maxTypeID<Id, Msgs...>() + 1;
+
+            /* \brief The size of the type ID preceding each message */
+            static const uint32_t HEADER_SIZE = sizeof(Id);
+
+            MessageRouter()
+            {
+                m_table.fill(Entry{&MessageRouter::unknown, NULL});
+            }
+
+            /* \brief Register the handler of a message type, replacing the previous one. Not thread safe : register before launching the Server
+             * \param handler called as handler(C* client, const MessageView<Msg>& msg). Copied in the router */
+            template <typename Msg, typename F>
+            void on(F&& handler)
+            {
+                static_assert(routerDetail::Contains<Msg, Msgs...>::value, "Msg is not in the message list of this MessageRouter");
+
+                typedef typename std::decay<F>::type Handler;
+                std::shared_ptr<Handler> h = std::make_shared<Handler>(std::forward<F>(handler));
+                m_table[Msg::TYPE_ID]      = Entry{&MessageRouter::call<Msg, Handler>, h.get()};
+                m_handlers[Msg::TYPE_ID]   = std::move(h);
+            }
+
+            /* \brief Remove the handler of a message type. Not thread safe, see on */
+            template <typename Msg>
+            void off()
+            {
+                static_assert(routerDetail::Contains<Msg, Msgs...>::value, "Msg is not in the message list of this MessageRouter");
+                m_table[Msg::TYPE_ID] = Entry{&MessageRouter::unknown, NULL};
+                m_handlers[Msg::TYPE_ID].reset();
+            }
+
+            /* \brief Call the handler of a message, e.g., from Server::onMessage
+             * \param client the client which sent the message
+             * \param data the message : [type ID][fixed part][tail]
+             * \param size the message size
+             * \return false if the type has no handler or if the message is shorter than its fixed part (the client should be closed) */
+            bool dispatch(C* client, const uint8_t* data, uint32_t size) const
+            {
+                if(size < HEADER_SIZE)
+                    return false;
+                Id id;
+                memcpy(&id, data, sizeof(Id));
+                if(id >= TABLE_SIZE)
+                    return false;
+                const Entry& entry = m_table[id];
+                return entry.call(entry.handler, client, data + HEADER_SIZE, size - HEADER_SIZE);
+            }
+
+            /* \brief Does a message type have a handler?
+             * \param id the type ID
+             * \return true if yes, false otherwise */
+            bool isRouted(Id id) const {return id < TABLE_SIZE && m_table[id].handler != NULL;}
+        private:
+            typedef bool (*Call)(void* handler, C* client, const uint8_t* data, uint32_t size);
+
+            /* \brief An entry of the dispatch table */
+            struct Entry
+            {
+                Call  call;    /*!< Check the size and call the handler*/
+                void* handler; /*!< The handler, owned by m_handlers*/
+            };
+
+            template <typename Msg, typename Handler>
+            static bool call(void* handler, C* client, const uint8_t* data, uint32_t size)
+            {
+                if(size < sizeof(Msg))
+                    return false;
+                MessageView<Msg> view{reinterpret_cast<const Msg*>(data), data + sizeof(Msg), (uint32_t)(size - sizeof(Msg))};
+                (*static_cast<Handler*>(handler))(client, view);
+                return true;
+            }
+
+            static bool unknown(void* handler, C* client, const uint8_t* data, uint32_t size)
+            {
+                return false;
+            }
+
+            std::array<Entry, TABLE_SIZE>                 m_table;    /*!< The dispatch table, indexed by the type ID*/
+            std::array<std::shared_ptr<void>, TABLE_SIZE> m_handlers; /*!< The registered handlers*/
+    };
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef  PRIORITYLANES_INC
+#define  PRIORITYLANES_INC
+
+#include <cstdint>
+#include <vector>
+
+namespace sereno
+{
+    /* \brief The priority lanes of the inbound (handler) and outbound (ClientSocket) queues. Lower is more urgent */
+    enum PacketPriority
+    {
+        PRIORITY_CONTROL = 0, /*!< Small latency-critical messages*/
+        PRIORITY_NORMAL,      /*!< The default lane*/
+        PRIORITY_BULK,        /*!< Large transfers*/
+        PRIORITY_COUNT
+    };
+
+    /* \brief Choose which lane to serve next.
+     * Without weights the scheduling is strict-priority : the most urgent non empty lane is always served first.
+     * With weights it is a deficit round robin : each lane receives weights[lane] credits per round and each served element
+     * costs its size (bytes for outbound queues, 1 for inbound messages) */
+    class LaneScheduler
+    {
+        public:
+            /* \brief Set the lane weights
+             * \param weights the credits of each lane per round (PRIORITY_COUNT values, all > 0). Empty == strict-priority */
+            void setWeights(const std::vector<uint32_t>& weights)
+            {
+                m_weights.clear();
+                if(weights.size() != PRIORITY_COUNT)
+                    return;
+                for(uint32_t w : weights)
+                    if(w == 0)
+                        return;
+                m_weights = weights;
+                for(uint32_t i = 0; i < PRIORITY_COUNT; i++)
+                    m_deficit[i] = 0;
+                m_current    = 0;
+                m_deficit[0] = m_weights[0];
+            }
+
+            /* \brief Get the next lane to serve
+             * \param isEmpty function telling whether a lane is empty, isEmpty(lane) -> bool
+             * \return the lane to serve, -1 if every lane is empty */
+            template <typename IsEmpty>
+            int next(IsEmpty isEmpty)
+            {
+                bool empty = true;
+                for(int i = 0; i < PRIORITY_COUNT && empty; i++)
+                    if(!isEmpty(i))
+                    {
+                        if(m_weights.empty())
+                            return i;
+                        empty = false;
+                    }
+                if(empty)
+                    return -1;
+
+                //Deficit round robin. Terminates as each round gives positive credits
+                while(true)
+                {
+                    if(isEmpty(m_current))
+                        m_deficit[m_current] = 0;
+                    else if(m_deficit[m_current] > 0)
+                        return m_current;
+
+                    m_current = (m_current+1) % PRIORITY_COUNT;
+                    m_deficit[m_current] += m_weights[m_current];
+                }
+            }
+
+            /* \brief Charge a lane for a served element
+             * \param lane the lane served
+             * \param cost the element cost */
+            void consume(int lane, uint32_t cost)
+            {
+                if(!m_weights.empty())
+                    m_deficit[lane] -= cost;
+            }
+        private:
+            std::vector<uint32_t> m_weights;                 /*!< The lane weights. Empty == strict-priority*/
+            int64_t               m_deficit[PRIORITY_COUNT]{}; /*!< The credits of each lane*/
+            int                   m_current = 0;           /*!< The lane currently served (round robin)*/
+    };
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef  SCRATCHARENA_INC
+#define  SCRATCHARENA_INC
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+#include "Buffer.h"
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define SERENO_HAVE_PMR
+#endif
+#endif
+
+namespace sereno
+{
+    /* \brief When the Server resets the scratch arena of a handle messages thread (see Server::getScratchArena) */
+    enum ScratchReset
+    {
+        SCRATCH_RESET_BATCH   = 0, /*!< After each received read, i.e., every message the framing extracted from it*/
+        SCRATCH_RESET_MESSAGE = 1  /*!< After each onMessage (and onFrameEnd) call*/
+    };
+
+    /* \brief The configuration of a ScratchArena */
+    struct ScratchArenaConfig
+    {
+        uint32_t     chunkSize     = (1u << 16);          /*!< The size of the chunks. Larger allocations get their own chunk*/
+        uint32_t     maxFreeChunks = 4;                   /*!< The chunks kept for reuse after a reset*/
+        ScratchReset reset         = SCRATCH_RESET_BATCH; /*!< When the Server resets the arena*/
+    };
+
+    /* \brief The counters of a ScratchArena */
+    struct ScratchArenaStats
+    {
+        uint64_t nbAllocations = 0; /*!< The allocations served*/
+        uint64_t nbChunks      = 0; /*!< The chunks allocated with malloc (the arena is warm once it stops growing)*/
+        uint64_t nbPromotions  = 0; /*!< The buffers promoted (see ScratchArena::promote)*/
+        uint64_t nbResets      = 0; /*!< The resets of a non-empty arena*/
+        uint64_t peakBytes     = 0; /*!< The largest number of bytes in use between two resets*/
+    };
+
+    /* \brief A bump allocator for the temporary memory of a handler, owned by one thread : allocations move a pointer in a chunk
+     * and nothing is freed until reset, which gives every chunk back at once. The chunks are Buffers : a reply built in the arena
+     * is promoted to a Buffer sharing its chunk and pushed without copy (ClientSocket::pushPacket). A chunk still referenced by a
+     * promoted buffer at reset is left to it, and freed once written. Not thread safe */
+    class ScratchArena
+    {
+        public:
+            /* \brief Constructor
+             * \param config the arena configuration */
+            ScratchArena(const ScratchArenaConfig& config = ScratchArenaConfig());
+
+            ScratchArena(const ScratchArena&) = delete;
+            ScratchArena& operator=(const ScratchArena&) = delete;
+
+            /* \brief Set the configuration. Resets the arena
+             * \param config the arena configuration */
+            void setConfig(const ScratchArenaConfig& config);
+
+            /* \brief Allocate memory, valid until the next reset
+             * \param size the memory size
+             * \param align the alignment (a power of two)
+             * \return the memory. Throws std::bad_alloc if malloc fails, as operator new */
+            void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+            /* \brief Share memory of this arena as a Buffer, without copying it. Do not modify the memory afterwards
+             * \param data memory returned by allocate
+             * \param size the memory size
+             * \return the buffer, empty if data is not in this arena */
+            Buffer promote(const void* data, uint32_t size);
+
+            /* \brief Give every allocation back at once. The memory allocated since the last reset becomes invalid */
+            void reset();
+
+            /* \brief Get the bytes allocated since the last reset
+             * \return the bytes, alignment included */
+            uint64_t getUsedBytes() const {return m_usedBytes;}
+
+            /* \brief Get the counters of this arena
+             * \return the counters */
+            const ScratchArenaStats& getStats() const {return m_stats;}
+
+            const ScratchArenaConfig& getConfig() const {return m_config;}
+        private:
+            /* \brief Make a new chunk the current one
+             * \param size the minimum chunk size */
+            void nextChunk(size_t size);
+
+            ScratchArenaConfig  m_config;        /*!< The configuration*/
+            std::vector<Buffer> m_chunks;        /*!< The chunks used since the last reset. The last one is the current one*/
+            std::vector<Buffer> m_largeChunks;   /*!< The chunks of the large allocations since the last reset*/
+            std::vector<Buffer> m_freeChunks;    /*!< The chunks kept for reuse*/
+            uint32_t            m_offset    = 0; /*!< The first free byte of the current chunk*/
+            uint64_t            m_usedBytes = 0; /*!< The bytes allocated since the last reset*/
+            ScratchArenaStats   m_stats;         /*!< The counters*/
+    };
+
+    /* \brief A standard allocator over a ScratchArena, for the containers of a handler :
+     * ScratchVector<T> v(server.getScratchArena(bufID)), or std::vector<T, ArenaAllocator<T>>.
+     * deallocate does nothing : the memory comes back with the arena reset */
+    template <typename T>
+    class ArenaAllocator
+    {
+        public:
+            typedef T value_type;
+
+            ArenaAllocator(ScratchArena& arena) : m_arena(&arena) {}
+
+            template <typename U>
+            ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.getArena()) {}
+
+            T* allocate(size_t n)               {return static_cast<T*>(m_arena->allocate(n*sizeof(T), alignof(T)));}
+            void deallocate(T* data, size_t n)  {}
+
+            ScratchArena* getArena() const {return m_arena;}
+
+            template <typename U>
+            bool operator==(const ArenaAllocator<U>& other) const {return m_arena == other.getArena();}
+
+            template <typename U>
+            bool operator!=(const ArenaAllocator<U>& other) const {return m_arena != other.getArena();}
+        private:
+            ScratchArena* m_arena; /*!< The arena*/
+    };
+
+    /* \brief A vector in a ScratchArena */
+    template <typename T>
+    using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+
+    /* \brief A string in a ScratchArena */
+    typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ScratchString;
+
+#ifdef SERENO_HAVE_PMR
+    /* \brief A std::pmr::memory_resource over a ScratchArena (C++17 applications), e.g.,
+     * ScratchResource res(server.getScratchArena(bufID)); std::pmr::vector<int> v(&res); */
+    class ScratchResource : public std::pmr::memory_resource
+    {
+        public:
+            ScratchResource(ScratchArena& arena) : m_arena(&arena) {}
+        protected:
+            void* do_allocate(size_t size, size_t align) override           {return m_arena->allocate(size, align);}
+            void  do_deallocate(void* data, size_t size, size_t align) override {}
+            bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept override {return this == &other;}
+        private:
+            ScratchArena* m_arena; /*!< The arena*/
+    };
+#endif
+}
+
+#endif
@@ -7,61 +7,95 @@
 #include <sys/socket.h>
 #include <sys/poll.h>
 #include <sys/ioctl.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstdio>
+#include <cerrno>
 #include <cstdlib>
 #include <pthread.h>
 #include <cstring>
 #include <dlfcn.h>
 #include <cstdint>
+#include <algorithm>
 #include <queue>
 #include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
 #include <pthread.h>
 
 #include "ClientSocket.h"
+#include "SharedMemoryChannel.h"
+#include "ThreadConfig.h"
+#include "SocketOptions.h"
+#include "ServerPolicies.h"
+#include "TrafficCapture.h"
+#include "TopicRegistry.h"
+#include "PriorityLanes.h"
+#include "AdmissionControl.h"
+#include "Buffer.h"
+#include "HandlerPool.h"
+#include "ScratchArena.h"
+#include "Transport.h"
 #include "Types/ServerType.h"
 #include "ConcurrentVector.h"
 #include "utils.h"
 
 namespace sereno
 {
+    /* \brief How long (nanoseconds) a listener is not polled when connections cannot be accepted for a lack of descriptors or memory */
+    static const uint64_t ACCEPT_PAUSE_NS = 100000000;
 
     /* \brief The Message received by the Server. */
     template <typename T>
     struct SocketMessage
     {
         T client; /*!< The client who sends this message*/
-        std::shared_ptr<uint8_t> data;   /*!< The message*/
+        Buffer        data;              /*!< The message*/
         uint32_t      size;              /*!< The data size*/
+        uint8_t       priority;          /*!< The lane (PacketPriority) of this message*/
+        uint64_t      time;              /*!< The time (nanoseconds) the message was queued. 0 if not measured*/
 
         /* \brief Constructor
          * \param c the client who sends the message
          * \param d the client's data
-         * \param s the data size in bytes */
-        SocketMessage(T c, std::shared_ptr<uint8_t> d, uint32_t s) : client(c), data(d), size(s)
-        {}
-
-        /* \brief Operator= For SocketMessage. Called the copy constructor */
-        SocketMessage& operator=(const SocketMessage<T>& copy)
+         * \param s the data size in bytes
+         * \param p the lane (PacketPriority) of this message
+         * \param t the time (nanoseconds) the message was queued */
+        SocketMessage(T c, Buffer d, uint8_t p = PRIORITY_NORMAL, uint64_t t = 0) : client(c), data(std::move(d)), priority(p), time(t)
         {
-            if(this == &copy)
-                return *this;
-
-            new(this) SocketMessage(copy);
-            return *this;
+            size = data.size();
         }
+
+        /* \brief Constructor
+         * \param c the client who sends the message
+         * \param d the client's data
+         * \param s the data size in bytes
+         * \param p the lane (PacketPriority) of this message
+         * \param t the time (nanoseconds) the message was queued */
+        SocketMessage(T c, std::shared_ptr<uint8_t> d, uint32_t s, uint8_t p = PRIORITY_NORMAL, uint64_t t = 0) : SocketMessage(c, Buffer::wrap(std::move(d), s), p, t)
+        {}
     };
 
     /* \brief The Class Server. It will handles all the communication part with all the potential clients
-     * The type T must extends from ClientSocket */
-    template <typename T>
+     * The type T must extends from ClientSocket.
+     * Policies are policy setters (see ServerPolicies.h) resolved at compile time, e.g.,
+     * Server<MyClient, LockIs<SpinLock>, WaitIs<SpinWait>, DispatchIs<StaticDispatch<MyServer>>> */
+    template <typename T, typename... Policies>
     class Server
     {
         public:
+            typedef ServerPolicies<Policies...>                        Policy;       /*!< The policies in use*/
+            typedef typename Policy::template Queue<SocketMessage<T*>> MessageQueue; /*!< The handle messages thread queue type*/
+            typedef typename Policy::Lock                              BufferLock;   /*!< The handle messages thread queue lock type*/
+
 
             /*----------------------------------------------------------------------------*/
             /*------------------------------PUBLIC FUNCTIONS------------------------------*/
@@ -72,17 +106,22 @@ namespace sereno
              * \param port the port to open*/
             Server(uint32_t nbReadThread, uint32_t port) : m_nbReadThread(nbReadThread), m_port(port)
             {
-                //Allocate memory for the handle messages thread
-                m_buffers       = new std::queue<SocketMessage<T*>>[nbReadThread];
-                m_handleThread  = new std::thread*[nbReadThread];
-                for(uint32_t i = 0; i < nbReadThread; i++)
-                    m_handleThread[i] = NULL;
-                m_bufferMutexes = new std::mutex[nbReadThread];
+                allocHandleThreads();
+            }
+
+            /** \brief Server constructor. Initialize a Server listening only on a UNIX domain socket (no TCP port)
+             * \param nbReadThread the number of thread which will handle the received messages
+             * \param unixPath the UNIX socket file path to open
+             * \param unixType the UNIX socket type (SOCK_STREAM or SOCK_SEQPACKET)*/
+            Server(uint32_t nbReadThread, const std::string& unixPath, int unixType = SOCK_STREAM) : m_nbReadThread(nbReadThread), m_port(0), m_useTCP(false)
+            {
+                allocHandleThreads();
+                addUnixSocket(unixPath, unixType);
             }
 
             /** \brief the movement constructor
              * \param mvt the object to move*/
-            Server(Server&& mvt) : m_clients(std::move(mvt.m_clients)), m_clientTable(std::move(mvt.m_clientTable))
+            Server(Server&& mvt) : m_clients(std::move(mvt.m_clients)), m_clientTable(std::move(mvt.m_clientTable)), m_shmChannels(std::move(mvt.m_shmChannels)), m_listeners(std::move(mvt.m_listeners))
             {
                 //Copy data
                 m_sock          = mvt.m_sock;
@@ -92,9 +131,20 @@ namespace sereno
                 m_handleThread  = mvt.m_handleThread;
                 m_writeThread   = mvt.m_writeThread;
                 m_buffers       = mvt.m_buffers;
+                m_bufferMutexes    = mvt.m_bufferMutexes;
+                m_bufferSchedulers = mvt.m_bufferSchedulers;
+                m_handlerStates    = mvt.m_handlerStates;
+                m_scratchArenas    = mvt.m_scratchArenas;
+                m_adaptive         = mvt.m_adaptive;
+                m_adaptiveEnabled  = mvt.m_adaptiveEnabled;
                 m_nbReadThread  = mvt.m_nbReadThread;
                 m_currentBuffer = mvt.m_currentBuffer;
                 m_port          = mvt.m_port;
+                m_useTCP        = mvt.m_useTCP;
+                m_threadConfig  = mvt.m_threadConfig;
+                m_backlog       = mvt.m_backlog;
+                m_socketOptions = mvt.m_socketOptions;
+                m_capture       = std::move(mvt.m_capture);
 
                 //reset mvt
                 mvt.m_sock          = SOCKET_ERROR;
@@ -104,6 +154,10 @@ namespace sereno
                 mvt.m_handleThread  = NULL;
                 mvt.m_writeThread   = NULL;
                 mvt.m_buffers       = NULL;
+                mvt.m_bufferMutexes    = NULL;
+                mvt.m_bufferSchedulers = NULL;
+                mvt.m_handlerStates    = NULL;
+                mvt.m_scratchArenas    = NULL;
                 mvt.m_nbReadThread  = 0;
                 mvt.m_currentBuffer = 0;
             }
@@ -126,6 +180,12 @@ namespace sereno
                 }
                 if(m_bufferMutexes)
                     delete[] m_bufferMutexes;
+                if(m_bufferSchedulers)
+                    delete[] m_bufferSchedulers;
+                if(m_handlerStates)
+                    delete[] m_handlerStates;
+                if(m_scratchArenas)
+                    delete[] m_scratchArenas;
             }
 
             /* \brief Launch the Server and all the communication thread associated
@@ -134,55 +194,181 @@ namespace sereno
             {
                 if(m_isLaunch)
                     closeServer();
+
+                if(!m_useTCP && m_listeners.size() == 0)
+                {
+                    ERROR << "No TCP port nor UNIX socket to listen to\n";
+                    return false;
+                }
+
                 m_isLaunch = true;
                 m_closeThread = false;
-                //Create the socket and make it reusable
-                m_sock   = socket(AF_INET, SOCK_STREAM, 0);
-                int temp = 1;
-                setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(int));
-
-                 //The server address.
-                SOCKADDR_IN serverAddr;
-                serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-                serverAddr.sin_family      = AF_INET;
-                serverAddr.sin_port        = htons(m_port);
 
-                socklen_t serverLength = sizeof(serverAddr);
-                int sockErr;
+                //Open the TCP socket
+                if(m_useTCP)
+                {
+                    //Create the socket and make it reusable
+                    m_sock   = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                    int temp = 1;
+                    setsockopt(m_sock, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(int));
+
+                     //The server address.
+                    SOCKADDR_IN serverAddr;
+                    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+                    serverAddr.sin_family      = AF_INET;
+                    serverAddr.sin_port        = htons(m_port);
+
+                    socklen_t serverLength = sizeof(serverAddr);
+                    if(!bindAndListen(m_sock, (SOCKADDR*)&serverAddr, serverLength, m_socketOptions))
+                    {
+                        closeListeners();
+                        m_isLaunch = false;
+                        return false;
+                    }
+                }
 
-                if(m_sock != SOCKET_ERROR)
+                //Open the other listeners (TCP and UNIX)
+                for(auto& listener : m_listeners)
                 {
-                    sockErr = bind(m_sock, (SOCKADDR*)&serverAddr, serverLength);
-                    if(sockErr != SOCKET_ERROR)
+                    listener.sock = socket(listener.addr.ss_family, listener.type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                    if(listener.addr.ss_family == AF_UNIX)
                     {
-                        sockErr = listen(m_sock, 10);
-                        if(sockErr != SOCKET_ERROR)
-                        {
-                            //Launch every thread 
-                            m_acceptThread = new std::thread(&Server::acceptConnectionsThread, this);
-                            m_readThread   = new std::thread(&Server::readSocketsThread, this);
-                            m_writeThread  = new std::thread(&Server::writeSocketThread, this);
-                            for(uint32_t i = 0; i < m_nbReadThread; i++)
-                                m_handleThread[i] = new std::thread(&Server::handleMessagesThread, this, i);
-                        }
-                        else
-                        {
-                            ERROR << "Could not listen the server socket\n";
-                            return false;
-                        }
+                        //Remove a previous socket file which would make bind fail
+                        unlink(listener.path.c_str());
                     }
-                    else
+                    else if(listener.sock != SOCKET_ERROR)
                     {
-                        ERROR << "Could not bind the server socket\n";
+                        int temp = 1;
+                        setsockopt(listener.sock, SOL_SOCKET, SO_REUSEADDR, &temp, sizeof(int));
+                    }
+
+                    if(!bindAndListen(listener.sock, (SOCKADDR*)&listener.addr, listener.addrLen, listener.options))
+                    {
+                        closeListeners();
+                        m_isLaunch = false;
                         return false;
                     }
                 }
+
+                //Every handler is active, except in adaptive mode where the pool starts at its minimum
+                m_nbActiveHandlers = m_adaptiveEnabled ? m_adaptive.minHandlers : m_nbReadThread;
+                m_currentBuffer    = 0;
+                m_nbScaleUp        = 0;
+                m_nbScaleDown      = 0;
+                m_nbMigrations     = 0;
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                {
+                    m_handlerStates[i].active  = (i < m_nbActiveHandlers);
+                    m_handlerStates[i].depth   = 0;
+                    m_handlerStates[i].latency = 0;
+                }
+
+                //Launch every thread 
+                m_acceptThread = new std::thread(&Server::acceptConnectionsThread, this);
+                m_readThread   = new std::thread(&Server::readSocketsThread, this);
+                m_writeThread  = new std::thread(&Server::writeSocketThread, this);
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                    m_handleThread[i] = new std::thread(&Server::handleMessagesThread, this, i);
+                if(m_adaptiveEnabled)
+                    m_scaleThread = new std::thread(&Server::scaleHandlersThread, this);
+
+                return true;
+            }
+
+            /* \brief Add a TCP port on which the Server will listen, in addition to the port of the constructor (if any).
+             * Every listener shares the threads of the Server : its clients only differ by their ClientSocket::listenerID.
+             * Has to be called before launch
+             * \param listenerID the ID given to the clients of this listener (see ClientSocket::listenerID and createClient)
+             * \param port the port to open
+             * \param address the IPv4 or IPv6 address to bind, e.g., "127.0.0.1" or "::1". Empty == every IPv4 address
+             * \param options the socket options applied to this listener and to its clients
+             * \return true on success, false if the address is not valid*/
+            bool addTCPListener(uint32_t listenerID, uint16_t port, const std::string& address = "", const SocketOptions& options = SocketOptions())
+            {
+                Listener listener;
+                memset(&listener.addr, 0, sizeof(listener.addr));
+                struct sockaddr_in*  in  = (struct sockaddr_in*)&listener.addr;
+                struct sockaddr_in6* in6 = (struct sockaddr_in6*)&listener.addr;
+                if(address.size() == 0 || inet_pton(AF_INET, address.c_str(), &in->sin_addr) == 1)
+                {
+                    in->sin_family   = AF_INET;
+                    in->sin_port     = htons(port);
+                    listener.addrLen = sizeof(*in);
+                    if(address.size() == 0)
+                        in->sin_addr.s_addr = htonl(INADDR_ANY);
+                }
+                else if(inet_pton(AF_INET6, address.c_str(), &in6->sin6_addr) == 1)
+                {
+                    in6->sin6_family = AF_INET6;
+                    in6->sin6_port   = htons(port);
+                    listener.addrLen = sizeof(*in6);
+                }
                 else
                 {
-                    ERROR << "Could not create the server socket\n";
+                    ERROR << "The address " << address << " is not a valid IPv4 or IPv6 address\n";
                     return false;
                 }
 
+                listener.id      = listenerID;
+                listener.type    = SOCK_STREAM;
+                listener.options = options;
+                m_listeners.push_back(listener);
+                return true;
+            }
+
+            /* \brief Add a UNIX domain socket on which the Server will listen, in addition to the TCP port (if any).
+             * Clients connected through it go through the same ClientSocket and handler pipeline.
+             * Has to be called before launch
+             * \param path the UNIX socket file path
+             * \param type the UNIX socket type (SOCK_STREAM or SOCK_SEQPACKET)
+             * \param options the socket options applied to this listener and to its clients
+             * \param listenerID the ID given to the clients of this listener (see ClientSocket::listenerID and createClient)
+             * \return true on success, false if the path is too long or the type is not supported*/
+            bool addUnixSocket(const std::string& path = SOCK_PATH, int type = SOCK_STREAM, const SocketOptions& options = SocketOptions(),
+                               uint32_t listenerID = DEFAULT_LISTENER_ID)
+            {
+                if(path.size() >= sizeof(((struct sockaddr_un*)NULL)->sun_path))
+                {
+                    ERROR << "The UNIX socket path " << path << " is too long\n";
+                    return false;
+                }
+
+                if(type != SOCK_STREAM && type != SOCK_SEQPACKET)
+                {
+                    ERROR << "The UNIX socket type " << type << " is not supported\n";
+                    return false;
+                }
+
+                Listener listener;
+                struct sockaddr_un* unixAddr = (struct sockaddr_un*)&listener.addr;
+                memset(&listener.addr, 0, sizeof(listener.addr));
+                unixAddr->sun_family = AF_UNIX;
+                strncpy(unixAddr->sun_path, path.c_str(), sizeof(unixAddr->sun_path)-1);
+                listener.addrLen = sizeof(*unixAddr);
+
+                listener.id      = listenerID;
+                listener.type    = type;
+                listener.path    = path;
+                listener.options = options;
+                m_listeners.push_back(listener);
+                return true;
+            }
+
+            /* \brief Add a UNIX control socket for same-host clients using a shared memory transport.
+             * Every client connecting to it receives a memfd holding two rings (one per direction) and their eventfd doorbells
+             * (see SharedMemoryChannel::connect). Messages then go through the rings and arrive in onMessage like TCP ones.
+             * Has to be called before launch
+             * \param path the UNIX control socket file path
+             * \param ringSize the size in bytes of each ring
+             * \param options the socket options applied to this control socket and to its clients
+             * \param listenerID the ID given to the clients of this listener (see ClientSocket::listenerID and createClient)
+             * \return true on success, false otherwise*/
+            bool addSharedMemorySocket(const std::string& path, uint32_t ringSize = 1 << 20, const SocketOptions& options = SocketOptions(),
+                                       uint32_t listenerID = DEFAULT_LISTENER_ID)
+            {
+                if(!addUnixSocket(path, SOCK_STREAM, options, listenerID))
+                    return false;
+                m_listeners.back().shmRingSize = ringSize;
                 return true;
             }
 
@@ -191,12 +377,9 @@ namespace sereno
                 if(!m_isLaunch)
                     return;
 
-                /* Close every Threads */
+                /* Close every Threads. The accept thread polls the listening sockets and stops by itself */
                 m_closeThread = true;
-                if(m_acceptThread && m_acceptThread->joinable())
-                {
-                    pthread_cancel(m_acceptThread->native_handle());
-                }
+                m_parkCond.notify_all();
 
                 if(m_handleThread)
                 {
@@ -214,8 +397,12 @@ namespace sereno
 
                 for(uint32_t i = 0; i < m_nbReadThread; i++)
                 {
-                    while(!m_buffers[i].empty())
-                        m_buffers[i].pop();
+                    for(uint32_t j = 0; j < PRIORITY_COUNT; j++)
+                        while(!getBuffer(i, j).empty())
+                        {
+                            getBuffer(i, j).front().client->release();
+                            getBuffer(i, j).pop();
+                        }
 
                     while(!m_bufferMutexes[i].try_lock())
                         m_bufferMutexes[i].unlock();
@@ -247,6 +434,11 @@ namespace sereno
                     m_readThread->join();
                 }
 
+                if(m_scaleThread && m_scaleThread->joinable())
+                {
+                    m_scaleThread->join();
+                }
+
                 if(m_handleThread)
                 {
                     for(uint32_t i = 0; i < m_nbReadThread; i++)
@@ -281,9 +473,11 @@ namespace sereno
                 //
                 //The server
                 INFO << "Close the Socket\n";
-                if(m_sock != SOCKET_ERROR)
-                    close(m_sock);
-                m_sock = SOCKET_ERROR;
+                closeListeners();
+
+                //Flush the capture
+                if(m_capture)
+                    m_capture->close();
 
                 //The clients
                 m_mapMutex.lock();
@@ -309,6 +503,12 @@ namespace sereno
                     m_writeThread = NULL;
                 }
 
+                if(m_scaleThread)
+                {
+                    delete m_scaleThread;
+                    m_scaleThread = NULL;
+                }
+
                 if(m_handleThread)
                 {
                     for(uint32_t i = 0; i < m_nbReadThread; i++)
@@ -323,14 +523,326 @@ namespace sereno
 
                 //Empty data
                 m_clients.clear();
+                m_seqpacketClients.clear();
+                m_topics.clear();
+
+                //The close requests left by the read thread : their clients are closed with the others
+                for(T* client : m_closeRequests)
+                    client->release();
+                m_closeRequests.clear();
 
+                //Drop the references of the table. Clients still referenced by a message are deleted with it
                 for(auto& client : m_clientTable)
-                    delete client.second;
+                    client.second->release();
                 m_clientTable.clear();
+                m_shmChannels.clear();
+                m_admission.clear();
 
                 m_isLaunch = false;
             }
 
+            /** \brief  Set the threading configuration (CPU affinity, thread names). Has to be called before launch
+             * \param config the new threading configuration */
+            void setThreadConfig(const ThreadConfig& config) {m_threadConfig = config;}
+
+            /** \brief  Get the threading configuration
+             * \return   the threading configuration */
+            const ThreadConfig& getThreadConfig() const {return m_threadConfig;}
+
+            /** \brief  Set the listen backlog of every listening socket (SOMAXCONN by default). Has to be called before launch
+             * \param backlog the maximum number of pending connections */
+            void setListenBacklog(int backlog) {m_backlog = backlog;}
+
+            /** \brief  Set the socket options applied to the TCP listening socket and to its clients. Has to be called before launch
+             * \param options the socket options policy */
+            void setSocketOptions(const SocketOptions& options) {m_socketOptions = options;}
+
+            /** \brief  Get the admission control (connection caps and rate limits) of this Server. Has to be configured before launch
+             * \return   the admission control */
+            AdmissionControl& getAdmissionControl() {return m_admission;}
+
+            /** \brief  Capture every inbound chunk (timestamp, client, bytes) to a memory-mapped segmented log, see TrafficCapture.
+             * The capture can be replayed with TrafficReplay. Has to be called before launch
+             * \param directory the directory (must exist) where to write the capture segments
+             * \param segmentSize the size of each segment in bytes */
+            void enableCapture(const std::string& directory, uint64_t segmentSize = 64 << 20)
+            {
+                m_capture.reset(new TrafficCapture(directory, segmentSize));
+            }
+
+            /** \brief  Stop the traffic capture. Has to be called while the Server is not launched */
+            void disableCapture() {m_capture.reset();}
+
+            /** \brief  Register an already connected socket (e.g., one end of a socketpair) as a new client
+             * \param sock the connected socket. The Server takes its ownership
+             * \param transport the transport of sock. NULL == a BSD socket (SocketTransport). The connections of a transport which are
+             * not kernel sockets (e.g., MemoryTransport) are not polled : their data have to be given with injectData
+             * \param listenerID the listener ID of the client (see ClientSocket::listenerID and createClient)
+             * \return   the ClientSocket created */
+            T* adoptClient(SOCKET sock, Transport* transport = NULL, uint32_t listenerID = DEFAULT_LISTENER_ID)
+            {
+                struct sockaddr_storage addr;
+                if(transport == NULL)
+                    transport = SocketTransport::get();
+                if(transport->isKernelSocket())
+                {
+                    //The peer address : the admission caps and ClientSocket::sockAddr are per remote IP
+                    socklen_t addrLen = sizeof(addr);
+                    if(getpeername(sock, (SOCKADDR*)&addr, &addrLen) == SOCKET_ERROR)
+                        addr.ss_family = AF_UNIX;
+                }
+                else
+                {
+                    memset(&addr, 0, sizeof(addr));
+                    addr.ss_family = AF_UNSPEC;
+                }
+                m_admission.admit(sock, addr, false);
+                return registerClient(sock, addr, NULL, transport, listenerID);
+            }
+
+            /** \brief  Close a client from the application side, as if it had disconnected. The read thread closes it (see requestClose)
+             * \param client the client socket
+             * \return   true if the client existed and was not being closed yet, false otherwise */
+            bool disconnectClient(SOCKET client)
+            {
+                T* cs = acquireClient(client);
+                if(cs == NULL)
+                    return false;
+                bool requested = requestClose(cs);
+                cs->release();
+                return requested;
+            }
+
+            /** \brief  Ask the read thread to close a client, e.g., from a handle messages thread on a protocol error.
+             * The client stops being fed at once. The read thread then unregisters and closes it, as on a disconnection
+             * \param client the client to close. The caller holds a reference on it
+             * \return   true for the first request, false if the client was already being closed */
+            bool requestClose(T* client)
+            {
+                if(!client->requestClose())
+                    return false;
+                client->acquire();
+                m_closeMutex.lock();
+                    m_closeRequests.push_back(client);
+                m_closeMutex.unlock();
+                return true;
+            }
+
+            /** \brief  Push data to the handle messages thread of a client as if it was read from its socket
+             * \param client the client socket
+             * \param data the data to copy
+             * \param size the data size
+             * \return   true if the client exists, false otherwise */
+            bool injectData(SOCKET client, const uint8_t* data, uint32_t size)
+            {
+                //Split the data as the read thread does
+                do
+                {
+                    uint32_t     count = std::min<uint32_t>(size, UniqueBuffer::maxSize<typename Policy::Allocator>());
+                    UniqueBuffer buf   = UniqueBuffer::allocateFrom<typename Policy::Allocator>(count);
+                    memcpy(buf.data(), data, count);
+                    if(!pushReceivedData(client, std::move(buf)))
+                        return false;
+                    data += count;
+                    size -= count;
+                }while(size > 0);
+                return true;
+            }
+
+            /** \brief  Send a file segment to a client through its outbound queue, with sendfile (no copy in user space)
+             * \param client the client socket
+             * \param fd the file descriptor. It is duplicated : the caller keeps the ownership of fd
+             * \param offset the segment offset in the file
+             * \param size the segment size
+             * \param priority the outbound lane (PacketPriority)
+             * \return   true on success, false if the client does not exist or fd could not be duplicated */
+            bool sendFile(SOCKET client, int fd, off_t offset, uint32_t size, uint8_t priority = PRIORITY_BULK)
+            {
+                T* cs = acquireClient(client);
+                if(cs == NULL)
+                    return false;
+                bool res = cs->pushFile(fd, offset, size, priority);
+                cs->release();
+                return res;
+            }
+
+            /** \brief  Send a large buffer to a client with MSG_ZEROCOPY, see ClientSocket::pushZeroCopy and SocketOptions::zeroCopy
+             * \param client the client socket
+             * \param data the data to send. It is kept until the kernel has sent it : do not modify it afterwards
+             * \param size the data size
+             * \param priority the outbound lane (PacketPriority)
+             * \return   true on success, false if the client does not exist */
+            bool sendZeroCopy(SOCKET client, std::shared_ptr<uint8_t> data, uint32_t size, uint8_t priority = PRIORITY_BULK)
+            {
+                return sendZeroCopy(client, Buffer::wrap(std::move(data), size), priority);
+            }
+
+            /** \brief  Send a large buffer to a client with MSG_ZEROCOPY, see sendZeroCopy(SOCKET, std::shared_ptr<uint8_t>, uint32_t, uint8_t)
+             * \param client the client socket
+             * \param data the data to send. It is kept until the kernel has sent it : do not modify it afterwards
+             * \param priority the outbound lane (PacketPriority)
+             * \return   true on success, false if the client does not exist */
+            bool sendZeroCopy(SOCKET client, Buffer data, uint8_t priority = PRIORITY_BULK)
+            {
+                T* cs = acquireClient(client);
+                if(cs == NULL)
+                    return false;
+                cs->pushZeroCopy(std::move(data), priority);
+                cs->release();
+                return true;
+            }
+
+            /** \brief  Subscribe a client to a topic. Subscriptions are removed automatically when the client is closed
+             * \param topic the topic name
+             * \param client the client to subscribe
+             * \return   true on success, false if the client was already subscribed or is closed */
+            bool subscribe(const std::string& topic, T* client)
+            {
+                //A handler may still run for a client closeClient already unsubscribed : it must not come back in the topics.
+                //closeClient unregisters it under m_mapMutex
+                bool res = false;
+                m_mapMutex.lock();
+                    auto it = m_clientTable.find(client->socket);
+                    if(it != m_clientTable.end() && it->second == client && client->isConnected())
+                        res = m_topics.subscribe(topic, client);
+                m_mapMutex.unlock();
+                return res;
+            }
+
+            /** \brief  Unsubscribe a client from a topic
+             * \param topic the topic name
+             * \param client the client to unsubscribe
+             * \return   true on success, false if the client was not subscribed */
+            bool unsubscribe(const std::string& topic, T* client) {return m_topics.unsubscribe(topic, client);}
+
+            /** \brief  Get a topic handle, to publish on it without looking the topic up at each publication
+             * \param topic the topic name
+             * \return   the topic */
+            std::shared_ptr<Topic<T>> getTopic(const std::string& topic) {return m_topics.getTopic(topic);}
+
+            /** \brief  Publish a message to every subscriber of a topic. The payload is shared (not copied) between the subscribers
+             * and pushed in their own outbound queue. Subscribers having compression enabled get it through ClientSocket::pushCompressed
+             * \param topic the topic
+             * \param data the payload
+             * \param size the payload size
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return   the number of subscribers the message was pushed to */
+            uint32_t publish(const Topic<T>& topic, std::shared_ptr<uint8_t> data, uint32_t size, uint8_t priority = PRIORITY_NORMAL)
+            {
+                return publish(topic, Buffer::wrap(std::move(data), size), priority);
+            }
+
+            /** \brief  Publish a message to every subscriber of a topic, see publish(const Topic<T>&, std::shared_ptr<uint8_t>, uint32_t)
+             * \param topic the topic
+             * \param data the payload. Each subscriber gets a handle on it
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return   the number of subscribers the message was pushed to */
+            uint32_t publish(const Topic<T>& topic, const Buffer& data, uint8_t priority = PRIORITY_NORMAL)
+            {
+                std::vector<T*> clients;
+                //The snapshot is read under m_mapMutex : clients are unsubscribed under it before being deleted.
+                //Each subscriber is referenced there and the messages are pushed out of the lock
+                m_mapMutex.lock();
+                    std::shared_ptr<const typename Topic<T>::Subscribers> subscribers = topic.getSubscribers();
+                    clients.reserve(subscribers->size());
+                    for(T* client : *subscribers)
+                    {
+                        if(client->isConnected())
+                        {
+                            client->acquire();
+                            clients.push_back(client);
+                        }
+                    }
+                m_mapMutex.unlock();
+
+                for(T* client : clients)
+                {
+                    //Compressing is per client (each has its own stream)
+                    if(client->isCompressionEnabled())
+                        client->pushCompressed(data);
+                    else
+                        client->pushPacket(data, priority);
+                    client->release();
+                }
+                return clients.size();
+            }
+
+            /** \brief  Publish a message to every subscriber of a topic, see publish(const Topic<T>&, std::shared_ptr<uint8_t>, uint32_t)
+             * \param topic the topic name
+             * \param data the payload
+             * \param size the payload size
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return   the number of subscribers the message was pushed to */
+            uint32_t publish(const std::string& topic, std::shared_ptr<uint8_t> data, uint32_t size, uint8_t priority = PRIORITY_NORMAL)
+            {
+                return publish(*m_topics.getTopic(topic), Buffer::wrap(std::move(data), size), priority);
+            }
+
+            /** \brief  Publish a message to every subscriber of a topic, see publish(const Topic<T>&, const Buffer&, uint8_t)
+             * \param topic the topic name
+             * \param data the payload
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return   the number of subscribers the message was pushed to */
+            uint32_t publish(const std::string& topic, const Buffer& data, uint8_t priority = PRIORITY_NORMAL)
+            {
+                return publish(*m_topics.getTopic(topic), data, priority);
+            }
+
+            /** \brief  Set the scheduling of the handler queue lanes (see ClientSocket::inboundPriority). Has to be called before launch
+             * \param weights the messages each lane can handle per round (PRIORITY_COUNT values). Empty == strict-priority (default) */
+            void setInboundLaneWeights(const std::vector<uint32_t>& weights)
+            {
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                    m_bufferSchedulers[i].setWeights(weights);
+            }
+
+            /** \brief  Configure the scratch arenas of the handle messages threads (see getScratchArena). Has to be called before launch
+             * \param config the arena configuration, shared by every handle messages thread */
+            void setScratchArenaConfig(const ScratchArenaConfig& config)
+            {
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                    m_scratchArenas[i].setConfig(config);
+            }
+
+            /** \brief  Get the scratch arena of a handle messages thread, for the temporary memory of onMessage (see ArenaAllocator) :
+             * no contention on malloc between the handlers. It is reset after each received read, or each message (ScratchArenaConfig::reset).
+             * Replies built in it are sent without copy with ClientSocket::pushPacket(arena.promote(reply, size))
+             * \param bufID the handle messages thread ID given to onMessage. Only use the arena from this thread
+             * \return   the arena */
+            ScratchArena& getScratchArena(uint32_t bufID) {return m_scratchArenas[bufID];}
+
+            /** \brief  Size the handle messages threads dynamically. nbReadThread becomes the maximum pool size : the handlers are
+             * activated when the queues grow or the queueing delay rises, and parked when idle. Clients of a parked handler move to
+             * another one once they have no queued message, which keeps the order of their messages. Has to be called before launch
+             * \param config the adaptive pool configuration */
+            void setAdaptiveHandlers(const AdaptiveHandlerConfig& config)
+            {
+                m_adaptive = config;
+                if(m_adaptive.maxHandlers == 0 || m_adaptive.maxHandlers > m_nbReadThread)
+                    m_adaptive.maxHandlers = m_nbReadThread;
+                m_adaptive.minHandlers = std::max<uint32_t>(1, std::min(m_adaptive.minHandlers, m_adaptive.maxHandlers));
+                m_adaptive.checkIntervalMS = std::max<uint32_t>(1, m_adaptive.checkIntervalMS);
+                m_adaptiveEnabled = true;
+            }
+
+            /** \brief  Get the handler pool metrics : active handlers, scaling decisions, migrations, queue depths and queueing delays
+             * \return   the current metrics */
+            HandlerPoolMetrics getHandlerPoolMetrics()
+            {
+                HandlerPoolMetrics metrics;
+                metrics.nbActive     = m_nbActiveHandlers;
+                metrics.nbScaleUp    = m_nbScaleUp;
+                metrics.nbScaleDown  = m_nbScaleDown;
+                metrics.nbMigrations = m_nbMigrations;
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                {
+                    metrics.active.push_back(m_handlerStates[i].active);
+                    metrics.queueDepths.push_back(m_handlerStates[i].depth);
+                    metrics.latenciesUS.push_back(m_handlerStates[i].latency / 1000.0);
+                }
+                return metrics;
+            }
+
             /** \brief  Lock the write thread */
             void lockWriteThread() {m_writeMutex.lock();}
 
@@ -351,12 +863,27 @@ namespace sereno
             }
 
         protected:
+            friend typename Policy::Dispatch;
+
             /* \brief No copy Constructor */
             Server(const Server& copy);
 
             /* \brief No copy Operator */
             Server& operator=(const Server& copy);
 
+            /* \brief A socket the Server listens on, in addition to the TCP port of the constructor */
+            struct Listener
+            {
+                SOCKET        sock        = SOCKET_ERROR;        /*!< The listening socket*/
+                uint32_t      id          = DEFAULT_LISTENER_ID; /*!< The ID given to the clients of this listener*/
+                int           type        = SOCK_STREAM;         /*!< The socket type (SOCK_STREAM or SOCK_SEQPACKET)*/
+                struct sockaddr_storage addr;                    /*!< The address to bind (AF_INET, AF_INET6 or AF_UNIX)*/
+                socklen_t     addrLen     = 0;                   /*!< The address length*/
+                std::string   path;                              /*!< The socket file path (AF_UNIX)*/
+                uint32_t      shmRingSize = 0;                   /*!< The shared memory ring size of the clients connecting to it. 0 == no shared memory*/
+                SocketOptions options;                           /*!< The socket options of this listener and of its clients*/
+            };
+
             /*----------------------------------------------------------------------------*/
             /*----------------------------PROTECTED FUNCTIONS-----------------------------*/
             /*----------------------------------------------------------------------------*/
@@ -366,76 +893,384 @@ namespace sereno
             virtual void closeClient(SOCKET client)
             {
                 //INFO << "Client Disconnected\n";
-                T* cs = m_clientTable[client];
-                if(cs != NULL)
+                //Release before closing the socket : its descriptor may be reused by the next accepted client
+                m_admission.release(client);
+                auto it = m_clientTable.find(client);
+                if(it != m_clientTable.end())
                 {
+                    T* cs = it->second;
+                    m_clientTable.erase(it);
+                    m_topics.unsubscribeAll(cs);
                     cs->close();
-                    if(cs->nbMessage == 0)
+
+                    //Drop the reference of the table. Messages still queued keep the client alive
+                    cs->release();
+                }
+                m_shmChannels.erase(client);
+                m_seqpacketClients.erase(client);
+                m_clients.erase(client);
+            }
+
+            /* \brief Get a registered client and take a reference on it
+             * \param client the client socket
+             * \return the client (to release), NULL if it does not exist */
+            T* acquireClient(SOCKET client)
+            {
+                T* cs = NULL;
+                m_mapMutex.lock();
+                    auto it = m_clientTable.find(client);
+                    if(it != m_clientTable.end())
                     {
-                        delete cs;
+                        cs = it->second;
+                        cs->acquire();
                     }
+                m_mapMutex.unlock();
+                return cs;
+            }
+
+            /* \brief Allocate memory for the handle messages threads */
+            void allocHandleThreads()
+            {
+                m_buffers       = new MessageQueue[m_nbReadThread*PRIORITY_COUNT];
+                m_bufferSchedulers = new LaneScheduler[m_nbReadThread];
+                m_handleThread  = new std::thread*[m_nbReadThread];
+                for(uint32_t i = 0; i < m_nbReadThread; i++)
+                    m_handleThread[i] = NULL;
+                m_bufferMutexes = new BufferLock[m_nbReadThread];
+                m_handlerStates = new HandlerState[m_nbReadThread];
+                m_scratchArenas = new ScratchArena[m_nbReadThread];
+            }
+
+            /* \brief Get a lane of a handle messages thread buffer
+             * \param bufID the buffer ID
+             * \param lane the lane (PacketPriority)
+             * \return the queue of this lane */
+            MessageQueue& getBuffer(uint32_t bufID, uint32_t lane) {return m_buffers[bufID*PRIORITY_COUNT + lane];}
+
+            /* \brief Bind a listening socket to an address and listen on it
+             * \param sock the socket to bind
+             * \param addr the address to bind the socket to
+             * \param addrLen the address length
+             * \param options the socket options to apply to the listening socket
+             * \return true on success, false otherwise */
+            bool bindAndListen(SOCKET sock, SOCKADDR* addr, socklen_t addrLen, const SocketOptions& options)
+            {
+                if(sock == SOCKET_ERROR)
+                {
+                    ERROR << "Could not create the server socket\n";
+                    return false;
+                }
+
+                options.applyToListener(sock, addr->sa_family);
+
+                if(bind(sock, addr, addrLen) == SOCKET_ERROR)
+                {
+                    ERROR << "Could not bind the server socket\n";
+                    return false;
+                }
+
+                if(listen(sock, m_backlog) == SOCKET_ERROR)
+                {
+                    ERROR << "Could not listen the server socket\n";
+                    return false;
+                }
+
+                return true;
+            }
+
+            /* \brief Close every listening sockets (TCP and UNIX) */
+            void closeListeners()
+            {
+                if(m_sock != SOCKET_ERROR)
+                    close(m_sock);
+                m_sock = SOCKET_ERROR;
+
+                for(auto& listener : m_listeners)
+                {
+                    if(listener.sock != SOCKET_ERROR)
+                    {
+                        close(listener.sock);
+                        if(listener.addr.ss_family == AF_UNIX)
+                            unlink(listener.path.c_str());
+                    }
+                    listener.sock = SOCKET_ERROR;
                 }
-                m_clientTable.erase(client);
-                m_clients.erase(client);
             }
 
             /* \brief Thread accepting the incoming connection*/
             void acceptConnectionsThread()
             {
+                m_threadConfig.apply(THREAD_ACCEPT, 0, pthread_self());
+
+                //Every listening socket (TCP and UNIX). The TCP port of the constructor is the listener DEFAULT_LISTENER_ID
+                Listener                   mainListener;
+                std::vector<Listener*>     listeners;
+                std::vector<struct pollfd> acceptPoll;
+                if(m_sock != SOCKET_ERROR)
+                {
+                    mainListener.sock    = m_sock;
+                    mainListener.options = m_socketOptions;
+                    listeners.push_back(&mainListener);
+                }
+                for(auto& listener : m_listeners)
+                    listeners.push_back(&listener);
+                for(Listener* listener : listeners)
+                    acceptPoll.push_back({.fd = listener->sock, .events = POLLIN});
+
+                //The descriptor given up to shed the pending connections when the process runs out of descriptors
+                int reserveFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                std::vector<uint64_t> pausedUntil(listeners.size(), 0);
+
+                while(!m_closeThread)
+                {
+                    //Resume the listeners paused by a descriptor shortage
+                    uint64_t now = AdmissionControl::now();
+                    for(uint32_t i = 0; i < acceptPoll.size(); i++)
+                        if(pausedUntil[i] > 0 && now >= pausedUntil[i])
+                        {
+                            pausedUntil[i]       = 0;
+                            acceptPoll[i].events = POLLIN;
+                        }
+
+                    if(poll(acceptPoll.data(), acceptPoll.size(), 10) <= 0)
+                        continue;
+
+                    for(uint32_t i = 0; i < acceptPoll.size(); i++)
+                    {
+                        //Still short of descriptors without reserve : the pending connection would wake poll at once, stop polling it a while
+                        if((acceptPoll[i].revents & POLLIN) && !acceptClients(*listeners[i], reserveFD))
+                        {
+                            pausedUntil[i]       = AdmissionControl::now() + ACCEPT_PAUSE_NS;
+                            acceptPoll[i].events = 0;
+                        }
+                    }
+                }
+
+                if(reserveFD >= 0)
+                    close(reserveFD);
+            }
+
+            /* \brief Accept every pending connection of a (non blocking) listening socket. When the process is out of descriptors
+             * (EMFILE, ENFILE), the reserve descriptor is closed to accept and close the pending connections, then reopened
+             * \param listener the listener
+             * \param reserveFD the reserve descriptor, -1 if it could not be reopened
+             * \return false if connections are left pending for a lack of descriptors, true otherwise */
+            bool acceptClients(const Listener& listener, int& reserveFD)
+            {
+                //Drain the whole accept queue
                 while(!m_closeThread)
                 {
                     //Accept a client (socket)
-                    SOCKADDR_IN clientAddr;
-                    socklen_t   clientAddrLen = sizeof(clientAddr);
-                    SOCKET client = accept(m_sock, (SOCKADDR*)&clientAddr, &clientAddrLen);
+                    struct sockaddr_storage clientAddr;
+                    socklen_t clientAddrLen = sizeof(clientAddr);
+                    SOCKET    client = accept4(listener.sock, (SOCKADDR*)&clientAddr, &clientAddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-                    if(client)
+                    if(client == SOCKET_ERROR)
                     {
-                        //No delay
-                        int one = 1;
-                        setsockopt(client, SOL_TCP, TCP_NODELAY, &one, sizeof(one));
-                        //INFO << "New client connected\n";
-                        m_mapMutex.lock();
-                            //Create a ClientSocket associated
-                            T* obj                 = new T();
-                            obj->bufferID          = m_currentBuffer;
-                            obj->socket            = client;
-                            obj->sockAddr          = clientAddr;
-                            m_clientTable[client]  = obj;
-                            m_clients.pushBack(client);
-                        m_mapMutex.unlock();
-                        m_currentBuffer        = (m_currentBuffer + 1)%m_nbReadThread;
+                        if(errno == EINTR || errno == ECONNABORTED)
+                            continue;
+                        if(errno == EMFILE || errno == ENFILE)
+                        {
+                            WARNING_RATE_LIMITED(1000) << "Could not accept a new client : " << strerror(errno) << ". Its connection is dropped\n";
+                            if(reserveFD < 0)
+                                return false;
+                            //accept fails with EMFILE before looking at the queue : stop once it is empty
+                            close(reserveFD);
+                            SOCKET dropped = accept(listener.sock, NULL, NULL);
+                            int    error   = errno;
+                            if(dropped != SOCKET_ERROR)
+                                close(dropped);
+                            reserveFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                            if(dropped == SOCKET_ERROR && (error == EAGAIN || error == EWOULDBLOCK))
+                                return true;
+                            continue;
+                        }
+                        if(errno == ENOBUFS || errno == ENOMEM)
+                        {
+                            WARNING_RATE_LIMITED(1000) << "Could not accept a new client : " << strerror(errno) << "\n";
+                            return false;
+                        }
+                        return true;
+                    }
+
+                    //Connection caps
+                    if(!m_admission.admit(client, clientAddr))
+                    {
+                        close(client);
+                        continue;
+                    }
+
+                    //Shared memory transport : hand the rings over the control socket
+                    std::shared_ptr<SharedMemoryChannel> channel;
+                    if(listener.shmRingSize > 0)
+                    {
+                        channel = SharedMemoryChannel::create(listener.shmRingSize);
+                        if(!channel || !channel->sendTo(client))
+                        {
+                            ERROR_RATE_LIMITED(1000) << "Could not set up the shared memory of a new client\n";
+                            m_admission.release(client);
+                            close(client);
+                            continue;
+                        }
+                    }
+
+                    listener.options.applyToClient(client, clientAddr.ss_family);
+                    registerClient(client, clientAddr, channel, SocketTransport::get(), listener.id);
+                }
+                return true;
+            }
+
+            /* \brief Create the ClientSocket of a new connected client and register it
+             * \param client the client socket
+             * \param clientAddr the client address
+             * \param channel the shared memory channel of this client, if any
+             * \param transport the transport of the client socket. Only the kernel sockets are polled
+             * \param listenerID the ID of the listener of the client
+             * \return the ClientSocket created */
+            T* registerClient(SOCKET client, const struct sockaddr_storage& clientAddr, std::shared_ptr<SharedMemoryChannel> channel,
+                              Transport* transport, uint32_t listenerID)
+            {
+                //INFO << "New client connected\n";
+                //Create a ClientSocket associated
+                T* obj = createClient(listenerID);
+                m_mapMutex.lock();
+                    obj->listenerID        = listenerID;
+                    obj->bufferID          = nextBuffer();
+                    obj->targetBufferID    = obj->bufferID;
+                    obj->socket            = client;
+                    obj->domain            = clientAddr.ss_family;
+                    obj->transport         = transport;
+                    obj->threadConfig      = &m_threadConfig;
+                    if(clientAddr.ss_family == AF_INET)
+                        obj->sockAddr      = *(SOCKADDR_IN*)&clientAddr;
+                    else
+                        memset(&obj->sockAddr, 0, sizeof(obj->sockAddr));
+                    if(channel)
+                    {
+                        obj->setSharedMemoryChannel(channel);
+                        m_shmChannels[client] = channel;
+                    }
+                    m_clientTable[client]  = obj;
+                    if(transport->isKernelSocket())
+                    {
+                        int       type    = SOCK_STREAM;
+                        socklen_t typeLen = sizeof(type);
+                        if(getsockopt(client, SOL_SOCKET, SO_TYPE, &type, &typeLen) == 0 && type == SOCK_SEQPACKET)
+                            m_seqpacketClients.insert(client);
+                        m_clients.pushBack(client);
                     }
+                m_mapMutex.unlock();
+                return obj;
+            }
+
+            /* \brief Read the next record of a SOCK_SEQPACKET client. recv drops what does not fit in the buffer : the record is read
+             * whole, larger than the allocator blocks and than the rate limit allowance if needed (the token buckets then go in debt).
+             * Empty records are skipped. The end of the connection is reported by POLLHUP
+             * \param client the client socket
+             * \param rateLimited is a rate limit set? */
+            void readRecord(SOCKET client, bool rateLimited)
+            {
+                //FIONREAD gives the size of the next record
+                int32_t count = SocketTransport::get()->available(client);
+                if(count < 0)
+                {
+                    if(m_capture)
+                        m_capture->append(CAPTURE_CLOSE, client, NULL, 0);
+                    m_mapMutex.lock();
+                        Policy::Dispatch::closeClient(this, client);
+                    m_mapMutex.unlock();
+                    return;
                 }
+
+                UniqueBuffer buf = ((uint32_t)count <= UniqueBuffer::maxSize<typename Policy::Allocator>() ?
+                                    UniqueBuffer::allocateFrom<typename Policy::Allocator>(count) : UniqueBuffer::allocate(count));
+                ssize_t nbRead = SocketTransport::get()->receive(client, buf.data(), count);
+                if(nbRead <= 0)
+                    return;
+                if(rateLimited)
+                    m_admission.consume(client, nbRead);
+                buf.resize(nbRead);
+                if(m_capture)
+                    m_capture->append(CAPTURE_DATA, client, buf.data(), buf.size());
+                pushReceivedData(client, std::move(buf));
             }
 
             void readSocketsThread()
             {
+                m_threadConfig.apply(THREAD_READ, 0, pthread_self());
+                Transport* sockets = SocketTransport::get(); //Only the kernel sockets are polled
+
                 while(!m_closeThread)
                 {
+                    closeRequestedClients();
+
                     std::vector<struct pollfd> readPoll;
+                    bool     rateLimited = m_admission.isRateLimited();
+                    uint64_t now         = rateLimited ? AdmissionControl::now() : 0;
                     
                     //Create a pollfd containing all our sockets
                     //The idea is to know every sockets status
+                    //Over-limit sockets are not polled : their data stay in the kernel until they get tokens
                     for(uint32_t i = 0; i < m_clients.getSize(); i++)
                     {
                         auto client = m_clients[i];
                         if(client.getPtr())
                         {
+                            if(rateLimited && m_admission.getAllowance(*client, now) == 0)
+                                continue;
                             struct pollfd pfd = {.fd = *client, .events = POLLIN};
                             readPoll.push_back(pfd);
                         }
                     }
-                    poll(readPoll.data(), readPoll.size(), 10);
-                    
-                    for(auto& pfd : readPoll)
+                    uint32_t nbSockets = readPoll.size();
+
+                    //Shared memory clients : only poll the doorbell of those having nothing to read
+                    std::vector<std::pair<SOCKET, std::shared_ptr<SharedMemoryChannel>>> shmChannels;
+                    std::set<SOCKET> seqpacketClients;
+                    m_mapMutex.lock();
+                        for(auto& it : m_shmChannels)
+                            shmChannels.push_back(it);
+                        if(!m_seqpacketClients.empty())
+                            seqpacketClients = m_seqpacketClients;
+                    m_mapMutex.unlock();
+
+                    int timeout = 10;
+                    if(rateLimited)
+                        shmChannels.erase(std::remove_if(shmChannels.begin(), shmChannels.end(),
+                                                         [this, now](const std::pair<SOCKET, std::shared_ptr<SharedMemoryChannel>>& it)
+                                                         {return m_admission.getAllowance(it.first, now) == 0;}),
+                                          shmChannels.end());
+
+                    for(auto& it : shmChannels)
                     {
+                        if(it.second->prepareWait())
+                            readPoll.push_back({.fd = it.second->getDoorbell(), .events = POLLIN});
+                        else
+                            timeout = 0;
+                    }
+
+                    poll(readPoll.data(), readPoll.size(), timeout);
+
+                    for(uint32_t i = 0; i < nbSockets; i++)
+                    {
+                        struct pollfd& pfd = readPoll[i];
+
+                        //A record of a SOCK_SEQPACKET client. The records sent before a hang up are read first
+                        if((pfd.revents & POLLIN) && seqpacketClients.count(pfd.fd))
+                        {
+                            readRecord(pfd.fd, rateLimited);
+                            continue;
+                        }
+
                         //One error -> disconnection
                         if(pfd.revents & POLLHUP ||
-                           pfd.revents & POLLERR)
+                           pfd.revents & POLLERR ||
+                           pfd.revents & POLLNVAL)
                         {
+                            if(m_capture)
+                                m_capture->append(CAPTURE_CLOSE, pfd.fd, NULL, 0);
                             m_mapMutex.lock();
-                                closeClient(pfd.fd);
+                                Policy::Dispatch::closeClient(this, pfd.fd);
                             m_mapMutex.unlock();
                             continue;
                         }
@@ -443,14 +1278,15 @@ namespace sereno
                         //Value to read available
                         if(pfd.revents & POLLIN)
                         {
-                            int count;
-                            ioctl(pfd.fd, FIONREAD, &count);
+                            int32_t count = sockets->available(pfd.fd);
 
                             //No data -> disconnection
-                            if(count == 0)
+                            if(count <= 0)
                             {
+                                if(m_capture)
+                                    m_capture->append(CAPTURE_CLOSE, pfd.fd, NULL, 0);
                                 m_mapMutex.lock();
-                                    closeClient(pfd.fd);
+                                    Policy::Dispatch::closeClient(this, pfd.fd);
                                 m_mapMutex.unlock();
                                 continue;
                             }
@@ -459,29 +1295,137 @@ namespace sereno
                             //Push the data to the corresponding buffer
                             else
                             {
-                                uint8_t* buf = (uint8_t*)malloc(sizeof(uint8_t)*count);
-                                read(pfd.fd, buf, count);
-                                m_mapMutex.lock();
-                                    T* client = m_clientTable[pfd.fd];
-                                    //This case can appears when a message has arrived AFTER that a client has been disconnected.
-                                    if(client == NULL) 
-                                    {
-                                        free(buf);
-                                        m_mapMutex.unlock();
+                                //Never read more than one buffer of the allocator at once : the rest stays in the socket
+                                count = std::min<uint32_t>(count, UniqueBuffer::maxSize<typename Policy::Allocator>());
+                                if(rateLimited)
+                                {
+                                    count = std::min<uint32_t>(count, m_admission.getAllowance(pfd.fd, AdmissionControl::now()));
+                                    if(count == 0)
                                         continue;
-                                    }
-                                    client->nbMessage++;
-                                m_mapMutex.unlock();
+                                    m_admission.consume(pfd.fd, count);
+                                }
+
+                                UniqueBuffer buf    = UniqueBuffer::allocateFrom<typename Policy::Allocator>(count);
+                                ssize_t      nbRead = sockets->receive(pfd.fd, buf.data(), count);
+                                if(nbRead <= 0)
+                                    continue;
+                                buf.resize(nbRead);
+                                if(m_capture)
+                                    m_capture->append(CAPTURE_DATA, pfd.fd, buf.data(), buf.size());
+                                pushReceivedData(pfd.fd, std::move(buf));
+                            }
+                        }
+                    }
+
+                    //Drain the shared memory rings
+                    for(auto& it : shmChannels)
+                    {
+                        it.second->finishWait();
+                        uint32_t count = std::min<uint32_t>(it.second->available(), UniqueBuffer::maxSize<typename Policy::Allocator>());
+                        if(rateLimited && count > 0)
+                        {
+                            count = std::min<uint32_t>(count, m_admission.getAllowance(it.first, AdmissionControl::now()));
+                            if(count > 0)
+                                m_admission.consume(it.first, count);
+                        }
+                        if(count == 0)
+                            continue;
+
+                        UniqueBuffer buf = UniqueBuffer::allocateFrom<typename Policy::Allocator>(count);
+                        it.second->read(buf.data(), count);
+                        if(m_capture)
+                            m_capture->append(CAPTURE_DATA, it.first, buf.data(), count);
+                        pushReceivedData(it.first, std::move(buf));
+                    }
 
-                                m_bufferMutexes[client->bufferID].lock();
-                                    std::shared_ptr<uint8_t> sharedBuf(buf, free);
-                                    m_buffers[client->bufferID].emplace(client, sharedBuf, count);    
-                                m_bufferMutexes[client->bufferID].unlock();
+                    //The client corrupted its rings : close it, if the channel is still its own (the descriptor may be reused)
+                    for(auto& it : shmChannels)
+                    {
+                        if(!it.second->isCorrupted())
+                            continue;
+                        m_mapMutex.lock();
+                            auto channel = m_shmChannels.find(it.first);
+                            if(channel != m_shmChannels.end() && channel->second == it.second)
+                            {
+                                if(m_capture)
+                                    m_capture->append(CAPTURE_CLOSE, it.first, NULL, 0);
+                                Policy::Dispatch::closeClient(this, it.first);
                             }
+                        m_mapMutex.unlock();
+                    }
+
+                    if(timeout > 0)
+                        std::this_thread::sleep_for(std::chrono::microseconds(10));
+                }
+            }
+
+            /* \brief Close the clients of requestClose. Called by the read thread, the only writer of the capture */
+            void closeRequestedClients()
+            {
+                std::vector<T*> requests;
+                m_closeMutex.lock();
+                    requests.swap(m_closeRequests);
+                m_closeMutex.unlock();
+
+                for(T* client : requests)
+                {
+                    //Only close the registered client : it may already be gone, and its descriptor reused
+                    m_mapMutex.lock();
+                        auto it = m_clientTable.find(client->socket);
+                        if(it != m_clientTable.end() && it->second == client)
+                        {
+                            if(m_capture)
+                                m_capture->append(CAPTURE_CLOSE, client->socket, NULL, 0);
+                            Policy::Dispatch::closeClient(this, client->socket);
                         }
+                    m_mapMutex.unlock();
+                    client->release();
+                }
+            }
+
+            /* \brief Push data received from a client to its handle messages thread buffer
+             * \param sock the client socket
+             * \param buf the data received, moved in the handler queue
+             * \return true if the client exists, false otherwise */
+            bool pushReceivedData(SOCKET sock, UniqueBuffer&& buf)
+            {
+                m_mapMutex.lock();
+                    auto it = m_clientTable.find(sock);
+                    //This case can appears when a message has arrived AFTER that a client has been disconnected (or asked to be).
+                    if(it == m_clientTable.end() || !it->second->isConnected())
+                    {
+                        m_mapMutex.unlock();
+                        return false;
+                    }
+                    //The message holds a reference on its client
+                    T* client = it->second;
+                    client->acquire();
+
+                    //Move the client to its new handler only once it has no message queued : its messages stay in order
+                    if(client->targetBufferID != client->bufferID && client->nbQueued.load(std::memory_order_acquire) == 0)
+                    {
+                        client->bufferID = client->targetBufferID;
+                        m_nbMigrations++;
                     }
-                    std::this_thread::sleep_for(std::chrono::microseconds(10));
+                    client->nbQueued++;
+                    uint32_t bufID = client->bufferID;
+                m_mapMutex.unlock();
+
+                uint8_t  lane = std::min<uint32_t>(client->inboundPriority, PRIORITY_COUNT-1);
+                uint64_t time = m_adaptiveEnabled ? AdmissionControl::now() : 0;
+                m_bufferMutexes[bufID].lock();
+                    getBuffer(bufID, lane).emplace(client, buf.share(), lane, time);
+                    m_handlerStates[bufID].depth++;
+                m_bufferMutexes[bufID].unlock();
+
+                //A client still draining on a parked handler : wake it up
+                if(!m_handlerStates[bufID].active)
+                {
+                    m_parkMutex.lock();
+                    m_parkMutex.unlock();
+                    m_parkCond.notify_all();
                 }
+                return true;
             }
 
             /* \brief Handle the messages received by the clients
@@ -489,41 +1433,153 @@ namespace sereno
              * \param bufID the buffer for which this thread has been called */
             void handleMessagesThread(uint32_t bufID)
             {
-                std::queue<SocketMessage<T*>>& buffer = m_buffers[bufID];
+                m_threadConfig.apply(THREAD_HANDLER, bufID, pthread_self());
+
+                auto isLaneEmpty = [this, bufID](int lane) {return getBuffer(bufID, lane).empty();};
                 while(!m_closeThread)
                 {
-                    //Sleep if no data
-                    if(buffer.size() == 0)
-                    {
-                        usleep(5);
-                        continue;
-                    }
-
+                    //Choose the lane to serve. Sleep if no data
                     m_bufferMutexes[bufID].lock();
+                        int lane = m_bufferSchedulers[bufID].next(isLaneEmpty);
+                        if(lane < 0)
+                        {
+                            m_bufferMutexes[bufID].unlock();
+                            m_handlerStates[bufID].latency = 0;
+
+                            //Parked handler : sleep until activated. The timeout only guards the shutdown
+                            if(!m_handlerStates[bufID].active)
+                            {
+                                std::unique_lock<std::mutex> parkLock(m_parkMutex);
+                                m_parkCond.wait_for(parkLock, std::chrono::milliseconds(100),
+                                                    [this, bufID] {return m_closeThread || m_handlerStates[bufID].active || m_handlerStates[bufID].depth > 0;});
+                                continue;
+                            }
+                            Policy::Wait::idle();
+                            continue;
+                        }
+
+                        MessageQueue&      buffer = getBuffer(bufID, lane);
                         SocketMessage<T*>& msg    = buffer.front();
                         T*       client = msg.client;
                         uint32_t size   = msg.size;
-                        std::shared_ptr<uint8_t> data = msg.data;
+                        Buffer   data   = std::move(msg.data);
+                        uint64_t queuedTime = msg.time;
                         buffer.pop();
+                        m_bufferSchedulers[bufID].consume(lane, 1);
+                        m_handlerStates[bufID].depth--;
                     m_bufferMutexes[bufID].unlock();
 
-                    onMessage(bufID, client, data.get(), size);
+                    //Queueing delay, averaged (1/8 weight for the new sample)
+                    if(queuedTime > 0)
+                    {
+                        uint64_t delay   = AdmissionControl::now() - queuedTime;
+                        uint64_t average = m_handlerStates[bufID].latency;
+                        m_handlerStates[bufID].latency = average - average/8 + delay/8;
+                    }
 
-                    //Delete the client after having parsed every messages
-                    m_mapMutex.lock();
-                        client->nbMessage--;
-                        if(!client->isConnected() && client->nbMessage == 0)
+                    //A client being closed (requestClose) is not fed anymore
+                    if(client->isConnected())
+                        Policy::Framing::feed(client, data.data(), size, FrameSink{this, bufID, client});
+                    if(m_scratchArenas[bufID].getConfig().reset == SCRATCH_RESET_BATCH)
+                        m_scratchArenas[bufID].reset();
+
+                    //Drop the reference of the message. Closed clients are deleted with their last message
+                    client->nbQueued.fetch_sub(1, std::memory_order_release);
+                    client->release();
+                }
+            }
+
+            /* \brief Thread taking the scaling decisions of the adaptive handler pool */
+            void scaleHandlersThread()
+            {
+                uint64_t idleSince = 0;
+                while(!m_closeThread)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(m_adaptive.checkIntervalMS));
+
+                    uint32_t nbActive   = m_nbActiveHandlers;
+                    uint64_t depth      = 0;
+                    uint64_t maxLatency = 0;
+                    for(uint32_t i = 0; i < nbActive; i++)
+                    {
+                        depth     += m_handlerStates[i].depth;
+                        maxLatency = std::max<uint64_t>(maxLatency, m_handlerStates[i].latency);
+                    }
+
+                    uint64_t latencyHigh = (uint64_t)m_adaptive.latencyHighUS*1000;
+                    bool     overloaded  = depth > (uint64_t)m_adaptive.queueDepthHigh*nbActive || maxLatency > latencyHigh;
+                    bool     idle        = depth <= (uint64_t)m_adaptive.queueDepthLow*nbActive && maxLatency < latencyHigh/2;
+
+                    if(overloaded && nbActive < m_adaptive.maxHandlers)
+                    {
+                        setNbActiveHandlers(nbActive+1);
+                        m_nbScaleUp++;
+                        idleSince = 0;
+                        INFO_RATE_LIMITED(1000) << "Handler pool scaled up to " << nbActive+1 << " threads (queued messages : " << depth
+                                                << ", queueing delay : " << maxLatency/1000 << " us)\n";
+                    }
+                    else if(idle && nbActive > m_adaptive.minHandlers)
+                    {
+                        uint64_t now = AdmissionControl::now();
+                        if(idleSince == 0)
+                            idleSince = now;
+                        else if(now - idleSince >= (uint64_t)m_adaptive.idleMS*1000000)
                         {
-                            m_clientTable.erase(client->socket);
-                            delete client;
+                            setNbActiveHandlers(nbActive-1);
+                            m_nbScaleDown++;
+                            idleSince = 0;
+                            INFO_RATE_LIMITED(1000) << "Handler pool scaled down to " << nbActive-1 << " threads\n";
                         }
-                    m_mapMutex.unlock();
+                    }
+                    else
+                        idleSince = 0;
                 }
             }
 
+            /* \brief Change the number of active handlers and reassign the clients. Handlers [0, nbActive[ are the active ones
+             * \param nbActive the new number of active handlers */
+            void setNbActiveHandlers(uint32_t nbActive)
+            {
+                uint32_t previous = m_nbActiveHandlers;
+                m_mapMutex.lock();
+                    for(uint32_t i = 0; i < m_nbReadThread; i++)
+                        m_handlerStates[i].active = (i < nbActive);
+                    m_nbActiveHandlers = nbActive;
+                    if(m_currentBuffer >= nbActive)
+                        m_currentBuffer = 0;
+
+                    //Scale up : give one client in nbActive to the new handlers. Scale down : spread the clients of the parked handlers
+                    uint32_t index = 0;
+                    for(auto& it : m_clientTable)
+                    {
+                        T* client = it.second;
+                        if(nbActive > previous && index % nbActive >= previous)
+                            client->targetBufferID = index % nbActive;
+                        else if(client->targetBufferID >= nbActive)
+                            client->targetBufferID = index % nbActive;
+                        index++;
+                    }
+                m_mapMutex.unlock();
+
+                m_parkMutex.lock();
+                m_parkMutex.unlock();
+                m_parkCond.notify_all();
+            }
+
+            /* \brief Get the handler of the next new client (round robin over the active handlers). m_mapMutex must be locked
+             * \return the buffer ID */
+            uint32_t nextBuffer()
+            {
+                uint32_t nbActive = (m_nbActiveHandlers > 0 ? m_nbActiveHandlers.load() : m_nbReadThread);
+                uint32_t bufID    = m_currentBuffer % nbActive;
+                m_currentBuffer   = (bufID + 1) % nbActive;
+                return bufID;
+            }
+
             /* \brief Thread handling the write call */
             void writeSocketThread()
             {
+                m_threadConfig.apply(THREAD_WRITE, 0, pthread_self());
                 INFO << "In write thread...\n\n";
                 while(!m_closeThread)
                 {
@@ -535,25 +1591,20 @@ namespace sereno
                                 m_writeMutex.unlock();
                                 break;
                             }
-                            SocketMessage<int>& msg = m_writeBuffer.front();
-                            int size   = msg.size;
-                            int client = msg.client;
-                            std::shared_ptr<uint8_t> data = msg.data;
+                            SocketMessage<int> msg = std::move(m_writeBuffer.front());
                             m_writeBuffer.pop();
                         m_writeMutex.unlock();
 
                         //INFO << "Writing " << msg.size << " bytes\n";
-                        m_mapMutex.lock();
-                        if(m_clientTable.find(msg.client) != m_clientTable.end())
+                        uint32_t size = msg.size;
+                        T* cs = acquireClient(msg.client);
+                        if(cs)
                         {
-                            m_clientTable[msg.client]->pushPacket(data, size);
-                            m_mapMutex.unlock();
+                            cs->pushPacket(std::move(msg.data), msg.priority);
+                            cs->release();
                         }
                         else
-                        {
-                            m_mapMutex.unlock();
-                            write(client, data.get(), size);
-                        }
+                            SocketTransport::get()->send(msg.client, msg.data.data(), size);
 
                         m_writeMutex.lock();
                             m_bytesInWriting -= size;
@@ -566,40 +1617,140 @@ namespace sereno
             }
 
             void writeMessage(SocketMessage<int>& msg)
+            {
+                writeMessage(SocketMessage<int>(msg));
+            }
+
+            /** \brief  Push a message in the write queue, without copying it
+             * \param msg the message to write, moved */
+            void writeMessage(SocketMessage<int>&& msg)
             {
                 m_writeMutex.lock();
                     m_bytesInWriting += msg.size;
-                    m_writeBuffer.push(msg);
+                    m_writeBuffer.push(std::move(msg));
                 m_writeMutex.unlock();
             }
 
+            /* \brief Create the ClientSocket of a new client. Override it to create a different T subclass (or to configure it) per listener
+             * \param listenerID the ID of the listener which accepted the client (see addTCPListener)
+             * \return the client, allocated with new */
+            virtual T* createClient(uint32_t listenerID)
+            {
+                return new T();
+            }
+
             virtual void onMessage(uint32_t bufID, T* client, uint8_t* data, uint32_t size)
             {
                 client->feedMessage(data, size);
             }
 
+            /* \brief Called when a large message starts (see StreamingLengthPrefixFraming). Its payload follows through onFrameChunk
+             * \param bufID the handle messages thread ID
+             * \param client the client sending the message
+             * \param size the message size */
+            virtual void onFrameBegin(uint32_t bufID, T* client, uint32_t size)
+            {}
+
+            /* \brief Called with the next piece of the large message started by onFrameBegin
+             * \param bufID the handle messages thread ID
+             * \param client the client sending the message
+             * \param data the piece. Do not keep it, it is recycled at the end of this call
+             * \param size the piece size */
+            virtual void onFrameChunk(uint32_t bufID, T* client, uint8_t* data, uint32_t size)
+            {}
+
+            /* \brief Called once every piece of the large message started by onFrameBegin has been delivered
+             * \param bufID the handle messages thread ID
+             * \param client the client sending the message */
+            virtual void onFrameEnd(uint32_t bufID, T* client)
+            {}
+
+            /* \brief Forward what the framing policy extracts to the dispatch policy */
+            struct FrameSink
+            {
+                Server*  server; /*!< The Server*/
+                uint32_t bufID;  /*!< The handle messages thread ID*/
+                T*       client; /*!< The client*/
+
+                void operator()(uint8_t* data, uint32_t size)
+                {
+                    Policy::Dispatch::onMessage(server, bufID, client, data, size);
+                    resetScratch();
+                }
+                void frameBegin(uint32_t size)                {Policy::Dispatch::onFrameBegin(server, bufID, client, size);}
+                void frameChunk(uint8_t* data, uint32_t size) {Policy::Dispatch::onFrameChunk(server, bufID, client, data, size);}
+                void frameEnd()
+                {
+                    Policy::Dispatch::onFrameEnd(server, bufID, client);
+                    resetScratch();
+                }
+
+                /* \brief Close the client on a framing error, see Server::requestClose */
+                void close() {server->requestClose(client);}
+
+                /* \brief Reset the scratch arena after a message, if configured so */
+                void resetScratch()
+                {
+                    ScratchArena& arena = server->m_scratchArenas[bufID];
+                    if(arena.getConfig().reset == SCRATCH_RESET_MESSAGE)
+                        arena.reset();
+                }
+            };
+
             /*----------------------------------------------------------------------------*/
             /*----------------------------PROTECTED ATTRIBUTES----------------------------*/
             /*----------------------------------------------------------------------------*/
 
+            /* \brief The state of a handle messages thread */
+            struct HandlerState
+            {
+                std::atomic<bool>     active{true}; /*!< Does this handler receive clients? Parked otherwise*/
+                std::atomic<uint32_t> depth{0};     /*!< The messages queued*/
+                std::atomic<uint64_t> latency{0};   /*!< The queueing delay (average, nanoseconds)*/
+            };
+
             SOCKET                         m_sock          = SOCKET_ERROR; /*!< The server socket*/
             ConcurrentVector<SOCKET>       m_clients;                      /*!< The clients*/
-            std::map<SOCKET, T*>           m_clientTable;
+            std::map<SOCKET, T*>           m_clientTable;                  /*!< The registered clients. The table holds one reference on each of them*/
+            std::map<SOCKET, std::shared_ptr<SharedMemoryChannel>> m_shmChannels; /*!< The shared memory channels of the clients using them*/
+            std::set<SOCKET>               m_seqpacketClients;             /*!< The SOCK_SEQPACKET clients, read one whole record at a time*/
             bool                           m_closeThread   = true;         /*!< Should we close the threads ?*/
             std::thread*                   m_acceptThread  = NULL;         /*!< The accept connections thread*/
             std::thread*                   m_readThread    = NULL;         /*!< The read sockets thread*/
             std::thread**                  m_handleThread  = NULL;         /*!< The handle messages thread*/
             std::thread*                   m_writeThread   = NULL;         /*!< The write message thread*/
-            std::mutex*                    m_bufferMutexes = NULL;         /*!< The buffer mutexes*/
+            BufferLock*                    m_bufferMutexes = NULL;         /*!< The buffer mutexes*/
+            LaneScheduler*                 m_bufferSchedulers = NULL;      /*!< The lane scheduler of each buffer*/
+            HandlerState*                  m_handlerStates = NULL;         /*!< The state of each handle messages thread*/
+            ScratchArena*                  m_scratchArenas = NULL;         /*!< The scratch arena of each handle messages thread*/
+            std::thread*                   m_scaleThread   = NULL;         /*!< The adaptive handler pool thread*/
+            AdaptiveHandlerConfig          m_adaptive;                     /*!< The adaptive handler pool configuration*/
+            bool                           m_adaptiveEnabled = false;      /*!< Is the handler pool adaptive?*/
+            std::atomic<uint32_t>          m_nbActiveHandlers{0};          /*!< The number of active handlers*/
+            std::atomic<uint64_t>          m_nbScaleUp{0};                 /*!< The handlers activated since launch*/
+            std::atomic<uint64_t>          m_nbScaleDown{0};               /*!< The handlers parked since launch*/
+            std::atomic<uint64_t>          m_nbMigrations{0};              /*!< The clients moved since launch*/
+            std::mutex                     m_parkMutex;                    /*!< The mutex of m_parkCond*/
+            std::condition_variable        m_parkCond;                     /*!< Wake up the parked handlers*/
             std::mutex                     m_mapMutex;                     /*!< The map mutex*/
-            std::queue<SocketMessage<T*>>* m_buffers;                      /*!< The buffers containing the sockets messages*/
+            std::mutex                     m_closeMutex;                   /*!< The mutex of m_closeRequests*/
+            std::vector<T*>                m_closeRequests;                /*!< The clients to close by the read thread, one reference each (see requestClose)*/
+            MessageQueue*                  m_buffers;                      /*!< The buffers containing the sockets messages, PRIORITY_COUNT lanes per handle messages thread*/
             std::queue<SocketMessage<int>> m_writeBuffer;                  /*!< The write buffer*/
             std::mutex                     m_writeMutex;                   /*!< The mutex associated with the write buffer*/
             uint32_t                       m_nbReadThread;                 /*!< The number of thread which will handles received messages*/
             uint32_t                       m_currentBuffer = 0;            /*!< The current buffer to allocate the next connection*/
             uint32_t                       m_port;                         /*!< The port to open*/
+            bool                           m_useTCP        = true;         /*!< Should we listen on the TCP port?*/
+            std::vector<Listener>          m_listeners;                    /*!< The other sockets to listen on (TCP and UNIX)*/
             uint32_t                       m_bytesInWriting = 0;          /*!< Number of bytes currently being written*/
             bool                           m_isLaunch = false;
+            ThreadConfig                   m_threadConfig;                 /*!< The threading configuration*/
+            int                            m_backlog       = SOMAXCONN;    /*!< The listen backlog*/
+            SocketOptions                  m_socketOptions;                /*!< The socket options of the TCP listener and of its clients*/
+            std::unique_ptr<TrafficCapture> m_capture;                     /*!< The inbound traffic capture, if enabled*/
+            TopicRegistry<T>               m_topics;                       /*!< The publish/subscribe topics*/
+            AdmissionControl               m_admission;                    /*!< The connection caps and rate limits*/
     };
 }
 
@@ -0,0 +1,615 @@
+#ifndef  SERVERPOLICIES_INC
+#define  SERVERPOLICIES_INC
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <unistd.h>
+#include "ByteScan.h"
+
+namespace sereno
+{
+    /*----------------------------------------------------------------------------*/
+    /*----------------------------------ALLOCATORS--------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief Allocate the received buffers with malloc/free.
+     * Allocators provide allocate, deallocate and maxSize, the largest buffer they allocate (the read thread never reads more at once) */
+    struct MallocAllocator
+    {
+        static constexpr uint32_t maxSize() {return UINT32_MAX;}
+
+        static uint8_t* allocate(uint32_t size) {return (uint8_t*)malloc(size);}
+        static void deallocate(uint8_t* data)   {free(data);}
+    };
+
+    /* \brief Allocate the received buffers as fixed-size blocks recycled through a free list.
+     * Reads are split in blocks, which bounds the memory a client can pin at once to a few blocks
+     * \param BlockSize the block size in bytes
+     * \param MaxFreeBlocks the maximum number of blocks kept in the free list */
+    template <uint32_t BlockSize = (1u << 16), uint32_t MaxFreeBlocks = 1024>
+    struct PoolAllocator
+    {
+        static constexpr uint32_t maxSize() {return BlockSize;}
+
+        static uint8_t* allocate(uint32_t size)
+        {
+            FreeList& list = freeList();
+            {
+                std::lock_guard<std::mutex> lock(list.mutex);
+                if(list.blocks.size() > 0)
+                {
+                    uint8_t* block = list.blocks.back();
+                    list.blocks.pop_back();
+                    return block;
+                }
+            }
+            return (uint8_t*)malloc(BlockSize);
+        }
+
+        static void deallocate(uint8_t* data)
+        {
+            FreeList& list = freeList();
+            {
+                std::lock_guard<std::mutex> lock(list.mutex);
+                if(list.blocks.size() < MaxFreeBlocks)
+                {
+                    list.blocks.push_back(data);
+                    return;
+                }
+            }
+            free(data);
+        }
+
+        private:
+            /* \brief The free blocks */
+            struct FreeList
+            {
+                std::mutex            mutex;  /*!< Protect blocks*/
+                std::vector<uint8_t*> blocks; /*!< The free blocks*/
+
+                ~FreeList()
+                {
+                    for(uint8_t* block : blocks)
+                        free(block);
+                }
+            };
+
+            /* \brief Get the free list shared by every user of this allocator type */
+            static FreeList& freeList()
+            {
+                static FreeList list;
+                return list;
+            }
+    };
+
+    /*----------------------------------------------------------------------------*/
+    /*--------------------------------WAIT STRATEGIES-----------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief Sleep a few microseconds when a handler has nothing to do (lowest CPU usage) */
+    struct SleepWait
+    {
+        static void idle() {usleep(5);}
+    };
+
+    /* \brief Yield the CPU when a handler has nothing to do */
+    struct YieldWait
+    {
+        static void idle() {std::this_thread::yield();}
+    };
+
+    /* \brief Busy-wait when a handler has nothing to do (lowest latency, burns one core per handler) */
+    struct SpinWait
+    {
+        static void idle()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    };
+
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------------LOCKS----------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief A spin lock usable in place of std::mutex for the very short critical sections of the handler queues */
+    class SpinLock
+    {
+        public:
+            void lock()
+            {
+                while(m_flag.test_and_set(std::memory_order_acquire))
+                    SpinWait::idle();
+            }
+
+            bool try_lock() {return !m_flag.test_and_set(std::memory_order_acquire);}
+
+            void unlock() {m_flag.clear(std::memory_order_release);}
+        private:
+            std::atomic_flag m_flag = ATOMIC_FLAG_INIT; /*!< Is the lock taken?*/
+    };
+
+    /*----------------------------------------------------------------------------*/
+    /*------------------------------------FRAMING---------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief Deliver the data as it was read from the socket (arbitrary chunks) */
+    struct RawFraming
+    {
+        /* \brief Feed the data received for a client. Called by the handle messages thread of this client
+         * \param client the client who sent the data
+         * \param data the data received
+         * \param size the data size
+         * \param deliver the function to call for each message, deliver(data, size). deliver.close() asks the Server to close the client
+         * (e.g., malformed data) : the read thread unregisters and closes it, and no more data of this client is fed */
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& deliver)
+        {
+            deliver(data, size);
+        }
+    };
+
+    /* \brief Deliver messages prefixed by their uint32_t (host byte order) size. The prefix is not delivered.
+     * Partial messages are kept in ClientSocket::framingState
+     * \param MaxSize the maximum size of a message. Larger messages close the client */
+    template <uint32_t MaxSize = (1u << 26)>
+    struct LengthPrefixFraming
+    {
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& deliver)
+        {
+            std::vector<uint8_t>* partial = static_cast<std::vector<uint8_t>*>(client->framingState.get());
+
+            //Complete the pending message first
+            if(partial && partial->size() > 0)
+            {
+                uint32_t consumed = append(*partial, data, size);
+                data += consumed;
+                size -= consumed;
+                if(!isComplete(*partial, deliver))
+                    return;
+                deliver(partial->data()+sizeof(uint32_t), (uint32_t)(partial->size()-sizeof(uint32_t)));
+                partial->clear();
+            }
+
+            //Deliver every complete message without copying
+            while(size >= sizeof(uint32_t))
+            {
+                uint32_t msgSize;
+                memcpy(&msgSize, data, sizeof(uint32_t));
+                if(msgSize > MaxSize)
+                {
+                    deliver.close();
+                    return;
+                }
+                if(size - sizeof(uint32_t) < msgSize)
+                    break;
+                deliver(data+sizeof(uint32_t), msgSize);
+                data += sizeof(uint32_t) + msgSize;
+                size -= sizeof(uint32_t) + msgSize;
+            }
+
+            //Keep the remaining bytes
+            if(size > 0)
+            {
+                if(!partial)
+                {
+                    client->framingState = std::make_shared<std::vector<uint8_t>>();
+                    partial = static_cast<std::vector<uint8_t>*>(client->framingState.get());
+                }
+                partial->insert(partial->end(), data, data+size);
+            }
+        }
+
+        private:
+            /* \brief Append to a partial message the bytes it misses (header first, then payload)
+             * \return the number of bytes consumed */
+            static uint32_t append(std::vector<uint8_t>& partial, uint8_t* data, uint32_t size)
+            {
+                uint32_t consumed = 0;
+                if(partial.size() < sizeof(uint32_t))
+                {
+                    consumed = std::min<uint32_t>(size, sizeof(uint32_t) - partial.size());
+                    partial.insert(partial.end(), data, data+consumed);
+                    if(partial.size() < sizeof(uint32_t))
+                        return consumed;
+                }
+
+                uint32_t msgSize;
+                memcpy(&msgSize, partial.data(), sizeof(uint32_t));
+                if(msgSize > MaxSize)
+                    return consumed;
+                uint32_t missing = std::min<uint32_t>(size-consumed, msgSize - (uint32_t)(partial.size() - sizeof(uint32_t)));
+                partial.insert(partial.end(), data+consumed, data+consumed+missing);
+                return consumed + missing;
+            }
+
+            /* \brief Is the partial message complete? Closes the client if the message is too large */
+            template <typename F>
+            static bool isComplete(std::vector<uint8_t>& partial, F& deliver)
+            {
+                if(partial.size() < sizeof(uint32_t))
+                    return false;
+                uint32_t msgSize;
+                memcpy(&msgSize, partial.data(), sizeof(uint32_t));
+                if(msgSize > MaxSize)
+                {
+                    partial.clear();
+                    deliver.close();
+                    return false;
+                }
+                return partial.size() - sizeof(uint32_t) == msgSize;
+            }
+    };
+
+    /* \brief Like LengthPrefixFraming, but messages larger than StreamThreshold are not buffered : they are streamed to
+     * Server::onFrameBegin(size), then Server::onFrameChunk(data, size) for each received piece, and Server::onFrameEnd().
+     * Smaller messages are delivered whole to Server::onMessage. Combined with PoolAllocator, the memory used by a large upload
+     * is bounded by the block size instead of the message size.
+     * A streamed message whose client is closed before its end never gets onFrameEnd
+     * \param StreamThreshold the size above which messages are streamed
+     * \param MaxSize the maximum size of a message. Larger messages close the client */
+    template <uint32_t StreamThreshold = (1u << 16), uint32_t MaxSize = UINT32_MAX>
+    struct StreamingLengthPrefixFraming
+    {
+        /* \brief Feed the data received for a client. See RawFraming::feed
+         * \param sink the message receiver : sink(data, size) for whole messages, and sink.frameBegin(size),
+         * sink.frameChunk(data, size), sink.frameEnd() for streamed messages */
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& sink)
+        {
+            State* state = static_cast<State*>(client->framingState.get());
+            if(!state)
+            {
+                client->framingState = std::make_shared<State>();
+                state = static_cast<State*>(client->framingState.get());
+            }
+
+            while(size > 0 && client->isConnected())
+            {
+                //Stream the payload of a large message
+                if(state->remaining > 0)
+                {
+                    uint32_t chunkSize = std::min(size, state->remaining);
+                    state->remaining  -= chunkSize;
+                    sink.frameChunk(data, chunkSize);
+                    data += chunkSize;
+                    size -= chunkSize;
+                    if(state->remaining == 0)
+                        sink.frameEnd();
+                    continue;
+                }
+
+                //Complete the pending header or small message first
+                if(state->partial.size() > 0)
+                {
+                    uint32_t consumed = appendPartial(client, state, data, size, sink);
+                    data += consumed;
+                    size -= consumed;
+                    continue;
+                }
+
+                if(size < sizeof(uint32_t))
+                {
+                    state->partial.insert(state->partial.end(), data, data+size);
+                    return;
+                }
+
+                uint32_t msgSize;
+                memcpy(&msgSize, data, sizeof(uint32_t));
+                if(msgSize > MaxSize)
+                {
+                    sink.close();
+                    return;
+                }
+
+                //Large message : stream it
+                if(msgSize > StreamThreshold)
+                {
+                    data += sizeof(uint32_t);
+                    size -= sizeof(uint32_t);
+                    state->remaining = msgSize;
+                    sink.frameBegin(msgSize);
+                    continue;
+                }
+
+                //Small message : deliver it without copying if complete
+                if(size - sizeof(uint32_t) < msgSize)
+                {
+                    state->partial.insert(state->partial.end(), data, data+size);
+                    return;
+                }
+                sink(data+sizeof(uint32_t), msgSize);
+                data += sizeof(uint32_t) + msgSize;
+                size -= sizeof(uint32_t) + msgSize;
+            }
+        }
+
+        private:
+            /* \brief The per-client framing state */
+            struct State
+            {
+                std::vector<uint8_t> partial;       /*!< The pending header or small message (with its header)*/
+                uint32_t             remaining = 0; /*!< The bytes remaining of the streamed message*/
+            };
+
+            /* \brief Append to the pending header or small message the bytes it misses, and deliver or start streaming it
+             * \return the number of bytes consumed */
+            template <typename C, typename F>
+            static uint32_t appendPartial(C* client, State* state, uint8_t* data, uint32_t size, F&& sink)
+            {
+                std::vector<uint8_t>& partial = state->partial;
+                uint32_t consumed = 0;
+                if(partial.size() < sizeof(uint32_t))
+                {
+                    consumed = std::min<uint32_t>(size, sizeof(uint32_t) - partial.size());
+                    partial.insert(partial.end(), data, data+consumed);
+                    if(partial.size() < sizeof(uint32_t))
+                        return consumed;
+                }
+
+                uint32_t msgSize;
+                memcpy(&msgSize, partial.data(), sizeof(uint32_t));
+                if(msgSize > MaxSize)
+                {
+                    partial.clear();
+                    sink.close();
+                    return size;
+                }
+                if(msgSize > StreamThreshold)
+                {
+                    partial.clear();
+                    state->remaining = msgSize;
+                    sink.frameBegin(msgSize);
+                    return consumed;
+                }
+
+                uint32_t missing = std::min<uint32_t>(size-consumed, msgSize - (uint32_t)(partial.size() - sizeof(uint32_t)));
+                partial.insert(partial.end(), data+consumed, data+consumed+missing);
+                if(partial.size() - sizeof(uint32_t) == msgSize)
+                {
+                    sink(partial.data()+sizeof(uint32_t), msgSize);
+                    partial.clear();
+                }
+                return consumed + missing;
+            }
+    };
+
+    /* \brief Deliver the records ended by a delimiter byte (e.g., '\n' or '\0' text protocols). The delimiter is not delivered.
+     * Record boundaries are found with scanByte (SIMD). Records complete in the received data are delivered without copy,
+     * only a record split between two reads is gathered in ClientSocket::framingState
+     * \param Delimiter the byte ending a record
+     * \param MaxRecordSize the maximum size of a record. Longer records close the client */
+    template <uint8_t Delimiter = '\n', uint32_t MaxRecordSize = (1u << 16)>
+    struct DelimiterFraming
+    {
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& deliver)
+        {
+            std::vector<uint8_t>* partial = static_cast<std::vector<uint8_t>*>(client->framingState.get());
+
+            //Complete the pending record first
+            if(partial && partial->size() > 0)
+            {
+                const uint8_t* end = scanByte(data, size, Delimiter);
+                uint32_t length = (end ? (uint32_t)(end - data) : size);
+                if(partial->size() + length > MaxRecordSize)
+                {
+                    partial->clear();
+                    deliver.close();
+                    return;
+                }
+                partial->insert(partial->end(), data, data+length);
+                if(!end)
+                    return;
+
+                deliver(partial->data(), (uint32_t)partial->size());
+                partial->clear();
+                data += length+1;
+                size -= length+1;
+            }
+
+            //Deliver every complete record without copying
+            while(size > 0)
+            {
+                const uint8_t* end = scanByte(data, size, Delimiter);
+                if(!end)
+                    break;
+                uint32_t length = (uint32_t)(end - data);
+                if(length > MaxRecordSize)
+                {
+                    deliver.close();
+                    return;
+                }
+                deliver(data, length);
+                data += length+1;
+                size -= length+1;
+            }
+
+            //Keep the unfinished record
+            if(size > 0)
+            {
+                if(size > MaxRecordSize)
+                {
+                    deliver.close();
+                    return;
+                }
+                if(!partial)
+                {
+                    client->framingState = std::make_shared<std::vector<uint8_t>>();
+                    partial = static_cast<std::vector<uint8_t>*>(client->framingState.get());
+                }
+                partial->insert(partial->end(), data, data+size);
+            }
+        }
+    };
+
+    /*----------------------------------------------------------------------------*/
+    /*-----------------------------------DISPATCH---------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief Call the virtual Server::onMessage and Server::closeClient functions */
+    struct VirtualDispatch
+    {
+        template <typename S, typename C>
+        static void onMessage(S* server, uint32_t bufID, C* client, uint8_t* data, uint32_t size)
+        {
+            server->onMessage(bufID, client, data, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameBegin(S* server, uint32_t bufID, C* client, uint32_t size)
+        {
+            server->onFrameBegin(bufID, client, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameChunk(S* server, uint32_t bufID, C* client, uint8_t* data, uint32_t size)
+        {
+            server->onFrameChunk(bufID, client, data, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameEnd(S* server, uint32_t bufID, C* client)
+        {
+            server->onFrameEnd(bufID, client);
+        }
+
+        template <typename S>
+        static void closeClient(S* server, int client)
+        {
+            server->closeClient(client);
+        }
+    };
+
+    /* \brief CRTP dispatch : call Derived::onMessage and Derived::closeClient without virtual call so that the compiler can inline
+     * the whole read -> dispatch path. Derived must give access to its onMessage, onFrameBegin, onFrameChunk, onFrameEnd and closeClient functions
+     * (e.g., friend struct StaticDispatch<Derived>;)
+     * \param Derived the final Server class */
+    template <typename Derived>
+    struct StaticDispatch
+    {
+        template <typename S, typename C>
+        static void onMessage(S* server, uint32_t bufID, C* client, uint8_t* data, uint32_t size)
+        {
+            static_cast<Derived*>(server)->Derived::onMessage(bufID, client, data, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameBegin(S* server, uint32_t bufID, C* client, uint32_t size)
+        {
+            static_cast<Derived*>(server)->Derived::onFrameBegin(bufID, client, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameChunk(S* server, uint32_t bufID, C* client, uint8_t* data, uint32_t size)
+        {
+            static_cast<Derived*>(server)->Derived::onFrameChunk(bufID, client, data, size);
+        }
+
+        template <typename S, typename C>
+        static void onFrameEnd(S* server, uint32_t bufID, C* client)
+        {
+            static_cast<Derived*>(server)->Derived::onFrameEnd(bufID, client);
+        }
+
+        template <typename S>
+        static void closeClient(S* server, int client)
+        {
+            static_cast<Derived*>(server)->Derived::closeClient(client);
+        }
+    };
+
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------POLICY SELECTION-----------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief The default Server policies */
+    struct DefaultServerPolicies
+    {
+        template <typename M>
+        using Queue = std::queue<M>;       /*!< The handle messages thread queues*/
+        typedef MallocAllocator Allocator; /*!< The received buffers allocator*/
+        typedef SleepWait       Wait;      /*!< What an idle handler does*/
+        typedef std::mutex      Lock;      /*!< The handler queues lock*/
+        typedef RawFraming      Framing;   /*!< How received data are split into messages*/
+        typedef VirtualDispatch Dispatch;  /*!< How the Server calls onMessage and closeClient*/
+    };
+
+    /* \brief The base of every policy setter. Virtual inheritance lets each setter override only one policy */
+    struct DefaultServerPoliciesBase : virtual DefaultServerPolicies
+    {};
+
+    /* \brief Select the handle messages thread queue (e.g., QueueIs<MyQueue>). Q<M> must provide push, emplace, front, pop, size and empty */
+    template <template <typename> class Q>
+    struct QueueIs : virtual DefaultServerPolicies
+    {
+        template <typename M>
+        using Queue = Q<M>;
+    };
+
+    /* \brief Select the received buffers allocator */
+    template <typename A>
+    struct AllocatorIs : virtual DefaultServerPolicies
+    {
+        typedef A Allocator;
+    };
+
+    /* \brief Select the wait strategy of idle handlers (SleepWait, YieldWait, SpinWait) */
+    template <typename W>
+    struct WaitIs : virtual DefaultServerPolicies
+    {
+        typedef W Wait;
+    };
+
+    /* \brief Select the lock of the handler queues (std::mutex, SpinLock) */
+    template <typename L>
+    struct LockIs : virtual DefaultServerPolicies
+    {
+        typedef L Lock;
+    };
+
+    /* \brief Select the framing (RawFraming, LengthPrefixFraming, StreamingLengthPrefixFraming, DelimiterFraming) */
+    template <typename F>
+    struct FramingIs : virtual DefaultServerPolicies
+    {
+        typedef F Framing;
+    };
+
+    /* \brief Select the dispatch (VirtualDispatch, StaticDispatch<Derived>) */
+    template <typename D>
+    struct DispatchIs : virtual DefaultServerPolicies
+    {
+        typedef D Dispatch;
+    };
+
+    /* \brief Make two identical setters distinct base classes */
+    template <typename Setter, size_t I>
+    struct PolicyDiscriminator : Setter
+    {};
+
+    template <typename Indices, typename... Setters>
+    struct PolicySelectorImpl;
+
+    template <size_t... I, typename... Setters>
+    struct PolicySelectorImpl<std::index_sequence<I...>, Setters...> : DefaultServerPoliciesBase, PolicyDiscriminator<Setters, I>...
+    {};
+
+    /* \brief Merge policy setters (QueueIs, AllocatorIs, WaitIs, LockIs, FramingIs, DispatchIs) over the default policies.
+     * ServerPolicies<> is DefaultServerPolicies */
+    template <typename... Setters>
+    struct ServerPolicies : PolicySelectorImpl<std::index_sequence_for<Setters...>, Setters...>
+    {};
+}
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef  SHAREDMEMORYCHANNEL_INC
+#define  SHAREDMEMORYCHANNEL_INC
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <string>
+#include "Types/ServerType.h"
+
+namespace sereno
+{
+    /* \brief The header of a single producer single consumer ring stored in shared memory.
+     * head and tail grow monotonically, the position in the ring is given by (value % capacity).
+     * Both sides can write the whole header : a side never trusts it (see SharedMemoryRing) */
+    struct SharedMemoryRingHeader
+    {
+        alignas(64) std::atomic<uint64_t> head;            /*!< The write position (owned by the producer)*/
+        alignas(64) std::atomic<uint64_t> tail;            /*!< The read position (owned by the consumer)*/
+        alignas(64) std::atomic<uint32_t> consumerWaiting; /*!< Is the consumer sleeping on its doorbell?*/
+        alignas(64) std::atomic<uint32_t> producerWaiting; /*!< Is the producer sleeping on its space doorbell (ring full)?*/
+        uint32_t                          capacity;        /*!< The data capacity in bytes (power of two). Informative only*/
+    };
+
+    /* \brief A byte stream single producer single consumer ring living in shared memory.
+     * This object does not own the memory it works on. The capacity is kept on this side, and a header
+     * whose head and tail are more than capacity bytes apart (a buggy or hostile peer) corrupts the ring :
+     * it is then never read nor written again (see isCorrupted) */
+    class SharedMemoryRing
+    {
+        public:
+            /* \brief Constructor
+             * \param header the ring header, followed in memory by the ring data
+             * \param capacity the ring capacity in bytes, as mapped. Must be a power of two */
+            SharedMemoryRing(SharedMemoryRingHeader* header = NULL, uint32_t capacity = 0);
+
+            /* \brief Initialize the header of a newly created ring */
+            void init();
+
+            /* \brief Write as many bytes as possible into the ring (producer side)
+             * \param data the data to write
+             * \param size the data size in bytes
+             * \return the number of bytes written */
+            uint32_t write(const uint8_t* data, uint32_t size);
+
+            /* \brief Read as many bytes as possible from the ring (consumer side)
+             * \param data the buffer to fill
+             * \param size the buffer size in bytes
+             * \return the number of bytes read */
+            uint32_t read(uint8_t* data, uint32_t size);
+
+            /* \brief Get the number of bytes available for reading
+             * \return the number of bytes to read, 0 if the ring is corrupted */
+            uint32_t available() const;
+
+            /* \brief Get the number of bytes which can be written
+             * \return the free bytes. The capacity if the ring is corrupted (write then fails) */
+            uint32_t freeSpace() const;
+
+            /* \brief Did the peer corrupt the ring header?
+             * \return true if yes, false otherwise */
+            bool isCorrupted() const {return m_corrupted;}
+
+            /* \brief Get the ring header
+             * \return the ring header */
+            SharedMemoryRingHeader* getHeader() {return m_header;}
+        private:
+            /* \brief Get the bytes between tail and head, checking the header
+             * \param head the write position
+             * \param tail the read position
+             * \return the bytes in the ring, 0 if the ring is corrupted */
+            uint32_t used(uint64_t head, uint64_t tail) const;
+
+            SharedMemoryRingHeader* m_header;            /*!< The ring header*/
+            uint8_t*                m_data;              /*!< The ring data, following the header*/
+            uint32_t                m_capacity;          /*!< The ring capacity (never read from the header)*/
+            mutable bool            m_corrupted = false; /*!< Did the peer corrupt the header?*/
+    };
+
+    /* \brief A bidirectional same-host channel made of two SharedMemoryRing stored in one memfd.
+     * Each side has two eventfd doorbells, only rung when this side sleeps : one for inbound data, one for outbound space
+     * (its outbound ring was full). The fast path (data is flowing) therefore does not need any system call.
+     *
+     * The Server side is created with create() and sent to the client with sendTo() over a UNIX control socket.
+     * The client side is retrieved with connect(). */
+    class SharedMemoryChannel
+    {
+        public:
+            /* \brief Destructor. Unmap the memory and close the file descriptors */
+            ~SharedMemoryChannel();
+
+            /* \brief Create the server side of a new channel
+             * \param ringSize the size of each ring in bytes. Rounded up to a power of two
+             * \return the new channel, NULL on error */
+            static std::shared_ptr<SharedMemoryChannel> create(uint32_t ringSize);
+
+            /* \brief Connect to a Server shared memory control socket and retrieve the client side of the channel
+             * \param path the UNIX control socket path
+             * \return the new channel, NULL on error */
+            static std::shared_ptr<SharedMemoryChannel> connect(const std::string& path);
+
+            /* \brief Send the channel file descriptors (memory, doorbells) to the client
+             * \param sock the UNIX control socket connected to the client
+             * \return true on success, false otherwise */
+            bool sendTo(SOCKET sock);
+
+            /* \brief Write the whole data into the outbound ring. Sleeps on the space doorbell while the ring is full.
+             * \param data the data to write
+             * \param size the data size
+             * \return true on success, false if the channel has been closed */
+            bool write(const uint8_t* data, uint32_t size);
+
+            /* \brief Read available data from the inbound ring, and wake the producer if it waits for space. Does not block
+             * \param data the buffer to fill
+             * \param size the buffer size
+             * \return the number of bytes read */
+            uint32_t read(uint8_t* data, uint32_t size);
+
+            /* \brief Did the other side corrupt one of the rings? The channel is then unusable and its client has to be closed.
+             * Call it from the reading thread
+             * \return true if yes, false otherwise */
+            bool isCorrupted() const {return m_in.isCorrupted() || m_outCorrupted;}
+
+            /* \brief Get the number of bytes available in the inbound ring
+             * \return the number of bytes available */
+            uint32_t available() const {return m_in.available();}
+
+            /* \brief Tell the producer that we are going to sleep on our doorbell.
+             * \return true if we can sleep (the inbound ring is still empty), false if data arrived meanwhile */
+            bool prepareWait();
+
+            /* \brief Acknowledge the doorbell after sleeping on it */
+            void finishWait();
+
+            /* \brief Wait for inbound data
+             * \param timeout the timeout in milliseconds (-1 == infinite)
+             * \return true if data is available, false otherwise */
+            bool wait(int timeout);
+
+            /* \brief Close the channel. Pending and future writes fail, a write waiting for space is woken up */
+            void close();
+
+            /* \brief Get the doorbell file descriptor to poll for inbound data
+             * \return the eventfd rung by the other side */
+            int getDoorbell() const {return m_inDoorbell;}
+
+            /* \brief Get the UNIX control socket (client side only)
+             * \return the control socket, SOCKET_ERROR on the server side */
+            SOCKET getControlSocket() const {return m_control;}
+        private:
+            SharedMemoryChannel();
+
+            /* \brief Check the memory size then map the memory and set the rings
+             * \param isServer are we the server side?
+             * \return true on success, false otherwise */
+            bool map(bool isServer);
+
+            /* \brief Sleep on the space doorbell until the consumer frees space in the outbound ring, or the channel is closed */
+            void waitSpace();
+
+            int               m_memFD             = -1;           /*!< The memfd containing both rings*/
+            void*             m_memory            = NULL;         /*!< The mapped memory*/
+            size_t            m_memorySize        = 0;            /*!< The mapped memory size*/
+            uint32_t          m_ringSize          = 0;            /*!< The size of each ring*/
+            int               m_doorbells[4]{-1, -1, -1, -1};     /*!< The data doorbells of the server (0) and of the client (1), then their space doorbells (2, 3)*/
+            int               m_inDoorbell        = -1;           /*!< The doorbell we sleep on for inbound data*/
+            int               m_outDoorbell       = -1;           /*!< The doorbell we ring for outbound data*/
+            int               m_spaceDoorbell     = -1;           /*!< The doorbell we sleep on for outbound space*/
+            int               m_peerSpaceDoorbell = -1;           /*!< The doorbell we ring once we freed inbound space*/
+            SharedMemoryRing  m_in;                               /*!< The ring we read*/
+            SharedMemoryRing  m_out;                              /*!< The ring we write*/
+            SOCKET            m_control           = SOCKET_ERROR; /*!< The control socket (client side)*/
+            std::atomic<bool> m_closed;                           /*!< Is the channel closed?*/
+            std::atomic<bool> m_outCorrupted{false};              /*!< Did the other side corrupt the ring we write?*/
+    };
+}
+
+#endif
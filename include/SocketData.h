@@ -3,13 +3,20 @@
 
 #include <memory>
 #include <cstdint>
+#include <sys/types.h>
+#include "Buffer.h"
 
 namespace sereno
 {
     struct SocketData
     {
-        std::shared_ptr<uint8_t> data;
+        Buffer                   data;
         int dataSize;
+        Buffer                   header;         /*!< Optional header written right before data (e.g., chunk header)*/
+        int                      headerSize = 0; /*!< The header size*/
+        std::shared_ptr<int>     file;           /*!< If set, send dataSize bytes of this file descriptor (closed with the last reference) instead of data*/
+        off_t                    fileOffset = 0; /*!< The offset in file*/
+        bool                     zeroCopy = false; /*!< Send data with MSG_ZEROCOPY if the socket allows it*/
     };
 }
 
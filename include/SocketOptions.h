@@ -0,0 +1,35 @@
+#ifndef  SOCKETOPTIONS_INC
+#define  SOCKETOPTIONS_INC
+
+#include <cstdint>
+#include "Types/ServerType.h"
+
+namespace sereno
+{
+    /* \brief The socket options policy applied to a listening socket and to every client accepted through it.
+     * A negative value means "keep the system default". TCP options are ignored for AF_UNIX sockets */
+    struct SocketOptions
+    {
+        int  rcvBuf      = -1;    /*!< SO_RCVBUF in bytes*/
+        int  sndBuf      = -1;    /*!< SO_SNDBUF in bytes*/
+        int  deferAccept = -1;    /*!< TCP_DEFER_ACCEPT in seconds (listener only) : wake the accept thread only once data has arrived*/
+        int  busyPoll    = -1;    /*!< SO_BUSY_POLL in microseconds*/
+        bool quickAck    = false; /*!< TCP_QUICKACK (clients only)*/
+        bool noDelay     = true;  /*!< TCP_NODELAY (clients only)*/
+        bool zeroCopy    = false; /*!< SO_ZEROCOPY (clients only) : lets ClientSocket::pushZeroCopy send with MSG_ZEROCOPY*/
+
+        /* \brief Apply the options to a listening socket
+         * \param sock the listening socket
+         * \param domain the socket domain (AF_INET, AF_INET6, AF_UNIX)
+         * \return true on success, false if at least one option could not be set */
+        bool applyToListener(SOCKET sock, int domain) const;
+
+        /* \brief Apply the options to an accepted client socket
+         * \param sock the client socket
+         * \param domain the socket domain (AF_INET, AF_INET6, AF_UNIX)
+         * \return true on success, false if at least one option could not be set */
+        bool applyToClient(SOCKET sock, int domain) const;
+    };
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef  THREADCONFIG_INC
+#define  THREADCONFIG_INC
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+namespace sereno
+{
+    /* \brief The classes of threads started by the Server */
+    enum ThreadClass
+    {
+        THREAD_ACCEPT = 0,  /*!< The accept connections thread*/
+        THREAD_READ,        /*!< The read sockets thread*/
+        THREAD_WRITE,       /*!< The write message thread*/
+        THREAD_HANDLER,     /*!< The handle messages threads (one per buffer)*/
+        THREAD_CLIENT,      /*!< The writing thread of each ClientSocket*/
+        THREAD_CLASS_COUNT
+    };
+
+    /* \brief The threading configuration of a Server : CPU affinity and name of each class of thread.
+     * Memory placement follows the threads (first-touch policy of the kernel) : the received buffers and the handler queues are
+     * allocated by the read thread, pin THREAD_READ on the NUMA node of the handlers for them to be local to the handlers */
+    class ThreadConfig
+    {
+        public:
+            /* \brief Constructor. No affinity, default names ("srvAccept", "srvRead", "srvWrite", "srvHandle<i>", "srvClient<i>") */
+            ThreadConfig();
+
+            /* \brief Pin a class of threads to a CPU set
+             * \param cls the thread class
+             * \param cpus the CPUs to use. Empty == no affinity
+             * \param spread if true, the thread i of this class is pinned on cpus[i % cpus.size()] only.
+             * Otherwise every thread of this class can run on any CPU of the set */
+            void setCPUs(ThreadClass cls, const std::vector<int>& cpus, bool spread = false);
+
+            /* \brief Set the name prefix of a class of threads, as shown by top or perf.
+             * Classes having several threads are suffixed by the thread index. Names are truncated to 15 characters
+             * \param cls the thread class
+             * \param name the name prefix. Empty == do not name the threads */
+            void setName(ThreadClass cls, const std::string& name);
+
+            /* \brief Apply the configuration (affinity and name) to a thread
+             * \param cls the thread class
+             * \param index the index of the thread in its class (the client socket for THREAD_CLIENT)
+             * \param thread the thread to configure
+             * \return true on success, false otherwise*/
+            bool apply(ThreadClass cls, uint32_t index, pthread_t thread) const;
+        private:
+            std::vector<int> m_cpus[THREAD_CLASS_COUNT];   /*!< The CPU set of each thread class*/
+            bool             m_spread[THREAD_CLASS_COUNT]; /*!< Is each thread pinned on one CPU of the set?*/
+            std::string      m_names[THREAD_CLASS_COUNT];  /*!< The name prefix of each thread class*/
+    };
+}
+
+#endif
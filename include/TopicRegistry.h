@@ -0,0 +1,169 @@
+#ifndef  TOPICREGISTRY_INC
+#define  TOPICREGISTRY_INC
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sereno
+{
+    /* \brief A topic of a TopicRegistry. Its subscriber list is an immutable snapshot replaced (copy-on-write) at each
+     * subscription change, so that publishers read it without taking the registry lock */
+    template <typename C>
+    class Topic
+    {
+        public:
+            typedef std::vector<C*> Subscribers;
+
+            /* \brief Constructor
+             * \param name the topic name */
+            Topic(const std::string& name) : m_name(name), m_subscribers(std::make_shared<Subscribers>())
+            {}
+
+            /* \brief Get the current subscribers snapshot. Lock-free for the caller
+             * \return the subscribers at the time of the call */
+            std::shared_ptr<const Subscribers> getSubscribers() const {return std::atomic_load(&m_subscribers);}
+
+            /* \brief Get the topic name
+             * \return the topic name */
+            const std::string& getName() const {return m_name;}
+        private:
+            template <typename> friend class TopicRegistry;
+
+            std::string                        m_name;        /*!< The topic name*/
+            std::shared_ptr<const Subscribers> m_subscribers; /*!< The subscribers snapshot (atomically replaced)*/
+    };
+
+    /* \brief Map topics to their subscribed clients. Subscriptions are serialized by a mutex, publications only read snapshots */
+    template <typename C>
+    class TopicRegistry
+    {
+        public:
+            typedef typename Topic<C>::Subscribers Subscribers;
+
+            /* \brief Subscribe a client to a topic
+             * \param topic the topic name
+             * \param client the client to subscribe
+             * \return true on success, false if the client was already subscribed */
+            bool subscribe(const std::string& topic, C* client)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::shared_ptr<Topic<C>> t = getOrCreate(topic);
+
+                std::shared_ptr<const Subscribers> old = t->m_subscribers;
+                if(std::find(old->begin(), old->end(), client) != old->end())
+                    return false;
+
+                std::shared_ptr<Subscribers> subscribers = std::make_shared<Subscribers>(*old);
+                subscribers->push_back(client);
+                std::atomic_store(&t->m_subscribers, std::shared_ptr<const Subscribers>(subscribers));
+                m_clientTopics[client].push_back(topic);
+                return true;
+            }
+
+            /* \brief Unsubscribe a client from a topic
+             * \param topic the topic name
+             * \param client the client to unsubscribe
+             * \return true on success, false if the client was not subscribed */
+            bool unsubscribe(const std::string& topic, C* client)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(!removeSubscriber(topic, client))
+                    return false;
+
+                auto it = m_clientTopics.find(client);
+                if(it != m_clientTopics.end())
+                {
+                    it->second.erase(std::remove(it->second.begin(), it->second.end(), topic), it->second.end());
+                    if(it->second.empty())
+                        m_clientTopics.erase(it);
+                }
+                return true;
+            }
+
+            /* \brief Unsubscribe a client from every topic. Has to be called before deleting the client
+             * \param client the client to unsubscribe */
+            void unsubscribeAll(C* client)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_clientTopics.find(client);
+                if(it == m_clientTopics.end())
+                    return;
+                for(const std::string& topic : it->second)
+                    removeSubscriber(topic, client);
+                m_clientTopics.erase(it);
+            }
+
+            /* \brief Get a topic, to publish on it without looking it up each time
+             * \param topic the topic name
+             * \return the topic (created if needed) */
+            std::shared_ptr<Topic<C>> getTopic(const std::string& topic)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return getOrCreate(topic);
+            }
+
+            /* \brief Get the subscribers snapshot of a topic
+             * \param topic the topic name
+             * \return the subscribers, NULL if the topic does not exist */
+            std::shared_ptr<const Subscribers> getSubscribers(const std::string& topic)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto it = m_topics.find(topic);
+                if(it == m_topics.end())
+                    return NULL;
+                return it->second->getSubscribers();
+            }
+
+            /* \brief Remove every topic and subscription */
+            void clear()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                for(auto& it : m_topics)
+                    std::atomic_store(&it.second->m_subscribers, std::shared_ptr<const Subscribers>(std::make_shared<Subscribers>()));
+                m_topics.clear();
+                m_clientTopics.clear();
+            }
+        private:
+            /* \brief Get or create a topic. m_mutex must be locked
+             * \param topic the topic name
+             * \return the topic */
+            std::shared_ptr<Topic<C>> getOrCreate(const std::string& topic)
+            {
+                std::shared_ptr<Topic<C>>& t = m_topics[topic];
+                if(!t)
+                    t = std::make_shared<Topic<C>>(topic);
+                return t;
+            }
+
+            /* \brief Remove a subscriber from the snapshot of a topic. m_mutex must be locked
+             * \param topic the topic name
+             * \param client the client to remove
+             * \return true if the client was subscribed, false otherwise */
+            bool removeSubscriber(const std::string& topic, C* client)
+            {
+                auto it = m_topics.find(topic);
+                if(it == m_topics.end())
+                    return false;
+
+                std::shared_ptr<const Subscribers> old = it->second->m_subscribers;
+                auto pos = std::find(old->begin(), old->end(), client);
+                if(pos == old->end())
+                    return false;
+
+                std::shared_ptr<Subscribers> subscribers = std::make_shared<Subscribers>(*old);
+                subscribers->erase(subscribers->begin() + (pos - old->begin()));
+                std::atomic_store(&it->second->m_subscribers, std::shared_ptr<const Subscribers>(subscribers));
+                return true;
+            }
+
+            std::mutex                                                 m_mutex;        /*!< Serialize the subscription changes*/
+            std::unordered_map<std::string, std::shared_ptr<Topic<C>>> m_topics;       /*!< The topics*/
+            std::unordered_map<C*, std::vector<std::string>>           m_clientTopics; /*!< The topics of each client, for unsubscribeAll*/
+    };
+}
+
+#endif
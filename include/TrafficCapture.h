@@ -0,0 +1,108 @@
+#ifndef  TRAFFICCAPTURE_INC
+#define  TRAFFICCAPTURE_INC
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sereno
+{
+    /* \brief The type of a captured record */
+    enum CaptureRecordType
+    {
+        CAPTURE_END   = 0, /*!< No more record in this segment*/
+        CAPTURE_DATA  = 1, /*!< Data received from a client*/
+        CAPTURE_CLOSE = 2  /*!< The client has been disconnected*/
+    };
+
+    /* \brief The header of a captured record, followed by "size" bytes of data. Records are 8-bytes aligned */
+    struct CaptureRecordHeader
+    {
+        uint64_t timestamp; /*!< The reception time (CLOCK_MONOTONIC, in nanoseconds)*/
+        uint32_t clientID;  /*!< The client identifier (its socket at capture time)*/
+        uint32_t size;      /*!< The data size*/
+        uint32_t type;      /*!< The record type (CaptureRecordType)*/
+        uint32_t reserved;  /*!< Padding*/
+    };
+
+    /* \brief A captured record, pointing into the mapped capture segment */
+    struct CaptureRecord
+    {
+        uint64_t       timestamp; /*!< The reception time (CLOCK_MONOTONIC, in nanoseconds)*/
+        uint32_t       clientID;  /*!< The client identifier*/
+        uint32_t       type;      /*!< The record type (CaptureRecordType)*/
+        const uint8_t* data;      /*!< The data. Valid until the next call of TrafficCaptureReader::next*/
+        uint32_t       size;      /*!< The data size*/
+    };
+
+    /* \brief Append the inbound traffic of a Server to a memory-mapped segmented log (capture-<n>.log files in a directory).
+     * Single writer : only the read sockets thread appends to it */
+    class TrafficCapture
+    {
+        public:
+            /* \brief Constructor
+             * \param directory the directory where to write the segments. Must exist
+             * \param segmentSize the size of each segment in bytes */
+            TrafficCapture(const std::string& directory, uint64_t segmentSize = 64 << 20);
+
+            /* \brief Destructor. Truncate and close the current segment */
+            ~TrafficCapture();
+
+            /* \brief Append a record
+             * \param type the record type
+             * \param clientID the client identifier
+             * \param data the data (can be NULL if size == 0)
+             * \param size the data size
+             * \return true on success, false otherwise */
+            bool append(CaptureRecordType type, uint32_t clientID, const uint8_t* data, uint32_t size);
+
+            /* \brief Close the current segment */
+            void close();
+        private:
+            /* \brief Open the next segment
+             * \param minSize the minimum size of this segment
+             * \return true on success, false otherwise */
+            bool openSegment(uint64_t minSize);
+
+            std::string m_directory;         /*!< The capture directory*/
+            uint64_t    m_segmentSize;       /*!< The default segment size*/
+            uint32_t    m_segmentID   = 0;   /*!< The next segment ID*/
+            int         m_fd          = -1;  /*!< The current segment file*/
+            uint8_t*    m_memory      = NULL;/*!< The current segment mapping*/
+            uint64_t    m_mappedSize  = 0;   /*!< The current segment size*/
+            uint64_t    m_offset      = 0;   /*!< The write offset in the current segment*/
+            bool        m_failed      = false; /*!< Did the capture fail (and is thus stopped)?*/
+    };
+
+    /* \brief Read the records of a capture written by TrafficCapture, without copying them */
+    class TrafficCaptureReader
+    {
+        public:
+            /* \brief Constructor
+             * \param directory the capture directory */
+            TrafficCaptureReader(const std::string& directory);
+
+            /* \brief Destructor */
+            ~TrafficCaptureReader();
+
+            /* \brief Get the next record
+             * \param record the record to fill
+             * \return true if a record was read, false at the end of the capture */
+            bool next(CaptureRecord& record);
+        private:
+            /* \brief Map the next segment file
+             * \return true on success, false if there is no more segment */
+            bool openSegment();
+
+            /* \brief Unmap the current segment */
+            void closeSegment();
+
+            std::string m_directory;        /*!< The capture directory*/
+            uint32_t    m_segmentID  = 0;   /*!< The next segment ID*/
+            uint8_t*    m_memory     = NULL;/*!< The current segment mapping*/
+            uint64_t    m_mappedSize = 0;   /*!< The current segment size*/
+            uint64_t    m_offset     = 0;   /*!< The read offset in the current segment*/
+    };
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef  TRAFFICREPLAY_INC
+#define  TRAFFICREPLAY_INC
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include "Types/ServerType.h"
+#include "TrafficCapture.h"
+
+namespace sereno
+{
+    /* \brief Statistics of a replay */
+    struct ReplayStats
+    {
+        uint64_t nbRecords = 0; /*!< The number of data records replayed*/
+        uint64_t nbBytes   = 0; /*!< The number of bytes replayed*/
+        uint64_t nbClients = 0; /*!< The number of clients opened*/
+        double   duration  = 0; /*!< The replay duration in seconds*/
+    };
+
+    /* \brief Replay a capture written by TrafficCapture (see Server::enableCapture) to turn production traffic into a repeatable benchmark.
+     * Each captured client gets its own connection. Data sent back by the Server are read and discarded */
+    class TrafficReplay
+    {
+        public:
+            /* \brief Constructor
+             * \param directory the capture directory
+             * \param speed the replay speed relative to the recorded one (1 == recorded speed). 0 == as fast as possible */
+            TrafficReplay(const std::string& directory, double speed = 0.0);
+
+            /* \brief Replay the capture over the network (e.g., loopback) by connecting to a Server
+             * \param addr the Server address
+             * \param addrLen the address length
+             * \return true on success, false otherwise */
+            bool toAddress(const SOCKADDR* addr, socklen_t addrLen);
+
+            /* \brief Replay the capture directly into the handler queues of an in-process Server, bypassing the network.
+             * Each captured client is adopted by the Server as one end of a socketpair
+             * \param server the Server (Server<T, Policies...>) to feed
+             * \return true on success, false otherwise */
+            template <typename S>
+            bool toServer(S& server)
+            {
+                return run([&server, this](int& peer, SOCKET& serverSock)
+                {
+                    int pair[2];
+                    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == SOCKET_ERROR)
+                        return false;
+                    peer       = pair[1];
+                    serverSock = pair[0];
+                    server.adoptClient(pair[0]);
+                    return true;
+                },
+                [&server](int peer, SOCKET serverSock, const uint8_t* data, uint32_t size)
+                {
+                    return server.injectData(serverSock, data, size);
+                });
+            }
+
+            /* \brief Get the statistics of the last replay
+             * \return the replay statistics */
+            const ReplayStats& getStats() const {return m_stats;}
+        private:
+            /* \brief The replay loop
+             * \param open function opening the connection of a new captured client, open(int& peer, SOCKET& serverSock) -> bool
+             * \param send function sending data of a client, send(int peer, SOCKET serverSock, data, size) -> bool
+             * \return true on success, false otherwise */
+            template <typename Open, typename Send>
+            bool run(Open open, Send send)
+            {
+                TrafficCaptureReader reader(m_directory);
+                std::map<uint32_t, std::pair<int, SOCKET>> clients; //clientID -> (peer, server socket)
+                CaptureRecord record;
+                bool          res = true;
+
+                m_stats = ReplayStats();
+                startDrain();
+                uint64_t start = now();
+                uint64_t first = 0;
+
+                while(reader.next(record))
+                {
+                    if(first == 0)
+                        first = record.timestamp;
+                    pace(start, record.timestamp - first);
+
+                    auto it = clients.find(record.clientID);
+                    if(record.type == CAPTURE_CLOSE)
+                    {
+                        if(it != clients.end())
+                        {
+                            removePeer(it->second.first);
+                            clients.erase(it);
+                        }
+                        continue;
+                    }
+
+                    if(it == clients.end())
+                    {
+                        int    peer       = -1;
+                        SOCKET serverSock = SOCKET_ERROR;
+                        if(!open(peer, serverSock))
+                        {
+                            res = false;
+                            break;
+                        }
+                        addPeer(peer);
+                        m_stats.nbClients++;
+                        it = clients.emplace(record.clientID, std::make_pair(peer, serverSock)).first;
+                    }
+
+                    if(!send(it->second.first, it->second.second, record.data, record.size))
+                        res = false;
+                    m_stats.nbRecords++;
+                    m_stats.nbBytes += record.size;
+                }
+
+                for(auto& it : clients)
+                    removePeer(it.second.first);
+                stopDrain();
+                m_stats.duration = (now() - start)*1e-9;
+                return res;
+            }
+
+            /* \brief Wait until the time of a record, depending on the replay speed
+             * \param start the replay start time
+             * \param offset the record time offset since the first record */
+            void pace(uint64_t start, uint64_t offset);
+
+            /* \brief Get the current time
+             * \return the CLOCK_MONOTONIC time in nanoseconds */
+            static uint64_t now();
+
+            /* \brief Start the thread discarding what the Server sends back */
+            void startDrain();
+
+            /* \brief Stop the draining thread */
+            void stopDrain();
+
+            /* \brief Add a connection to drain
+             * \param peer the connection */
+            void addPeer(int peer);
+
+            /* \brief Close a connection and stop draining it
+             * \param peer the connection */
+            void removePeer(int peer);
+
+            std::string       m_directory;            /*!< The capture directory*/
+            double            m_speed;                /*!< The replay speed*/
+            ReplayStats       m_stats;                /*!< The statistics of the last replay*/
+            std::vector<int>  m_peers;                /*!< The connections to drain*/
+            std::mutex        m_peerMutex;            /*!< The mutex protecting m_peers*/
+            std::thread       m_drainThread;          /*!< The draining thread*/
+            std::atomic<bool> m_closeDrain{true};     /*!< Should the draining thread stop? Written by stopDrain, read by the draining thread*/
+    };
+}
+
+#endif
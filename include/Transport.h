@@ -0,0 +1,151 @@
+#ifndef  TRANSPORT_INC
+#define  TRANSPORT_INC
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+#include "Types/ServerType.h"
+
+namespace sereno
+{
+    /* \brief The I/O operations of a client connection. The Server and ClientSocket go through it instead of calling the system directly,
+     * SocketTransport being the BSD socket implementation. The calls of one connection may come from several threads */
+    class Transport
+    {
+        public:
+            virtual ~Transport() {}
+
+            /* \brief Write data to a connection, without blocking
+             * \param sock the connection
+             * \param data the data to write
+             * \param size the data size
+             * \return the number of bytes written, -1 on error (errno set, EAGAIN if the connection is not writable) */
+            virtual ssize_t send(SOCKET sock, const uint8_t* data, uint32_t size) = 0;
+
+            /* \brief Read data from a connection
+             * \param sock the connection
+             * \param data the buffer to fill
+             * \param size the buffer size
+             * \return the number of bytes read, 0 at the end of the stream, -1 on error */
+            virtual ssize_t receive(SOCKET sock, uint8_t* data, uint32_t size) = 0;
+
+            /* \brief Get the number of bytes which can be read without blocking
+             * \param sock the connection
+             * \return the number of bytes, -1 on error */
+            virtual int32_t available(SOCKET sock) = 0;
+
+            /* \brief Shut a connection down : the peer sees the end of the stream
+             * \param sock the connection */
+            virtual void shutdown(SOCKET sock) = 0;
+
+            /* \brief Close a connection. sock is invalid afterwards
+             * \param sock the connection */
+            virtual void close(SOCKET sock) = 0;
+
+            /* \brief Is a connection of this transport a file descriptor of the kernel? Only those can be polled by the Server
+             * and written with sendfile or MSG_ZEROCOPY
+             * \return true if yes, false otherwise */
+            virtual bool isKernelSocket() const = 0;
+    };
+
+    /* \brief The BSD socket transport : the connections are socket descriptors */
+    class SocketTransport : public Transport
+    {
+        public:
+            /* \brief Get the instance shared by every socket
+             * \return the socket transport */
+            static SocketTransport* get();
+
+            ssize_t send(SOCKET sock, const uint8_t* data, uint32_t size);
+            ssize_t receive(SOCKET sock, uint8_t* data, uint32_t size);
+            int32_t available(SOCKET sock);
+            void    shutdown(SOCKET sock);
+            void    close(SOCKET sock);
+            bool    isKernelSocket() const {return true;}
+    };
+
+    /* \brief The first connection ID of a MemoryTransport : above the descriptors the process can open */
+    static const SOCKET MEMORY_SOCKET_BASE = (1 << 30);
+
+    /* \brief The counters of a MemoryTransport */
+    struct MemoryTransportStats
+    {
+        uint64_t nbOpened = 0; /*!< The connections opened*/
+        uint64_t nbClosed = 0; /*!< The connections closed by the Server*/
+        uint64_t nbWrites = 0; /*!< The writes of the Server*/
+        uint64_t nbBytes  = 0; /*!< The bytes written by the Server*/
+    };
+
+    /* \brief An in-process transport to measure the handlers and the queues of a Server without the network stack.
+     * Its connections are synthetic IDs adopted by the Server (see connect) : they are not polled, the data being injected directly
+     * in the handler queues (see inject). What the Server writes is counted, then given to the receiver if any.
+     * Sendfile and MSG_ZEROCOPY packets are written as normal packets */
+    class MemoryTransport : public Transport
+    {
+        public:
+            /* \brief Receive what the Server writes to a connection, receiver(sock, data, size). size == 0 : the Server shut the
+             * connection down. Called from the writing thread of the connection, or from the thread closing it */
+            typedef std::function<void(SOCKET sock, const uint8_t* data, uint32_t size)> Receiver;
+
+            /* \brief Constructor
+             * \param receiver the receiver of the written data. NULL == discard them */
+            MemoryTransport(Receiver receiver = NULL);
+
+            /* \brief Open a connection and make a Server adopt it
+             * \param server the Server (Server<T, Policies...>)
+             * \param listenerID the listener the connection comes from (see Server::addTCPListener)
+             * \return the ClientSocket created */
+            template <typename S>
+            auto connect(S& server, uint32_t listenerID = 0) -> decltype(server.adoptClient(0))
+            {
+                return server.adoptClient(open(), this, listenerID);
+            }
+
+            /* \brief Deliver data to the handler of a connection, as if it was read from the network
+             * \param server the Server owning the connection
+             * \param sock the connection
+             * \param data the data. Copied
+             * \param size the data size
+             * \return true on success, false if the connection is closed */
+            template <typename S>
+            bool inject(S& server, SOCKET sock, const uint8_t* data, uint32_t size)
+            {
+                return server.injectData(sock, data, size);
+            }
+
+            /* \brief Close a connection from the client side
+             * \param server the Server owning the connection
+             * \param sock the connection
+             * \return true on success, false if the connection is already closed */
+            template <typename S>
+            bool disconnect(S& server, SOCKET sock)
+            {
+                return server.disconnectClient(sock);
+            }
+
+            /* \brief Get a new connection ID. The IDs are never reused
+             * \return the connection */
+            SOCKET open();
+
+            /* \brief Get the counters of this transport
+             * \return the counters */
+            MemoryTransportStats getStats() const;
+
+            ssize_t send(SOCKET sock, const uint8_t* data, uint32_t size);
+            ssize_t receive(SOCKET sock, uint8_t* data, uint32_t size);
+            int32_t available(SOCKET sock);
+            void    shutdown(SOCKET sock);
+            void    close(SOCKET sock);
+            bool    isKernelSocket() const {return false;}
+        private:
+            Receiver              m_receiver;                  /*!< The receiver of the written data*/
+            std::atomic<SOCKET>   m_nextID{MEMORY_SOCKET_BASE}; /*!< The next connection ID*/
+            std::atomic<uint64_t> m_nbClosed{0};               /*!< The connections closed*/
+            std::atomic<uint64_t> m_nbWrites{0};               /*!< The writes*/
+            std::atomic<uint64_t> m_nbBytes{0};                /*!< The bytes written*/
+    };
+}
+
+#endif
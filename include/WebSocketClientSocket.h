@@ -0,0 +1,178 @@
+#ifndef  WEBSOCKETCLIENTSOCKET_INC
+#define  WEBSOCKETCLIENTSOCKET_INC
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "ClientSocket.h"
+
+namespace sereno
+{
+    /* \brief The WebSocket opcodes (RFC 6455) */
+    enum WebSocketOpcode
+    {
+        WS_CONTINUATION = 0x0,
+        WS_TEXT         = 0x1,
+        WS_BINARY       = 0x2,
+        WS_CLOSE        = 0x8,
+        WS_PING         = 0x9,
+        WS_PONG         = 0xA
+    };
+
+    /* \brief The WebSocket close status codes used by the Server */
+    enum WebSocketCloseCode
+    {
+        WS_CLOSE_NORMAL         = 1000,
+        WS_CLOSE_PROTOCOL_ERROR = 1002,
+        WS_CLOSE_TOO_BIG        = 1009
+    };
+
+    /* \brief Unmask a WebSocket payload in place, using the best kernel of the CPU (AVX2, SSE2 or scalar)
+     * \param data the payload
+     * \param size the payload size
+     * \param mask the masking key (4 bytes, in the frame order)
+     * \param phase the payload offset of data in its frame (the mask is applied modulo 4) */
+    void webSocketUnmask(uint8_t* data, uint32_t size, const uint8_t* mask, uint32_t phase = 0);
+
+    /* \brief Unmask a WebSocket payload in place, without SIMD. See webSocketUnmask */
+    void webSocketUnmaskScalar(uint8_t* data, uint32_t size, const uint8_t* mask, uint32_t phase = 0);
+
+    /* \brief Get the unmasking kernel used by webSocketUnmask
+     * \return "avx2", "sse2" or "scalar" */
+    const char* webSocketUnmaskKernel();
+
+    /* \brief A ClientSocket speaking WebSocket. It answers the HTTP upgrade handshake, parses the frames (fragmentation included)
+     * and answers the ping and close frames by itself : only the data messages reach the Server (see WebSocketFraming).
+     * Payloads are unmasked in place, and a message received in one frame of one read is delivered without copy.
+     * Text messages are not checked to be valid UTF-8 */
+    class WebSocketClientSocket : public ClientSocket
+    {
+        public:
+            /* \brief Send a data message. The payload is not copied : each frame header is written before it (see pushChunked)
+             * \param data the payload
+             * \param opcode WS_TEXT or WS_BINARY
+             * \param fragmentSize the maximum payload size of a frame. 0 == one frame. Fragments let urgent packets go between them
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return false if the connection is not open */
+            bool sendMessage(Buffer data, uint8_t opcode = WS_BINARY, uint32_t fragmentSize = 0, uint8_t priority = PRIORITY_NORMAL);
+
+            /* \brief Send a data message, see sendMessage(Buffer, uint8_t, uint32_t, uint8_t)
+             * \param data the payload
+             * \param size the payload size
+             * \param opcode WS_TEXT or WS_BINARY
+             * \param fragmentSize the maximum payload size of a frame. 0 == one frame. Fragments let urgent packets go between them
+             * \param priority the outbound lane (PacketPriority) of the message
+             * \return false if the connection is not open */
+            bool sendMessage(std::shared_ptr<uint8_t> data, uint32_t size, uint8_t opcode = WS_BINARY, uint32_t fragmentSize = 0,
+                             uint8_t priority = PRIORITY_NORMAL);
+
+            /* \brief Send a ping frame
+             * \param data the ping payload (<= 125 bytes)
+             * \param size the payload size
+             * \return false if the connection is not open */
+            bool sendPing(const uint8_t* data = NULL, uint32_t size = 0);
+
+            /* \brief Start the closing handshake. The connection is shut down when the peer answers
+             * \param code the close status code
+             * \param reason the close reason (<= 123 bytes)
+             * \return false if the connection is not open */
+            bool sendClose(uint16_t code = WS_CLOSE_NORMAL, const std::string& reason = "");
+
+            /* \brief Parse the next data message of the received data (see WebSocketFraming). Handle messages thread only
+             * \param data the received data, advanced past the consumed bytes. Unmasked in place
+             * \param size the received data size, decreased by the consumed bytes
+             * \param msg the message payload if a message is complete. Valid until the next call
+             * \param msgSize the message size
+             * \return true if a message is complete, false if every byte was consumed */
+            bool nextMessage(uint8_t*& data, uint32_t& size, uint8_t*& msg, uint32_t& msgSize);
+
+            /* \brief Is the handshake done and the connection not closing?
+             * \return true if data messages can be sent */
+            bool isWebSocketOpen() const {return m_state == WS_STATE_OPEN;}
+
+            /* \brief Get the opcode of the last message returned by nextMessage
+             * \return WS_TEXT or WS_BINARY */
+            uint8_t getMessageOpcode() const {return m_messageOpcode;}
+
+            /* \brief Get the path requested in the handshake
+             * \return the request path, e.g., "/chat" */
+            const std::string& getRequestPath() const {return m_path;}
+
+            uint32_t maxMessageSize = (1u << 26); /*!< The maximum size of a received message. Larger messages close the connection (1009)*/
+        private:
+            /* \brief The connection states */
+            enum State
+            {
+                WS_STATE_HANDSHAKE, /*!< Waiting for the HTTP upgrade request*/
+                WS_STATE_OPEN,      /*!< Exchanging messages*/
+                WS_STATE_CLOSING,   /*!< Our close frame is sent, waiting for the peer one*/
+                WS_STATE_CLOSED     /*!< Closed, the received data are ignored*/
+            };
+
+            /* \brief Consume the HTTP upgrade request and answer it
+             * \param data the received data, advanced past the consumed bytes
+             * \param size the received data size, decreased by the consumed bytes */
+            void parseHandshake(uint8_t*& data, uint32_t& size);
+
+            /* \brief Consume a frame header and check it
+             * \param data the received data, advanced past the consumed bytes
+             * \param size the received data size, decreased by the consumed bytes
+             * \return true if the header is complete */
+            bool parseHeader(uint8_t*& data, uint32_t& size);
+
+            /* \brief Handle a complete control frame (m_control) */
+            void handleControl();
+
+            /* \brief Push a frame whose payload is copied. For the control frames and the empty messages
+             * \param opcode the frame opcode
+             * \param data the payload
+             * \param size the payload size
+             * \param priority the outbound lane (PacketPriority) of the frame */
+            void pushFrame(uint8_t opcode, const uint8_t* data, uint32_t size, uint8_t priority = PRIORITY_CONTROL);
+
+            /* \brief Push an HTTP response
+             * \param response the response */
+            void pushResponse(const std::string& response);
+
+            /* \brief Fail the connection : send a close frame and shut the socket down
+             * \param code the close status code */
+            void fail(uint16_t code);
+
+            std::atomic<State>   m_state{WS_STATE_HANDSHAKE}; /*!< The connection state*/
+            std::string          m_request;           /*!< The partial HTTP upgrade request*/
+            std::string          m_path;              /*!< The request path*/
+
+            uint8_t              m_header[14];        /*!< The partial frame header*/
+            uint32_t             m_headerSize = 0;    /*!< The bytes in m_header*/
+            bool                 m_inPayload = false; /*!< Is a frame payload being received?*/
+            uint8_t              m_opcode = 0;        /*!< The opcode of the current frame*/
+            bool                 m_fin = false;       /*!< Is the current frame the last of its message?*/
+            uint8_t              m_mask[4];           /*!< The masking key of the current frame*/
+            uint64_t             m_remaining = 0;     /*!< The payload bytes of the current frame still to receive*/
+            uint32_t             m_phase = 0;         /*!< The payload bytes of the current frame already received*/
+
+            uint8_t              m_messageOpcode = WS_BINARY; /*!< The opcode of the message being received, or last returned*/
+            bool                 m_fragmented = false; /*!< Is a fragmented message being received?*/
+            bool                 m_delivered = false;  /*!< Was m_message returned by the last nextMessage call?*/
+            std::vector<uint8_t> m_message;           /*!< The partial data message (fragmented, or split between reads)*/
+            std::vector<uint8_t> m_control;           /*!< The partial control frame payload*/
+    };
+
+    /* \brief The framing of WebSocketClientSocket clients : FramingIs<WebSocketFraming>.
+     * Only the data messages are delivered, WebSocketClientSocket::getMessageOpcode giving their type */
+    struct WebSocketFraming
+    {
+        /* \brief Feed the data received for a client. See RawFraming::feed */
+        template <typename C, typename F>
+        static void feed(C* client, uint8_t* data, uint32_t size, F&& deliver)
+        {
+            uint8_t* msg;
+            uint32_t msgSize;
+            while(client->nextMessage(data, size, msg, msgSize))
+                deliver(msg, msgSize);
+        }
+    };
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <fstream>
 #include <string>
 #include <cstring>
+#include <type_traits>
+#include "Logger.h"
 
 //Color
 #ifndef RED
@@ -47,22 +49,35 @@
 #define CAT(x, y)  CAT_(x, y)
 #endif
 
-//Filename
+//Filename (computed at compile time)
 #ifndef __FILENAME__
-#define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+#define __FILENAME__ (__FILE__ + std::integral_constant<size_t, sereno::logBasenameOffset(__FILE__)>::value)
 #endif
 
-//Log system
+//Log system (asynchronous, see Logger.h). Lines below SERENO_LOG_LEVEL are removed at compile time
 #ifndef ERROR
-#define ERROR   (std::cerr << BOLD RED "Error : "   RESET GRN  << __FILENAME__ << ":" STR(__LINE__) RESET " ")
+#define ERROR   SERENO_LOG(SERENO_LOG_LEVEL_ERROR)
 #endif
 
 #ifndef INFO
-#define INFO    (std::cout << BOLD WHT "Info : "    RESET GRN  << __FILENAME__ << ":" STR(__LINE__) RESET " ")
+#define INFO    SERENO_LOG(SERENO_LOG_LEVEL_INFO)
 #endif
 
 #ifndef WARNING
-#define WARNING (std::cout << BOLD YEL "Warning : " RESET GRN  << __FILENAME__ << ":" STR(__LINE__) RESET " ")
+#define WARNING SERENO_LOG(SERENO_LOG_LEVEL_WARNING)
+#endif
+
+//Rate limited logs for hot paths : at most one line per periodMS milliseconds and per call site, e.g., WARNING_RATE_LIMITED(1000) << "...";
+#ifndef ERROR_RATE_LIMITED
+#define ERROR_RATE_LIMITED(periodMS)   SERENO_LOG_RATE_LIMITED(SERENO_LOG_LEVEL_ERROR, periodMS)
+#endif
+
+#ifndef INFO_RATE_LIMITED
+#define INFO_RATE_LIMITED(periodMS)    SERENO_LOG_RATE_LIMITED(SERENO_LOG_LEVEL_INFO, periodMS)
+#endif
+
+#ifndef WARNING_RATE_LIMITED
+#define WARNING_RATE_LIMITED(periodMS) SERENO_LOG_RATE_LIMITED(SERENO_LOG_LEVEL_WARNING, periodMS)
 #endif
 
 #endif
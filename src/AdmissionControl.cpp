@@ -0,0 +1,175 @@
+#include "AdmissionControl.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <ctime>
+#include <netinet/in.h>
+
+namespace sereno
+{
+    /*----------------------------------------------------------------------------*/
+    /*---------------------------------TokenBucket--------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    void TokenBucket::configure(double rate, double burst, uint64_t now)
+    {
+        m_rate   = rate;
+        m_burst  = std::max(burst, 1.0);
+        m_tokens = m_burst;
+        m_last   = now;
+    }
+
+    double TokenBucket::getTokens(uint64_t now)
+    {
+        if(m_rate <= 0.0)
+            return (double)UINT32_MAX;
+
+        if(now > m_last)
+        {
+            m_tokens = std::min(m_burst, m_tokens + m_rate*(now-m_last)/1e9);
+            m_last   = now;
+        }
+        return m_tokens;
+    }
+
+    void TokenBucket::consume(double tokens)
+    {
+        if(m_rate > 0.0)
+            m_tokens -= tokens;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------AdmissionControl-----------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    void AdmissionControl::Buckets::configure(const RateLimit& limit, uint64_t now)
+    {
+        reads.configure(limit.readsPerSecond, limit.readsPerSecond*limit.burstSeconds, now);
+        bytes.configure(limit.bytesPerSecond, limit.bytesPerSecond*limit.burstSeconds, now);
+    }
+
+    uint32_t AdmissionControl::Buckets::getAllowance(uint64_t now)
+    {
+        if(reads.getTokens(now) < 1.0)
+            return 0;
+        return (uint32_t)std::min(bytes.getTokens(now), (double)UINT32_MAX);
+    }
+
+    void AdmissionControl::Buckets::consume(uint32_t size)
+    {
+        reads.consume(1.0);
+        bytes.consume(size);
+    }
+
+    bool AdmissionControl::admit(SOCKET sock, const struct sockaddr_storage& addr, bool enforceCaps)
+    {
+        std::string ip = getIPKey(addr);
+        uint64_t    t  = now();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(enforceCaps && m_maxConnections > 0 && m_clients.size() >= m_maxConnections)
+            return false;
+
+        if(ip.size() > 0)
+        {
+            auto it = m_ips.find(ip);
+            if(enforceCaps && m_maxConnectionsPerIP > 0 && it != m_ips.end() && it->second.nbConnections >= m_maxConnectionsPerIP)
+                return false;
+            if(it == m_ips.end())
+            {
+                it = m_ips.emplace(ip, IPState()).first;
+                it->second.buckets.configure(m_ipLimit, t);
+            }
+            it->second.nbConnections++;
+        }
+
+        ClientState& client = m_clients[sock];
+        client.ip = ip;
+        client.buckets.configure(m_clientLimit, t);
+        return true;
+    }
+
+    void AdmissionControl::release(SOCKET sock)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_clients.find(sock);
+        if(it == m_clients.end())
+            return;
+
+        if(it->second.ip.size() > 0)
+        {
+            auto ipIt = m_ips.find(it->second.ip);
+            if(ipIt != m_ips.end() && --ipIt->second.nbConnections == 0)
+                m_ips.erase(ipIt);
+        }
+        m_clients.erase(it);
+    }
+
+    void AdmissionControl::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients.clear();
+        m_ips.clear();
+    }
+
+    uint32_t AdmissionControl::getAllowance(SOCKET sock, uint64_t now)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_clients.find(sock);
+        if(it == m_clients.end())
+            return UINT32_MAX;
+
+        uint32_t allowance = it->second.buckets.getAllowance(now);
+        if(allowance > 0 && it->second.ip.size() > 0)
+        {
+            auto ipIt = m_ips.find(it->second.ip);
+            if(ipIt != m_ips.end())
+                allowance = std::min(allowance, ipIt->second.buckets.getAllowance(now));
+        }
+        return allowance;
+    }
+
+    void AdmissionControl::consume(SOCKET sock, uint32_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_clients.find(sock);
+        if(it == m_clients.end())
+            return;
+
+        it->second.buckets.consume(size);
+        if(it->second.ip.size() > 0)
+        {
+            auto ipIt = m_ips.find(it->second.ip);
+            if(ipIt != m_ips.end())
+                ipIt->second.buckets.consume(size);
+        }
+    }
+
+    uint32_t AdmissionControl::getNbConnections()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_clients.size();
+    }
+
+    uint64_t AdmissionControl::now()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+    }
+
+    std::string AdmissionControl::getIPKey(const struct sockaddr_storage& addr)
+    {
+        if(addr.ss_family == AF_INET)
+        {
+            const struct sockaddr_in* in = (const struct sockaddr_in*)&addr;
+            return std::string((const char*)&in->sin_addr, sizeof(in->sin_addr));
+        }
+        else if(addr.ss_family == AF_INET6)
+        {
+            const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)&addr;
+            return std::string((const char*)&in6->sin6_addr, sizeof(in6->sin6_addr));
+        }
+        return std::string();
+    }
+}
@@ -0,0 +1,98 @@
+#include "ByteScan.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERENO_SCAN_X86
+#endif
+
+namespace sereno
+{
+    /* \brief A byte scanning kernel. See scanByte */
+    typedef const uint8_t* (*ScanKernel)(const uint8_t* data, uint32_t size, uint8_t value);
+
+    const uint8_t* scanByteScalar(const uint8_t* data, uint32_t size, uint8_t value)
+    {
+        for(uint32_t i = 0; i < size; i++)
+            if(data[i] == value)
+                return data+i;
+        return NULL;
+    }
+
+#ifdef SERENO_SCAN_X86
+    __attribute__((target("sse2")))
+    static const uint8_t* scanSSE2(const uint8_t* data, uint32_t size, uint8_t value)
+    {
+        __m128i  pattern = _mm_set1_epi8((char)value);
+        uint32_t i       = 0;
+        for(; i+16 <= size; i+=16)
+        {
+            __m128i  v    = _mm_loadu_si128((const __m128i*)(data+i));
+            uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, pattern));
+            if(mask)
+                return data + i + __builtin_ctz(mask);
+        }
+        return scanByteScalar(data+i, size-i, value);
+    }
+
+    __attribute__((target("avx2")))
+    static const uint8_t* scanAVX2(const uint8_t* data, uint32_t size, uint8_t value)
+    {
+        __m256i  pattern = _mm256_set1_epi8((char)value);
+        uint32_t i       = 0;
+        for(; i+32 <= size; i+=32)
+        {
+            __m256i  v    = _mm256_loadu_si256((const __m256i*)(data+i));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern));
+            if(mask)
+                return data + i + __builtin_ctz(mask);
+        }
+        return scanSSE2(data+i, size-i, value);
+    }
+#endif
+
+    /* \brief Get the best scanning kernel of the CPU, chosen once
+     * \param name the kernel name, if not NULL */
+    static ScanKernel getScanKernel(const char** name = NULL)
+    {
+        struct Selection
+        {
+            ScanKernel  kernel = &scanByteScalar;
+            const char* name   = "scalar";
+            Selection()
+            {
+#ifdef SERENO_SCAN_X86
+                __builtin_cpu_init();
+                if(__builtin_cpu_supports("avx2"))
+                {
+                    kernel = &scanAVX2;
+                    name   = "avx2";
+                }
+                else if(__builtin_cpu_supports("sse2"))
+                {
+                    kernel = &scanSSE2;
+                    name   = "sse2";
+                }
+#endif
+            }
+        };
+        static Selection selection;
+        if(name)
+            *name = selection.name;
+        return selection.kernel;
+    }
+
+    const uint8_t* scanByte(const uint8_t* data, uint32_t size, uint8_t value)
+    {
+        static ScanKernel kernel = getScanKernel();
+        return kernel(data, size, value);
+    }
+
+    const char* scanByteKernel()
+    {
+        const char* name;
+        getScanKernel(&name);
+        return name;
+    }
+}
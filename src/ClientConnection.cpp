@@ -0,0 +1,455 @@
+#include "ClientConnection.h"
+#include "utils.h"
+
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace sereno
+{
+    /* \brief The maximum size of a received message */
+    static const uint32_t MAX_FRAME_SIZE = 1u << 26;
+
+    /* \brief The pool of the sent messages and of the receive buffers, shared with the Servers using PoolAllocator<>.
+     * Larger messages are allocated with malloc */
+    typedef PoolAllocator<> FramePool;
+
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------ClientConnection-----------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    ClientConnection::ClientConnection(ConnectionPool* pool, SOCKET sock) : m_pool(pool), m_sock(sock), m_state(CONNECTION_CONNECTING)
+    {}
+
+    ClientConnection::~ClientConnection()
+    {
+        if(m_sock != SOCKET_ERROR)
+            ::close(m_sock);
+    }
+
+    Buffer ClientConnection::buildFrame(uint32_t correlationID, const uint8_t* data, uint32_t size, uint32_t* frameSize)
+    {
+        uint32_t     msgSize = sizeof(uint32_t) + size;
+        uint32_t     total   = sizeof(uint32_t) + msgSize;
+        UniqueBuffer frame   = (total <= UniqueBuffer::maxSize<FramePool>() ? UniqueBuffer::allocateFrom<FramePool>(total)
+                                                                            : UniqueBuffer::allocate(total));
+        if(frameSize)
+            *frameSize = frame.size();
+
+        memcpy(frame.data(), &msgSize, sizeof(uint32_t));
+        memcpy(frame.data()+sizeof(uint32_t), &correlationID, sizeof(uint32_t));
+        if(size > 0)
+            memcpy(frame.data()+2*sizeof(uint32_t), data, size);
+        return frame.share();
+    }
+
+    uint32_t ClientConnection::request(const uint8_t* data, uint32_t size, ResponseCallback callback)
+    {
+        if(m_state == CONNECTION_CLOSED)
+            return 0;
+
+        m_pendingMutex.lock();
+            uint32_t id = m_nextID++;
+            if(m_nextID == 0)
+                m_nextID = 1;
+            m_pending[id] = callback;
+        m_pendingMutex.unlock();
+
+        if(!push(buildFrame(id, data, size)))
+        {
+            m_pendingMutex.lock();
+                m_pending.erase(id);
+            m_pendingMutex.unlock();
+            return 0;
+        }
+        return id;
+    }
+
+    bool ClientConnection::send(uint32_t correlationID, const uint8_t* data, uint32_t size)
+    {
+        return push(buildFrame(correlationID, data, size));
+    }
+
+    void ClientConnection::setMessageCallback(MessageCallback callback)
+    {
+        m_pendingMutex.lock();
+            m_messageCallback = callback;
+        m_pendingMutex.unlock();
+    }
+
+    void ClientConnection::close()
+    {
+        //The event loop sees the hang up and removes the connection
+        ::shutdown(m_sock, SHUT_RDWR);
+    }
+
+    uint32_t ClientConnection::getNbPending()
+    {
+        std::lock_guard<std::mutex> lock(m_pendingMutex);
+        return m_pending.size();
+    }
+
+    bool ClientConnection::push(Buffer frame)
+    {
+        if(m_state == CONNECTION_CLOSED)
+            return false;
+
+        SocketData packet;
+        packet.dataSize = frame.size();
+        packet.data     = std::move(frame);
+
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_writeBuffer.push(std::move(packet));
+        if(m_state == CONNECTION_CONNECTED && !flush())
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool ClientConnection::flush()
+    {
+        while(!m_writeBuffer.empty())
+        {
+            SocketData& front = m_writeBuffer.front();
+            ssize_t written   = ::send(m_sock, front.data.data()+m_writeOffset, front.dataSize-m_writeOffset, MSG_NOSIGNAL);
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+
+                //Wait for the socket to be writable
+                if(!m_wantWrite)
+                {
+                    m_wantWrite = true;
+                    m_pool->watch(this, true);
+                }
+                return true;
+            }
+
+            m_writeOffset += written;
+            if(m_writeOffset == (uint32_t)front.dataSize)
+            {
+                m_writeBuffer.pop();
+                m_writeOffset = 0;
+            }
+        }
+
+        if(m_wantWrite)
+        {
+            m_wantWrite = false;
+            m_pool->watch(this, false);
+        }
+        return true;
+    }
+
+    bool ClientConnection::onConnected()
+    {
+        int       err    = 0;
+        socklen_t errLen = sizeof(err);
+        if(getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &err, &errLen) == SOCKET_ERROR || err != 0)
+            return false;
+
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_state     = CONNECTION_CONNECTED;
+        m_wantWrite = true; //EPOLLOUT was armed for the connect
+        return flush();
+    }
+
+    bool ClientConnection::onReadable()
+    {
+        while(true)
+        {
+            if(!reserveRead())
+                return false;
+
+            ssize_t count = read(m_sock, m_readBuffer.data()+m_readEnd, m_readBuffer.capacity()-m_readEnd);
+            if(count == 0)
+                return false;
+            if(count < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                return false;
+            }
+
+            m_readEnd += count;
+            if(!dispatch())
+                return false;
+        }
+
+        //An idle connection does not pin a block
+        if(m_readStart == m_readEnd)
+        {
+            m_readBuffer.reset();
+            m_readStart = m_readEnd = 0;
+        }
+        return true;
+    }
+
+    bool ClientConnection::reserveRead()
+    {
+        if(!m_readBuffer)
+        {
+            m_readBuffer = UniqueBuffer::allocateFrom<FramePool>(UniqueBuffer::maxSize<FramePool>());
+            m_readStart  = m_readEnd = 0;
+            return (bool)m_readBuffer;
+        }
+
+        if(m_readStart == m_readEnd)
+            m_readStart = m_readEnd = 0;
+        if(m_readEnd < m_readBuffer.capacity())
+            return true;
+
+        //The buffer is full : the pending message does not fit after m_readStart
+        uint32_t pending = m_readEnd - m_readStart;
+        uint32_t needed  = 2*sizeof(uint32_t);
+        if(pending >= sizeof(uint32_t))
+        {
+            uint32_t msgSize;
+            memcpy(&msgSize, m_readBuffer.data()+m_readStart, sizeof(uint32_t));
+            if(msgSize < sizeof(uint32_t) || msgSize > MAX_FRAME_SIZE)
+                return false;
+            needed = sizeof(uint32_t) + msgSize;
+        }
+
+        if(needed <= m_readBuffer.capacity())
+            memmove(m_readBuffer.data(), m_readBuffer.data()+m_readStart, pending);
+        else
+        {
+            UniqueBuffer large = UniqueBuffer::allocate(needed);
+            if(!large)
+                return false;
+            memcpy(large.data(), m_readBuffer.data()+m_readStart, pending);
+            m_readBuffer = std::move(large);
+        }
+        m_readStart = 0;
+        m_readEnd   = pending;
+        return true;
+    }
+
+    bool ClientConnection::dispatch()
+    {
+        while(m_readEnd - m_readStart >= 2*sizeof(uint32_t))
+        {
+            const uint8_t* msg = m_readBuffer.data()+m_readStart;
+            uint32_t msgSize;
+            uint32_t id;
+            memcpy(&msgSize, msg, sizeof(uint32_t));
+            if(msgSize < sizeof(uint32_t) || msgSize > MAX_FRAME_SIZE)
+                return false;
+            if(m_readEnd - m_readStart - sizeof(uint32_t) < msgSize)
+                break;
+            memcpy(&id, msg+sizeof(uint32_t), sizeof(uint32_t));
+
+            const uint8_t* payload     = msg+2*sizeof(uint32_t);
+            uint32_t       payloadSize = msgSize - sizeof(uint32_t);
+
+            ResponseCallback callback;
+            MessageCallback  messageCallback;
+            m_pendingMutex.lock();
+                auto it = m_pending.find(id);
+                if(it != m_pending.end())
+                {
+                    callback = std::move(it->second);
+                    m_pending.erase(it);
+                }
+                else
+                    messageCallback = m_messageCallback;
+            m_pendingMutex.unlock();
+
+            if(callback)
+                callback(true, payload, payloadSize);
+            else if(messageCallback)
+                messageCallback(id, payload, payloadSize);
+
+            m_readStart += sizeof(uint32_t) + msgSize;
+        }
+        return true;
+    }
+
+    void ClientConnection::shutdown()
+    {
+        m_state = CONNECTION_CLOSED;
+        ::shutdown(m_sock, SHUT_RDWR);
+
+        std::unordered_map<uint32_t, ResponseCallback> pending;
+        m_pendingMutex.lock();
+            pending.swap(m_pending);
+        m_pendingMutex.unlock();
+
+        for(auto& it : pending)
+            it.second(false, NULL, 0);
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*--------------------------------ConnectionPool------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    ConnectionPool::ConnectionPool() : m_closeThread(true)
+    {}
+
+    ConnectionPool::~ConnectionPool()
+    {
+        close();
+    }
+
+    bool ConnectionPool::launch()
+    {
+        if(!m_closeThread)
+            return true;
+
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if(m_epoll == -1)
+        {
+            ERROR << "Could not create the connection pool event loop\n";
+            return false;
+        }
+
+        m_closeThread = false;
+        m_thread      = std::thread(&ConnectionPool::loop, this);
+        return true;
+    }
+
+    void ConnectionPool::close()
+    {
+        m_closeThread = true;
+        if(m_thread.joinable())
+            m_thread.join();
+
+        std::map<SOCKET, std::shared_ptr<ClientConnection>> connections;
+        m_mutex.lock();
+            connections.swap(m_connections);
+        m_mutex.unlock();
+        for(auto& it : connections)
+            it.second->shutdown();
+
+        if(m_epoll != -1)
+            ::close(m_epoll);
+        m_epoll = -1;
+    }
+
+    std::shared_ptr<ClientConnection> ConnectionPool::connect(const SOCKADDR* addr, socklen_t addrLen)
+    {
+        if(m_closeThread)
+        {
+            ERROR << "The connection pool is not launched\n";
+            return NULL;
+        }
+
+        SOCKET sock = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(sock == SOCKET_ERROR)
+        {
+            ERROR << "Could not create a client socket\n";
+            return NULL;
+        }
+
+        if(addr->sa_family == AF_INET)
+        {
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        if(::connect(sock, addr, addrLen) == SOCKET_ERROR && errno != EINPROGRESS)
+        {
+            ::close(sock);
+            return NULL;
+        }
+
+        //Wait for the socket to be writable to know the connect result
+        std::shared_ptr<ClientConnection> conn(new ClientConnection(this, sock));
+        m_mutex.lock();
+            m_connections[sock] = conn;
+        m_mutex.unlock();
+
+        struct epoll_event ev;
+        ev.events  = EPOLLIN | EPOLLOUT;
+        ev.data.fd = sock;
+        if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, sock, &ev) == -1)
+        {
+            remove(sock);
+            return NULL;
+        }
+        return conn;
+    }
+
+    uint32_t ConnectionPool::getNbConnections()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_connections.size();
+    }
+
+    void ConnectionPool::loop()
+    {
+        struct epoll_event events[256];
+        while(!m_closeThread)
+        {
+            int nbEvents = epoll_wait(m_epoll, events, 256, 10);
+            for(int i = 0; i < nbEvents; i++)
+            {
+                SOCKET sock = events[i].data.fd;
+                std::shared_ptr<ClientConnection> conn;
+                m_mutex.lock();
+                    auto it = m_connections.find(sock);
+                    if(it != m_connections.end())
+                        conn = it->second;
+                m_mutex.unlock();
+                if(!conn)
+                    continue;
+
+                uint32_t flags = events[i].events;
+                bool     alive = true;
+
+                if(conn->getState() == CONNECTION_CONNECTING)
+                    alive = conn->onConnected();
+                else if(flags & EPOLLOUT)
+                {
+                    std::lock_guard<std::mutex> lock(conn->m_writeMutex);
+                    alive = conn->flush();
+                }
+
+                if(alive && (flags & EPOLLIN))
+                    alive = conn->onReadable();
+                else if(alive && (flags & (EPOLLHUP | EPOLLERR)))
+                    alive = false;
+
+                if(!alive)
+                    remove(sock);
+            }
+        }
+    }
+
+    void ConnectionPool::watch(ClientConnection* conn, bool wantWrite)
+    {
+        struct epoll_event ev;
+        ev.events  = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+        ev.data.fd = conn->m_sock;
+        epoll_ctl(m_epoll, EPOLL_CTL_MOD, conn->m_sock, &ev);
+    }
+
+    void ConnectionPool::remove(SOCKET sock)
+    {
+        std::shared_ptr<ClientConnection> conn;
+        m_mutex.lock();
+            auto it = m_connections.find(sock);
+            if(it != m_connections.end())
+            {
+                conn = it->second;
+                m_connections.erase(it);
+            }
+        m_mutex.unlock();
+
+        if(conn)
+        {
+            epoll_ctl(m_epoll, EPOLL_CTL_DEL, sock, NULL);
+            conn->shutdown();
+        }
+    }
+}
@@ -1,36 +1,80 @@
 #include "ClientSocket.h"
 #include "utils.h"
 
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
 namespace sereno
 {
     ClientSocket::ClientSocket() : bufferID(0), socket(SOCKET_ERROR)
+    {}
+
+    void ClientSocket::startWriteThread()
     {
+        //A client which never writes (e.g., a synthetic one, see MemoryTransport) never costs a thread
+        if(m_writeThread.joinable() || m_close)
+            return;
+
         m_writeThread = std::thread([this]{
+                if(threadConfig)
+                    threadConfig->apply(THREAD_CLIENT, socket, pthread_self());
+
+                //A packet partly written breaks the stream : the next ones are dropped, not written after it
+                bool failed = false;
                 while(!m_close)
                 {
-                    bool empty = false;
                     m_writeLock.lock();
-                    empty = m_writeBuffer.empty();
-                    if(!empty)
+                    int lane = m_writeScheduler.next([this](int l) {return m_writeBuffer[l].empty();});
+                    if(lane >= 0)
                     {
-                        std::shared_ptr<uint8_t> data = m_writeBuffer.front().data;
-                        int dataSize = m_writeBuffer.front().dataSize;
-                        m_writeBuffer.pop();
-                        m_bytesInWriting-=dataSize; //We can sure move it, but well...
+                        SocketData packet = std::move(m_writeBuffer[lane].front());
+                        m_writeBuffer[lane].pop();
+                        m_writeScheduler.consume(lane, packet.headerSize + packet.dataSize);
+                        m_bytesInWriting-=packet.headerSize + packet.dataSize; //We can sure move it, but well...
+                        std::shared_ptr<SharedMemoryChannel> channel = m_shmChannel;
                         m_writeLock.unlock();
-                        write(socket, data.get(), dataSize);
+                        if(!failed && !writePacket(packet, channel.get()))
+                        {
+                            failed = true;
+                            if(!m_close)
+                                WARNING_RATE_LIMITED(1000) << "Could not write to the socket " << socket << " : its next packets are dropped\n";
+                        }
                     }
                         
                     else
                     {
+                        bool shutdownNow     = m_shutdownAfterWrite;
+                        m_shutdownAfterWrite = false;
                         m_writeLock.unlock();
+                        if(shutdownNow)
+                            transport->shutdown(socket);
+                        if(m_zeroCopyPending.size() > 0)
+                            reapZeroCopy();
+
+                        //Sleep until the next push. Only poll for the zero copy completions
                         std::unique_lock<std::mutex> condLock(m_condMutex);
-                        m_cond.wait_for(condLock, std::chrono::microseconds(5));
+                        m_cond.wait_for(condLock, m_zeroCopyPending.size() > 0 ? std::chrono::milliseconds(1) : std::chrono::milliseconds(100),
+                                        [this] {return m_wakeUp || m_close;});
+                        m_wakeUp = false;
                     }
                 }
         });
     }
 
+    void ClientSocket::wakeWriteThread()
+    {
+        startWriteThread();
+        m_wakeUp = true;
+        //The writing thread checks m_wakeUp under m_condMutex : the notification cannot be lost
+        m_condMutex.lock();
+        m_condMutex.unlock();
+        m_cond.notify_one();
+    }
+
 
     ClientSocket::~ClientSocket()
     {
@@ -42,29 +86,396 @@ namespace sereno
         return true;
     }
 
+    void ClientSocket::shutdownAfterWrite()
+    {
+        m_writeLock.lock();
+            m_shutdownAfterWrite = true;
+            wakeWriteThread();
+        m_writeLock.unlock();
+    }
+
     void ClientSocket::close()
     {
-        if(m_close)
+        //Only the first caller closes : the descriptor may be reused once closed, and the writing thread is joined once
+        if(m_close.exchange(true))
             return;
-        INFO << "Closing this client." << std::endl;
-        //Close the writing thread
-        m_close = true;
+        INFO_RATE_LIMITED(1000) << "Closing this client." << std::endl;
 
-        //Close the socket
-        ::close(socket);
+        //Shut the socket down : a blocked or upcoming write fails instead of sending. The descriptor stays ours until the
+        //writing thread is joined, so that it cannot write to a newly accepted client reusing its number
+        transport->shutdown(socket);
+        //Once m_writeLock is released, no writing thread can be started anymore
+        m_writeLock.lock();
+            if(m_shmChannel)
+                m_shmChannel->close();
+        m_writeLock.unlock();
 
+        m_condMutex.lock();
+        m_condMutex.unlock();
         m_cond.notify_one();
         if(m_writeThread.joinable())
             m_writeThread.join();
-        INFO << "Finished to close this client." << std::endl;
+        transport->close(socket);
+        INFO_RATE_LIMITED(1000) << "Finished to close this client." << std::endl;
+    }
+
+    bool ClientSocket::writePacket(const SocketData& packet, SharedMemoryChannel* channel)
+    {
+        if(channel)
+        {
+            if(packet.headerSize > 0 && !channel->write(packet.header.data(), packet.headerSize))
+                return false;
+            if(packet.file)
+                return writeFile(*packet.file, packet.fileOffset, packet.dataSize, channel);
+            return channel->write(packet.data.data(), packet.dataSize);
+        }
+
+        if(packet.headerSize > 0 && !writeSocket(packet.header.data(), packet.headerSize))
+            return false;
+        if(packet.file)
+            return writeFile(*packet.file, packet.fileOffset, packet.dataSize, NULL);
+        if(packet.zeroCopy)
+            return writeZeroCopy(packet.data, packet.dataSize);
+        return writeSocket(packet.data.data(), packet.dataSize);
+    }
+
+    bool ClientSocket::writeFile(int fd, off_t offset, uint32_t size, SharedMemoryChannel* channel)
+    {
+        //No sendfile to a shared memory ring or a memory transport : copy through a bounce buffer
+        if(channel || !transport->isKernelSocket())
+        {
+            uint8_t buf[16384];
+            while(size > 0 && !m_close)
+            {
+                ssize_t count = pread(fd, buf, std::min<uint32_t>(size, sizeof(buf)), offset);
+                if(count <= 0)
+                    break;
+                if(channel ? !channel->write(buf, count) : !writeSocket(buf, count))
+                    return false;
+                offset += count;
+                size   -= count;
+            }
+        }
+        else
+        {
+            while(size > 0 && !m_close)
+            {
+                ssize_t written = sendfile(socket, fd, &offset, size);
+                if(written < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        return false;
+
+                    struct pollfd pfd = {.fd = socket, .events = POLLOUT};
+                    poll(&pfd, 1, 10);
+                    continue;
+                }
+                //End of file before the end of the segment
+                if(written == 0)
+                    break;
+                size -= written;
+            }
+        }
+
+        if(size > 0 && !m_close)
+        {
+            WARNING_RATE_LIMITED(1000) << "Could not send a whole file segment (" << size << " bytes missing)\n";
+            return false;
+        }
+        return size == 0;
     }
 
-    void ClientSocket::pushPacket(std::shared_ptr<uint8_t>& data, uint32_t size)
+    bool ClientSocket::writeZeroCopy(const Buffer& data, uint32_t size)
     {
+        const uint8_t* ptr = data.data();
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+        if(m_zeroCopy == -1 && !transport->isKernelSocket())
+            m_zeroCopy = 0;
+        if(m_zeroCopy == -1)
+        {
+            int       enabled = 0;
+            socklen_t len     = sizeof(enabled);
+            m_zeroCopy = (getsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &enabled, &len) == 0 && enabled);
+        }
+
+        while(m_zeroCopy == 1 && size > 0 && !m_close)
+        {
+            ssize_t written = send(socket, ptr, size, MSG_ZEROCOPY | MSG_NOSIGNAL);
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                //Too much memory pinned (optmem) : wait for completions
+                if(errno == ENOBUFS)
+                {
+                    reapZeroCopy();
+                    struct pollfd pfd = {.fd = socket, .events = 0};
+                    poll(&pfd, 1, 1);
+                    continue;
+                }
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+
+                reapZeroCopy();
+                struct pollfd pfd = {.fd = socket, .events = POLLOUT};
+                poll(&pfd, 1, 10);
+                continue;
+            }
+
+            //Each successful call gets the next notification ID. Keep data until it is notified
+            m_zeroCopyPending.emplace_back(m_zeroCopyID++, data);
+            ptr  += written;
+            size -= written;
+        }
+        if(m_zeroCopy == 1)
+        {
+            reapZeroCopy();
+            return size == 0;
+        }
+#endif
+        //No SO_ZEROCOPY, or zero copy disabled meanwhile : write the rest normally
+        return writeSocket(ptr, size);
+    }
+
+    void ClientSocket::reapZeroCopy()
+    {
+        while(m_zeroCopyPending.size() > 0)
+        {
+            char          control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control    = control;
+            msg.msg_controllen = sizeof(control);
+            if(recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                return;
+
+            for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if(!(cm->cmsg_level == SOL_IP   && cm->cmsg_type == IP_RECVERR) &&
+                   !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                    continue;
+
+                struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+                if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+
+                //The kernel had to copy the data (e.g., loopback) : plain writes are cheaper from now on
+                if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    m_zeroCopy = 0;
+
+                //The sends [ee_info, ee_data] are completed. Completions arrive in order
+                uint32_t lo = err->ee_info;
+                uint32_t hi = err->ee_data;
+                while(m_zeroCopyPending.size() > 0 && (uint32_t)(m_zeroCopyPending.front().first - lo) <= hi - lo)
+                    m_zeroCopyPending.pop_front();
+            }
+        }
+    }
+
+    bool ClientSocket::writeSocket(const uint8_t* data, uint32_t size)
+    {
+        //The socket is non blocking : handle partial writes and wait for it to be writable
+        while(size > 0 && !m_close)
+        {
+            ssize_t written = transport->send(socket, data, size);
+            if(written < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    return false;
+                if(!transport->isKernelSocket())
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                struct pollfd pfd = {.fd = socket, .events = POLLOUT};
+                poll(&pfd, 1, 10);
+                continue;
+            }
+            data += written;
+            size -= written;
+        }
+        return size == 0;
+    }
+
+    void ClientSocket::setSharedMemoryChannel(std::shared_ptr<SharedMemoryChannel> channel)
+    {
+        m_writeLock.lock();
+            m_shmChannel = channel;
+        m_writeLock.unlock();
+    }
+
+    void ClientSocket::pushSocketData(SocketData&& packet, uint8_t priority)
+    {
+        if(priority >= PRIORITY_COUNT)
+            priority = PRIORITY_COUNT-1;
+
         m_writeLock.lock();
-            m_bytesInWriting += size;
-            m_writeBuffer.push({data, (int)size});
-            m_cond.notify_one();
+            m_bytesInWriting += packet.headerSize + packet.dataSize;
+            m_writeBuffer[priority].push(std::move(packet));
+            wakeWriteThread();
         m_writeLock.unlock();
     }
+
+    void ClientSocket::pushPacket(Buffer data, uint8_t priority)
+    {
+        SocketData packet;
+        packet.dataSize = data.size();
+        packet.data     = std::move(data);
+        pushSocketData(std::move(packet), priority);
+    }
+
+    void ClientSocket::pushPacket(std::shared_ptr<uint8_t>& data, uint32_t size, uint8_t priority)
+    {
+        pushPacket(Buffer::wrap(data, size), priority);
+    }
+
+    void ClientSocket::pushChunked(Buffer data, uint32_t chunkSize, ChunkHeaderWriter headerWriter, uint8_t priority)
+    {
+        if(priority >= PRIORITY_COUNT)
+            priority = PRIORITY_COUNT-1;
+        uint32_t size = data.size();
+        if(chunkSize == 0)
+            chunkSize = size;
+
+        m_writeLock.lock();
+            for(uint32_t offset = 0; offset < size; offset += chunkSize)
+            {
+                SocketData   chunk;
+                UniqueBuffer header = UniqueBuffer::allocate(MAX_CHUNK_HEADER_SIZE);
+                chunk.data       = data.slice(offset, chunkSize); //Share the memory of data
+                chunk.dataSize   = chunk.data.size();
+                chunk.headerSize = std::min(MAX_CHUNK_HEADER_SIZE, headerWriter(header.data(), offset, chunk.dataSize, size));
+                header.resize(chunk.headerSize);
+                chunk.header     = header.share();
+
+                m_bytesInWriting += chunk.headerSize + chunk.dataSize;
+                m_writeBuffer[priority].push(std::move(chunk));
+            }
+            wakeWriteThread();
+        m_writeLock.unlock();
+    }
+
+    void ClientSocket::pushChunked(std::shared_ptr<uint8_t> data, uint32_t size, uint32_t chunkSize, ChunkHeaderWriter headerWriter, uint8_t priority)
+    {
+        pushChunked(Buffer::wrap(std::move(data), size), chunkSize, headerWriter, priority);
+    }
+
+    bool ClientSocket::pushFile(int fd, off_t offset, uint32_t size, uint8_t priority)
+    {
+        int dupFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(dupFd == -1)
+        {
+            ERROR_RATE_LIMITED(1000) << "Could not duplicate the file descriptor to send\n";
+            return false;
+        }
+
+        SocketData packet;
+        packet.dataSize   = size;
+        packet.file       = std::shared_ptr<int>(new int(dupFd), [](int* f) {::close(*f); delete f;});
+        packet.fileOffset = offset;
+        pushSocketData(std::move(packet), priority);
+        return true;
+    }
+
+    void ClientSocket::pushZeroCopy(Buffer data, uint8_t priority)
+    {
+        SocketData packet;
+        packet.dataSize = data.size();
+        packet.data     = std::move(data);
+        packet.zeroCopy = true;
+        pushSocketData(std::move(packet), priority);
+    }
+
+    void ClientSocket::pushZeroCopy(std::shared_ptr<uint8_t>& data, uint32_t size, uint8_t priority)
+    {
+        pushZeroCopy(Buffer::wrap(data, size), priority);
+    }
+
+    void ClientSocket::setWriteLaneWeights(const std::vector<uint32_t>& weights)
+    {
+        m_writeLock.lock();
+            m_writeScheduler.setWeights(weights);
+        m_writeLock.unlock();
+    }
+
+    bool ClientSocket::enableCompression(const CompressionConfig& config, ChunkHeaderWriter headerWriter)
+    {
+        if(!StreamCompressor::isAvailable())
+        {
+            ERROR << "Compression is not available : serenoServer was built without zlib\n";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_compressLock);
+        if(m_compressor)
+        {
+            WARNING << "Compression is already enabled for this client\n";
+            return false;
+        }
+        std::unique_ptr<StreamCompressor> compressor(new StreamCompressor(config));
+        if(!compressor->isValid())
+            return false;
+        m_compressor           = std::move(compressor);
+        m_compressHeaderWriter = headerWriter;
+        m_compressionEnabled.store(true, std::memory_order_release);
+        return true;
+    }
+
+    void ClientSocket::pushCompressed(const Buffer& data)
+    {
+        if(!isCompressionEnabled())
+        {
+            pushPacket(data);
+            return;
+        }
+
+        //Compress and queue in the same critical section : the queue order is the stream order
+        std::lock_guard<std::mutex> lock(m_compressLock);
+        UniqueBuffer    payload;
+        CompressionFlag flag = m_compressor->compress(data.data(), data.size(), payload);
+
+        SocketData   packet;
+        UniqueBuffer header     = UniqueBuffer::allocate(MAX_CHUNK_HEADER_SIZE + 1);
+        uint32_t     msgSize    = 1 + (flag == COMPRESSION_RAW ? data.size() : payload.size());
+        uint32_t     headerSize = 0;
+        if(m_compressHeaderWriter)
+            headerSize = std::min(MAX_CHUNK_HEADER_SIZE, m_compressHeaderWriter(header.data(), 0, msgSize, msgSize));
+        header.data()[headerSize++] = flag;
+        header.resize(headerSize);
+
+        packet.header     = header.share();
+        packet.headerSize = headerSize;
+        packet.data       = (flag == COMPRESSION_RAW ? data : payload.share());
+        packet.dataSize   = packet.data.size();
+        pushSocketData(std::move(packet), m_compressor->getConfig().priority);
+    }
+
+    void ClientSocket::pushCompressed(std::shared_ptr<uint8_t>& data, uint32_t size)
+    {
+        pushCompressed(Buffer::wrap(data, size));
+    }
+
+    bool ClientSocket::decompress(uint8_t* data, uint32_t size, uint8_t*& msg, uint32_t& msgSize)
+    {
+        if(!isCompressionEnabled())
+            return false;
+        if(!m_compressor->decode(data, size, msg, msgSize))
+        {
+            WARNING_RATE_LIMITED(1000) << "Could not decode a compressed message of the socket " << socket << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    CompressionStats ClientSocket::getCompressionStats() const
+    {
+        if(!isCompressionEnabled())
+            return CompressionStats();
+        return m_compressor->getStats();
+    }
 }
@@ -0,0 +1,259 @@
+#include "Compression.h"
+#include "utils.h"
+
+#include <cstring>
+#include <time.h>
+#ifdef SERENO_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace sereno
+{
+#ifdef SERENO_HAVE_ZLIB
+    /* \brief The pool of the compressed payloads. Larger payloads are allocated with malloc */
+    typedef PoolAllocator<(1u << 14)> CompressionPool;
+
+    /* \brief The end of a Z_SYNC_FLUSH block. It ends every compressed payload, hence is not sent (as in RFC 7692) */
+    static const uint8_t SYNC_FLUSH_TAIL[4] = {0x00, 0x00, 0xFF, 0xFF};
+
+    /* \brief Get the CPU time of the calling thread
+     * \return the time in nanoseconds */
+    static uint64_t threadCPUTime()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+        return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+    }
+
+    /* \brief The zlib streams of a StreamCompressor */
+    struct CompressionStreams
+    {
+        z_stream deflater; /*!< The outbound stream*/
+        z_stream inflater; /*!< The inbound stream*/
+        bool     deflaterInit = false;
+        bool     inflaterInit = false;
+
+        ~CompressionStreams()
+        {
+            if(deflaterInit)
+                deflateEnd(&deflater);
+            if(inflaterInit)
+                inflateEnd(&inflater);
+        }
+    };
+
+    StreamCompressor::StreamCompressor(const CompressionConfig& config) : m_config(config), m_streams(new CompressionStreams())
+    {
+        //Raw deflate (negative windowBits) : no zlib header nor checksum, the connection is the stream
+        memset(&m_streams->deflater, 0, sizeof(z_stream));
+        memset(&m_streams->inflater, 0, sizeof(z_stream));
+        m_streams->deflaterInit = (deflateInit2(&m_streams->deflater, config.level, Z_DEFLATED, -config.windowBits,
+                                                config.memLevel, Z_DEFAULT_STRATEGY) == Z_OK);
+        m_streams->inflaterInit = (inflateInit2(&m_streams->inflater, -config.windowBits) == Z_OK);
+        if(!isValid())
+        {
+            ERROR << "Could not initialize the compression streams\n";
+            m_streams.reset();
+        }
+    }
+
+    bool StreamCompressor::isAvailable()
+    {
+        return true;
+    }
+
+    bool StreamCompressor::isValid() const
+    {
+        return m_streams && m_streams->deflaterInit && m_streams->inflaterInit;
+    }
+
+    CompressionFlag StreamCompressor::compress(const uint8_t* data, uint32_t size, UniqueBuffer& out)
+    {
+        out.reset();
+        m_inBytes.fetch_add(size, std::memory_order_relaxed);
+        if(!m_streams || m_deflateBroken || size < m_config.threshold)
+        {
+            m_nbRaw.fetch_add(1, std::memory_order_relaxed);
+            m_outBytes.fetch_add(size + 1, std::memory_order_relaxed);
+            return COMPRESSION_RAW;
+        }
+
+        uint64_t  start    = threadCPUTime();
+        z_stream& deflater = m_streams->deflater;
+        uint32_t  capacity = deflateBound(&deflater, size) + 16;
+        out = (capacity <= UniqueBuffer::maxSize<CompressionPool>() ? UniqueBuffer::allocateFrom<CompressionPool>(capacity)
+                                                                    : UniqueBuffer::allocate(capacity));
+
+        deflater.next_in   = (Bytef*)data;
+        deflater.avail_in  = size;
+        uint32_t written   = 0;
+        int      res       = Z_OK;
+        do
+        {
+            //The bound does not account for the flush : grow if needed
+            if(written == out.capacity())
+            {
+                UniqueBuffer larger = UniqueBuffer::allocate(2*out.capacity());
+                memcpy(larger.data(), out.data(), written);
+                out = std::move(larger);
+            }
+            deflater.next_out  = out.data() + written;
+            deflater.avail_out = out.capacity() - written;
+            res                = deflate(&deflater, Z_SYNC_FLUSH);
+            written            = out.capacity() - deflater.avail_out;
+        }while(res == Z_OK && (deflater.avail_in > 0 || deflater.avail_out == 0));
+
+        //The receiver history now differs from ours : stop compressing. Raw messages stay readable
+        if(res != Z_OK || written < sizeof(SYNC_FLUSH_TAIL))
+        {
+            ERROR_RATE_LIMITED(1000) << "Could not compress a message : the stream is sent raw from now on\n";
+            m_deflateBroken = true;
+            out.reset();
+            m_nbRaw.fetch_add(1, std::memory_order_relaxed);
+            m_outBytes.fetch_add(size + 1, std::memory_order_relaxed);
+            return COMPRESSION_RAW;
+        }
+
+        out.resize(written - sizeof(SYNC_FLUSH_TAIL));
+        m_nbCompressed.fetch_add(1, std::memory_order_relaxed);
+        m_outBytes.fetch_add(out.size() + 1, std::memory_order_relaxed);
+        m_compressNS.fetch_add(threadCPUTime() - start, std::memory_order_relaxed);
+        return COMPRESSION_DEFLATE;
+    }
+
+    bool StreamCompressor::decode(uint8_t* data, uint32_t size, uint8_t*& msg, uint32_t& msgSize)
+    {
+        if(size == 0 || data[0] > COMPRESSION_DEFLATE)
+            return false;
+
+        m_nbDecompressed.fetch_add(1, std::memory_order_relaxed);
+        if(data[0] == COMPRESSION_RAW)
+        {
+            msg     = data + 1;
+            msgSize = size - 1;
+            m_decompressedBytes.fetch_add(msgSize, std::memory_order_relaxed);
+            return true;
+        }
+        if(!m_streams)
+            return false;
+
+        uint64_t  start    = threadCPUTime();
+        z_stream& inflater = m_streams->inflater;
+        uint32_t  inflated = 0;
+        if(m_inflated.size() < 4*size)
+            m_inflated.resize(std::min<uint64_t>(4*(uint64_t)size, m_config.maxMessageSize) + 1);
+
+        //The payload, then the flush tail removed by the sender
+        const uint8_t* inputs[2]     = {data + 1, SYNC_FLUSH_TAIL};
+        uint32_t       inputSizes[2] = {size - 1, sizeof(SYNC_FLUSH_TAIL)};
+        for(uint32_t i = 0; i < 2; i++)
+        {
+            inflater.next_in  = (Bytef*)inputs[i];
+            inflater.avail_in = inputSizes[i];
+            while(inflater.avail_in > 0)
+            {
+                if(inflated == m_inflated.size())
+                {
+                    if(inflated > m_config.maxMessageSize)
+                    {
+                        WARNING_RATE_LIMITED(1000) << "Decompressed message larger than " << m_config.maxMessageSize << " bytes\n";
+                        return false;
+                    }
+                    m_inflated.resize(std::min<uint64_t>(2*(uint64_t)m_inflated.size(), m_config.maxMessageSize + 1));
+                }
+                inflater.next_out  = m_inflated.data() + inflated;
+                inflater.avail_out = m_inflated.size() - inflated;
+                int res  = inflate(&inflater, Z_SYNC_FLUSH);
+                inflated = m_inflated.size() - inflater.avail_out;
+                if(res != Z_OK && res != Z_BUF_ERROR)
+                {
+                    WARNING_RATE_LIMITED(1000) << "Corrupted compressed message\n";
+                    return false;
+                }
+                if(res == Z_BUF_ERROR && inflater.avail_out > 0)
+                    break;
+            }
+        }
+        if(inflated > m_config.maxMessageSize)
+        {
+            WARNING_RATE_LIMITED(1000) << "Decompressed message larger than " << m_config.maxMessageSize << " bytes\n";
+            return false;
+        }
+
+        msg     = m_inflated.data();
+        msgSize = inflated;
+        m_decompressedBytes.fetch_add(msgSize, std::memory_order_relaxed);
+        m_decompressNS.fetch_add(threadCPUTime() - start, std::memory_order_relaxed);
+        return true;
+    }
+#else
+    struct CompressionStreams
+    {};
+
+    StreamCompressor::StreamCompressor(const CompressionConfig& config) : m_config(config)
+    {}
+
+    bool StreamCompressor::isAvailable()
+    {
+        return false;
+    }
+
+    bool StreamCompressor::isValid() const
+    {
+        return false;
+    }
+
+    CompressionFlag StreamCompressor::compress(const uint8_t* data, uint32_t size, UniqueBuffer& out)
+    {
+        out.reset();
+        m_nbRaw.fetch_add(1, std::memory_order_relaxed);
+        m_inBytes.fetch_add(size, std::memory_order_relaxed);
+        m_outBytes.fetch_add(size + 1, std::memory_order_relaxed);
+        return COMPRESSION_RAW;
+    }
+
+    bool StreamCompressor::decode(uint8_t* data, uint32_t size, uint8_t*& msg, uint32_t& msgSize)
+    {
+        if(size == 0 || data[0] != COMPRESSION_RAW)
+            return false;
+        m_nbDecompressed.fetch_add(1, std::memory_order_relaxed);
+        m_decompressedBytes.fetch_add(size - 1, std::memory_order_relaxed);
+        msg     = data + 1;
+        msgSize = size - 1;
+        return true;
+    }
+#endif
+
+    StreamCompressor::~StreamCompressor()
+    {}
+
+    UniqueBuffer StreamCompressor::encode(const uint8_t* data, uint32_t size)
+    {
+        UniqueBuffer    payload;
+        CompressionFlag flag = compress(data, size, payload);
+        if(flag == COMPRESSION_DEFLATE)
+        {
+            data = payload.data();
+            size = payload.size();
+        }
+
+        UniqueBuffer msg = UniqueBuffer::allocate(size + 1);
+        msg.data()[0] = flag;
+        memcpy(msg.data() + 1, data, size);
+        return msg;
+    }
+
+    CompressionStats StreamCompressor::getStats() const
+    {
+        CompressionStats stats;
+        stats.nbCompressed      = m_nbCompressed;
+        stats.nbRaw             = m_nbRaw;
+        stats.inBytes           = m_inBytes;
+        stats.outBytes          = m_outBytes;
+        stats.compressNS        = m_compressNS;
+        stats.nbDecompressed    = m_nbDecompressed;
+        stats.decompressedBytes = m_decompressedBytes;
+        stats.decompressNS      = m_decompressNS;
+        return stats;
+    }
+}
@@ -0,0 +1,318 @@
+#include "Logger.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+namespace sereno
+{
+    /* \brief The capacity of each thread staging ring (power of two) */
+    static const uint32_t LOG_RING_SIZE = 1 << 16;
+
+    /* \brief The maximum size of one line. Longer lines are truncated */
+    static const uint32_t LOG_MAX_LINE_SIZE = LOG_RING_SIZE / 4;
+
+    /* \brief The header of a line in a staging ring : [uint32_t size][uint8_t level] */
+    static const uint32_t LOG_HEADER_SIZE = sizeof(uint32_t) + 1;
+
+    /* \brief Get the monotonic time
+     * \return the time in nanoseconds */
+    static uint64_t logNow()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+    }
+
+    /* \brief The staging ring of one thread. Single producer (its thread), single consumer (the flusher) */
+    struct LogRing
+    {
+        std::atomic<uint64_t> head{0};     /*!< The write position (producer)*/
+        std::atomic<uint64_t> tail{0};     /*!< The read position (consumer)*/
+        std::atomic<bool>     alive{true}; /*!< Is the producer thread alive?*/
+        char                  data[LOG_RING_SIZE]; /*!< The lines*/
+
+        /* \brief Copy bytes at a position, wrapping around the ring */
+        void copyIn(uint64_t pos, const char* src, uint32_t size)
+        {
+            uint32_t offset = pos & (LOG_RING_SIZE-1);
+            uint32_t first  = std::min(size, LOG_RING_SIZE - offset);
+            memcpy(data+offset, src, first);
+            memcpy(data, src+first, size-first);
+        }
+
+        /* \brief Copy bytes from a position, wrapping around the ring */
+        void copyOut(uint64_t pos, char* dst, uint32_t size) const
+        {
+            uint32_t offset = pos & (LOG_RING_SIZE-1);
+            uint32_t first  = std::min(size, LOG_RING_SIZE - offset);
+            memcpy(dst, data+offset, first);
+            memcpy(dst+first, data, size-first);
+        }
+
+        /* \brief Push a line (producer)
+         * \return false if the ring is full */
+        bool push(int level, const char* line, uint32_t size)
+        {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            if(LOG_RING_SIZE - (h - tail.load(std::memory_order_acquire)) < LOG_HEADER_SIZE + size)
+                return false;
+
+            uint8_t l = level;
+            copyIn(h, (const char*)&size, sizeof(uint32_t));
+            copyIn(h+sizeof(uint32_t), (const char*)&l, 1);
+            copyIn(h+LOG_HEADER_SIZE, line, size);
+            head.store(h + LOG_HEADER_SIZE + size, std::memory_order_release);
+            return true;
+        }
+
+        /* \brief Move every line to the output buffers (consumer)
+         * \param out the stdout buffer
+         * \param err the stderr buffer */
+        void drain(std::string& out, std::string& err)
+        {
+            uint64_t t = tail.load(std::memory_order_relaxed);
+            uint64_t h = head.load(std::memory_order_acquire);
+            while(t < h)
+            {
+                uint32_t size;
+                uint8_t  level;
+                copyOut(t, (char*)&size, sizeof(uint32_t));
+                copyOut(t+sizeof(uint32_t), (char*)&level, 1);
+
+                std::string& dst = (level == SERENO_LOG_LEVEL_ERROR ? err : out);
+                size_t       pos = dst.size();
+                dst.resize(pos + size);
+                copyOut(t+LOG_HEADER_SIZE, &dst[pos], size);
+                t += LOG_HEADER_SIZE + size;
+            }
+            tail.store(t, std::memory_order_release);
+        }
+    };
+
+    /* \brief The Logger state : the staging rings and the flusher thread */
+    class LoggerBackend
+    {
+        public:
+            LoggerBackend()
+            {
+                m_thread = std::thread([this]
+                {
+                    std::unique_lock<std::mutex> lock(m_flushMutex);
+                    while(!m_close)
+                    {
+                        m_flushCond.wait_for(lock, std::chrono::milliseconds(5));
+                        lock.unlock();
+                            flush();
+                        lock.lock();
+                    }
+                });
+            }
+
+            /* \brief Get the ring of the calling thread, registering it at its first call
+             * \return the ring, NULL once the backend is stopped */
+            LogRing* getRing()
+            {
+                //Owns the ring reference of this thread, and marks the ring dead at the thread exit
+                struct ThreadRing
+                {
+                    std::shared_ptr<LogRing> ring;
+                    ~ThreadRing()
+                    {
+                        if(ring)
+                            ring->alive = false;
+                    }
+                };
+                static thread_local ThreadRing threadRing;
+
+                if(!threadRing.ring)
+                {
+                    threadRing.ring = std::make_shared<LogRing>();
+                    std::lock_guard<std::mutex> lock(m_ringsMutex);
+                    m_rings.push_back(threadRing.ring);
+                }
+                return threadRing.ring.get();
+            }
+
+            /* \brief Write every staged line */
+            void flush()
+            {
+                std::lock_guard<std::mutex> writeLock(m_writeMutex);
+
+                std::vector<std::shared_ptr<LogRing>> rings;
+                m_ringsMutex.lock();
+                    rings = m_rings;
+                m_ringsMutex.unlock();
+
+                std::string out;
+                std::string err;
+                for(auto& ring : rings)
+                    ring->drain(out, err);
+
+                uint64_t dropped = m_dropped.load();
+                if(dropped > m_reportedDropped)
+                {
+                    out += std::string(BOLD YEL "Warning : " RESET GRN "Logger" RESET " ") + std::to_string(dropped - m_reportedDropped) +
+                           " log lines dropped (staging ring full)\n";
+                    m_reportedDropped = dropped;
+                }
+
+                if(out.size() > 0)
+                {
+                    fwrite(out.data(), 1, out.size(), stdout);
+                    fflush(stdout);
+                }
+                if(err.size() > 0)
+                {
+                    fwrite(err.data(), 1, err.size(), stderr);
+                    fflush(stderr);
+                }
+
+                //Forget the rings of the exited threads once drained
+                m_ringsMutex.lock();
+                    for(auto it = m_rings.begin(); it != m_rings.end();)
+                    {
+                        if(!(*it)->alive && (*it)->tail == (*it)->head)
+                            it = m_rings.erase(it);
+                        else
+                            it++;
+                    }
+                m_ringsMutex.unlock();
+            }
+
+            /* \brief Stop the flusher thread and write the remaining lines. Lines logged afterwards are written synchronously */
+            void stop()
+            {
+                m_flushMutex.lock();
+                    m_close = true;
+                m_flushMutex.unlock();
+                m_flushCond.notify_one();
+                if(m_thread.joinable())
+                    m_thread.join();
+                flush();
+            }
+
+            bool isStopped() const {return m_close;}
+
+            std::atomic<uint64_t> m_dropped{0}; /*!< The number of dropped lines*/
+        private:
+            std::thread                           m_thread;              /*!< The flusher thread*/
+            std::mutex                            m_flushMutex;          /*!< The mutex of m_flushCond*/
+            std::condition_variable               m_flushCond;           /*!< Wake up the flusher thread*/
+            std::atomic<bool>                     m_close{false};        /*!< Should the flusher stop?*/
+            std::mutex                            m_ringsMutex;          /*!< Protect m_rings*/
+            std::vector<std::shared_ptr<LogRing>> m_rings;               /*!< The staging rings*/
+            std::mutex                            m_writeMutex;          /*!< Serialize the flushes*/
+            uint64_t                              m_reportedDropped = 0; /*!< The dropped lines already reported*/
+    };
+
+    /* \brief Get the backend. It is never destroyed (threads may log during the static destruction) and stopped at exit */
+    static LoggerBackend* getBackend()
+    {
+        static LoggerBackend* backend = []
+        {
+            LoggerBackend* b = new LoggerBackend();
+            atexit([] {getBackend()->stop();});
+            return b;
+        }();
+        return backend;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*------------------------------------Logger----------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    void Logger::push(int level, const char* line, uint32_t size)
+    {
+        size = std::min(size, LOG_MAX_LINE_SIZE);
+
+        LoggerBackend* backend = getBackend();
+        if(backend->isStopped())
+        {
+            fwrite(line, 1, size, level == SERENO_LOG_LEVEL_ERROR ? stderr : stdout);
+            return;
+        }
+
+        if(!backend->getRing()->push(level, line, size))
+            backend->m_dropped++;
+    }
+
+    void Logger::flush()
+    {
+        getBackend()->flush();
+    }
+
+    uint64_t Logger::getNbDropped()
+    {
+        return getBackend()->m_dropped;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*------------------------------------LogLine---------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief The lines suppressed by the last LogRateLimiter which allowed a line of this thread */
+    static thread_local uint32_t t_suppressed = 0;
+
+    /* \brief Get the formatting stream of the calling thread
+     * \return the stream, emptied */
+    static std::ostringstream& getThreadStream()
+    {
+        static thread_local std::ostringstream stream;
+        stream.str(std::string());
+        stream.clear();
+        return stream;
+    }
+
+    LogLine::LogLine(int level, const char* file, int line) : m_level(level), m_stream(getThreadStream())
+    {
+        switch(level)
+        {
+            case SERENO_LOG_LEVEL_ERROR:
+                m_stream << BOLD RED "Error : "   RESET GRN;
+                break;
+            case SERENO_LOG_LEVEL_WARNING:
+                m_stream << BOLD YEL "Warning : " RESET GRN;
+                break;
+            default:
+                m_stream << BOLD WHT "Info : "    RESET GRN;
+                break;
+        }
+        m_stream << file << ":" << line << RESET " ";
+
+        if(t_suppressed > 0)
+        {
+            m_stream << "(" << t_suppressed << " similar lines suppressed) ";
+            t_suppressed = 0;
+        }
+    }
+
+    LogLine::~LogLine()
+    {
+        const std::string& line = m_stream.str();
+        Logger::push(m_level, line.data(), line.size());
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*--------------------------------LogRateLimiter------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    bool LogRateLimiter::allow(uint32_t periodMS)
+    {
+        uint64_t now  = logNow();
+        uint64_t next = m_next.load(std::memory_order_relaxed);
+        if(now < next || !m_next.compare_exchange_strong(next, now + (uint64_t)periodMS*1000000))
+        {
+            m_suppressed++;
+            return false;
+        }
+        t_suppressed = m_suppressed.exchange(0);
+        return true;
+    }
+}
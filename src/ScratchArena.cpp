@@ -0,0 +1,143 @@
+#include "ScratchArena.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+namespace sereno
+{
+    /* \brief Allocate a chunk of a ScratchArena
+     * \param size the chunk size
+     * \return the chunk. Throws std::bad_alloc on failure */
+    static Buffer allocateChunk(size_t size)
+    {
+        if(size > UINT32_MAX)
+            throw std::bad_alloc();
+        Buffer chunk = UniqueBuffer::allocate(size).share();
+        if(!chunk)
+            throw std::bad_alloc();
+        return chunk;
+    }
+
+    /* \brief Align an address
+     * \param address the address
+     * \param align the alignment (a power of two)
+     * \return the first address >= address aligned on align */
+    static uintptr_t alignAddress(uintptr_t address, size_t align)
+    {
+        return (address + align-1) & ~(uintptr_t)(align-1);
+    }
+
+    ScratchArena::ScratchArena(const ScratchArenaConfig& config) : m_config(config)
+    {}
+
+    void ScratchArena::setConfig(const ScratchArenaConfig& config)
+    {
+        reset();
+        m_freeChunks.clear();
+        m_config = config;
+    }
+
+    void* ScratchArena::allocate(size_t size, size_t align)
+    {
+        if(align == 0)
+            align = 1;
+        m_stats.nbAllocations++;
+
+        //Large allocation : its own chunk, the current one stays current
+        if(size + align > m_config.chunkSize)
+        {
+            Buffer    chunk = allocateChunk(size + align);
+            uintptr_t start = alignAddress((uintptr_t)chunk.data(), align);
+            m_stats.nbChunks++;
+            m_largeChunks.push_back(std::move(chunk));
+            m_usedBytes      += size + align;
+            m_stats.peakBytes = std::max(m_stats.peakBytes, m_usedBytes);
+            return (void*)start;
+        }
+
+        //Bump in the current chunk, or in a new one if it is full
+        for(uint32_t i = 0; i < 2; i++)
+        {
+            if(!m_chunks.empty())
+            {
+                uintptr_t base  = (uintptr_t)m_chunks.back().data();
+                uintptr_t start = alignAddress(base + m_offset, align);
+                if(start + size <= base + m_chunks.back().size())
+                {
+                    m_usedBytes      += start + size - (base + m_offset);
+                    m_offset          = start + size - base;
+                    m_stats.peakBytes = std::max(m_stats.peakBytes, m_usedBytes);
+                    return (void*)start;
+                }
+            }
+            nextChunk(size + align);
+        }
+        throw std::bad_alloc();
+    }
+
+    void ScratchArena::nextChunk(size_t size)
+    {
+        if(m_freeChunks.size() > 0)
+        {
+            m_chunks.push_back(std::move(m_freeChunks.back()));
+            m_freeChunks.pop_back();
+        }
+        else
+        {
+            m_chunks.push_back(allocateChunk(m_config.chunkSize));
+            m_stats.nbChunks++;
+        }
+        m_offset = 0;
+    }
+
+    Buffer ScratchArena::promote(const void* data, uint32_t size)
+    {
+        const uint8_t* ptr = (const uint8_t*)data;
+        for(const std::vector<Buffer>* chunks : {&m_chunks, &m_largeChunks})
+        {
+            //The reply is usually in the last chunk
+            for(auto it = chunks->rbegin(); it != chunks->rend(); it++)
+            {
+                if(ptr >= it->data() && ptr + size <= it->data() + it->size())
+                {
+                    m_stats.nbPromotions++;
+                    return it->slice(ptr - it->data(), size);
+                }
+            }
+        }
+        return Buffer();
+    }
+
+    void ScratchArena::reset()
+    {
+        if(m_usedBytes == 0)
+            return;
+
+        //A current chunk shared with promoted buffers stays current : the memory after them is still free
+        Buffer   current;
+        uint32_t offset = 0;
+        if(m_chunks.size() > 0 && !m_chunks.back().isUnique() && m_chunks.back().size() == m_config.chunkSize)
+        {
+            current = std::move(m_chunks.back());
+            offset  = m_offset;
+            m_chunks.pop_back();
+        }
+
+        //The other chunks shared with promoted buffers are left to them
+        for(Buffer& chunk : m_chunks)
+        {
+            if(chunk.isUnique() && chunk.size() == m_config.chunkSize && m_freeChunks.size() < m_config.maxFreeChunks)
+                m_freeChunks.push_back(std::move(chunk));
+        }
+        m_chunks.clear();
+        m_largeChunks.clear();
+        m_offset = 0;
+        if(current)
+        {
+            m_chunks.push_back(std::move(current));
+            m_offset = offset;
+        }
+        m_usedBytes = 0;
+        m_stats.nbResets++;
+    }
+}
@@ -0,0 +1,361 @@
+#include "SharedMemoryChannel.h"
+#include "utils.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+namespace sereno
+{
+    /* \brief The size reserved for a ring header in the shared memory */
+    static const size_t RING_HEADER_SIZE = (sizeof(SharedMemoryRingHeader) + 63) & ~(size_t)63;
+
+    /*----------------------------------------------------------------------------*/
+    /*------------------------------SharedMemoryRing------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    SharedMemoryRing::SharedMemoryRing(SharedMemoryRingHeader* header, uint32_t capacity) : m_header(header),
+                                                                                           m_data(header ? (uint8_t*)header + RING_HEADER_SIZE : NULL),
+                                                                                           m_capacity(capacity)
+    {}
+
+    void SharedMemoryRing::init()
+    {
+        m_header->head.store(0);
+        m_header->tail.store(0);
+        m_header->consumerWaiting.store(0);
+        m_header->producerWaiting.store(0);
+        m_header->capacity = m_capacity;
+    }
+
+    uint32_t SharedMemoryRing::used(uint64_t head, uint64_t tail) const
+    {
+        //tail > head wraps to a huge value : one test covers both
+        if(m_corrupted || head - tail > m_capacity)
+        {
+            if(!m_corrupted)
+                WARNING << "Corrupted shared memory ring : head " << head << ", tail " << tail << "\n";
+            m_corrupted = true;
+            return 0;
+        }
+        return (uint32_t)(head - tail);
+    }
+
+    uint32_t SharedMemoryRing::write(const uint8_t* data, uint32_t size)
+    {
+        uint32_t capacity = m_capacity;
+        uint64_t head     = m_header->head.load(std::memory_order_relaxed);
+        uint64_t tail     = m_header->tail.load(std::memory_order_acquire);
+        uint32_t usedSize = used(head, tail);
+        if(m_corrupted)
+            return 0;
+        uint32_t freeSize = capacity - usedSize;
+
+        if(size > freeSize)
+            size = freeSize;
+        if(size == 0)
+            return 0;
+
+        uint32_t pos   = head & (capacity-1);
+        uint32_t first = std::min(size, capacity - pos);
+        memcpy(m_data+pos, data, first);
+        memcpy(m_data, data+first, size-first);
+
+        m_header->head.store(head+size, std::memory_order_release);
+        return size;
+    }
+
+    uint32_t SharedMemoryRing::read(uint8_t* data, uint32_t size)
+    {
+        uint32_t capacity = m_capacity;
+        uint64_t tail     = m_header->tail.load(std::memory_order_relaxed);
+        uint64_t head     = m_header->head.load(std::memory_order_acquire);
+        uint32_t usedSize = used(head, tail);
+
+        if(size > usedSize)
+            size = usedSize;
+        if(size == 0)
+            return 0;
+
+        uint32_t pos   = tail & (capacity-1);
+        uint32_t first = std::min(size, capacity - pos);
+        memcpy(data, m_data+pos, first);
+        memcpy(data+first, m_data, size-first);
+
+        m_header->tail.store(tail+size, std::memory_order_release);
+        return size;
+    }
+
+    uint32_t SharedMemoryRing::available() const
+    {
+        uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+        return used(m_header->head.load(std::memory_order_acquire), tail);
+    }
+
+    uint32_t SharedMemoryRing::freeSpace() const
+    {
+        uint64_t head = m_header->head.load(std::memory_order_relaxed);
+        return m_capacity - used(head, m_header->tail.load(std::memory_order_acquire));
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*-----------------------------SharedMemoryChannel----------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    SharedMemoryChannel::SharedMemoryChannel() : m_closed(false)
+    {}
+
+    SharedMemoryChannel::~SharedMemoryChannel()
+    {
+        if(m_memory)
+            munmap(m_memory, m_memorySize);
+        if(m_memFD != -1)
+            ::close(m_memFD);
+        for(int i = 0; i < 4; i++)
+            if(m_doorbells[i] != -1)
+                ::close(m_doorbells[i]);
+        if(m_control != SOCKET_ERROR)
+            ::close(m_control);
+    }
+
+    std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::create(uint32_t ringSize)
+    {
+        //Round to the next power of two
+        uint32_t size = 4096;
+        while(size < ringSize)
+            size <<= 1;
+
+        std::shared_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+        channel->m_ringSize   = size;
+        channel->m_memorySize = 2*(RING_HEADER_SIZE + size);
+        channel->m_memFD      = memfd_create("serenoServer", MFD_CLOEXEC);
+        if(channel->m_memFD == -1 || ftruncate(channel->m_memFD, channel->m_memorySize) == -1)
+        {
+            ERROR << "Could not create the shared memory\n";
+            return NULL;
+        }
+
+        for(int i = 0; i < 4; i++)
+        {
+            channel->m_doorbells[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(channel->m_doorbells[i] == -1)
+            {
+                ERROR << "Could not create the shared memory doorbells\n";
+                return NULL;
+            }
+        }
+
+        if(!channel->map(true))
+            return NULL;
+
+        channel->m_in.init();
+        channel->m_out.init();
+        return channel;
+    }
+
+    std::shared_ptr<SharedMemoryChannel> SharedMemoryChannel::connect(const std::string& path)
+    {
+        std::shared_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel());
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+
+        channel->m_control = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(channel->m_control == SOCKET_ERROR || ::connect(channel->m_control, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR)
+        {
+            ERROR << "Could not connect to the shared memory control socket " << path << "\n";
+            return NULL;
+        }
+
+        //Receive the ring size and the file descriptors
+        uint32_t     ringSize = 0;
+        struct iovec iov      = {.iov_base = &ringSize, .iov_len = sizeof(ringSize)};
+        char         control[CMSG_SPACE(5*sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr* cmsg = NULL;
+        if(recvmsg(channel->m_control, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(ringSize) ||
+           (cmsg = CMSG_FIRSTHDR(&msg)) == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+           cmsg->cmsg_len != CMSG_LEN(5*sizeof(int)))
+        {
+            ERROR << "Could not receive the shared memory from the server\n";
+            return NULL;
+        }
+
+        int fds[5];
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        channel->m_memFD        = fds[0];
+        for(int i = 0; i < 4; i++)
+            channel->m_doorbells[i] = fds[i+1];
+        channel->m_ringSize     = ringSize;
+        channel->m_memorySize   = 2*(RING_HEADER_SIZE + ringSize);
+
+        if(!channel->map(false))
+            return NULL;
+        return channel;
+    }
+
+    bool SharedMemoryChannel::map(bool isServer)
+    {
+        //The ring size sets every bound of the rings : it has to be a power of two that fits the memory
+        struct stat memStat;
+        if(m_ringSize < 4096 || (m_ringSize & (m_ringSize-1)) != 0 ||
+           fstat(m_memFD, &memStat) == -1 || (uint64_t)memStat.st_size < m_memorySize)
+        {
+            ERROR << "Invalid shared memory (ring size " << m_ringSize << ")\n";
+            return false;
+        }
+
+        m_memory = mmap(NULL, m_memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, m_memFD, 0);
+        if(m_memory == MAP_FAILED)
+        {
+            m_memory = NULL;
+            ERROR << "Could not map the shared memory\n";
+            return false;
+        }
+
+        //Ring 0 : client -> server. Ring 1 : server -> client
+        SharedMemoryRingHeader* rings[2] = {(SharedMemoryRingHeader*)m_memory,
+                                            (SharedMemoryRingHeader*)((uint8_t*)m_memory + RING_HEADER_SIZE + m_ringSize)};
+        int side      = isServer ? 0 : 1;
+        m_in          = SharedMemoryRing(rings[side], m_ringSize);
+        m_out         = SharedMemoryRing(rings[1-side], m_ringSize);
+        m_inDoorbell        = m_doorbells[side];
+        m_outDoorbell       = m_doorbells[1-side];
+        m_spaceDoorbell     = m_doorbells[2+side];
+        m_peerSpaceDoorbell = m_doorbells[3-side];
+        return true;
+    }
+
+    bool SharedMemoryChannel::sendTo(SOCKET sock)
+    {
+        int          fds[5]   = {m_memFD, m_doorbells[0], m_doorbells[1], m_doorbells[2], m_doorbells[3]};
+        uint32_t     ringSize = m_ringSize;
+        struct iovec iov      = {.iov_base = &ringSize, .iov_len = sizeof(ringSize)};
+        char         control[CMSG_SPACE(sizeof(fds))];
+        memset(control, 0, sizeof(control));
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(ringSize);
+    }
+
+    bool SharedMemoryChannel::write(const uint8_t* data, uint32_t size)
+    {
+        while(size > 0)
+        {
+            if(m_closed)
+                return false;
+
+            uint32_t written = m_out.write(data, size);
+            if(m_out.isCorrupted())
+            {
+                m_outCorrupted = true;
+                close();
+                return false;
+            }
+            if(written == 0)
+            {
+                waitSpace();
+                continue;
+            }
+            data += written;
+            size -= written;
+
+            //Ring the doorbell only if the consumer sleeps
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_out.getHeader()->consumerWaiting.load(std::memory_order_relaxed))
+                eventfd_write(m_outDoorbell, 1);
+        }
+        return true;
+    }
+
+    void SharedMemoryChannel::waitSpace()
+    {
+        //Same handshake as prepareWait : the consumer checks producerWaiting after having freed space
+        SharedMemoryRingHeader* header = m_out.getHeader();
+        header->producerWaiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_out.freeSpace() == 0 && !m_closed)
+        {
+            //The timeout only guards against a lost wake up from the peer
+            struct pollfd pfd = {.fd = m_spaceDoorbell, .events = POLLIN};
+            poll(&pfd, 1, 100);
+        }
+        header->producerWaiting.store(0, std::memory_order_relaxed);
+        eventfd_t value;
+        eventfd_read(m_spaceDoorbell, &value);
+    }
+
+    uint32_t SharedMemoryChannel::read(uint8_t* data, uint32_t size)
+    {
+        uint32_t count = m_in.read(data, size);
+
+        //Wake the producer only if it sleeps on a full ring
+        if(count > 0)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_in.getHeader()->producerWaiting.load(std::memory_order_relaxed))
+                eventfd_write(m_peerSpaceDoorbell, 1);
+        }
+        return count;
+    }
+
+    void SharedMemoryChannel::close()
+    {
+        m_closed = true;
+        if(m_spaceDoorbell != -1)
+            eventfd_write(m_spaceDoorbell, 1);
+    }
+
+    bool SharedMemoryChannel::prepareWait()
+    {
+        m_in.getHeader()->consumerWaiting.store(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_in.available() > 0)
+        {
+            m_in.getHeader()->consumerWaiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void SharedMemoryChannel::finishWait()
+    {
+        m_in.getHeader()->consumerWaiting.store(0, std::memory_order_relaxed);
+        eventfd_t value;
+        eventfd_read(m_inDoorbell, &value);
+    }
+
+    bool SharedMemoryChannel::wait(int timeout)
+    {
+        if(prepareWait())
+        {
+            struct pollfd pfd = {.fd = m_inDoorbell, .events = POLLIN};
+            poll(&pfd, 1, timeout);
+            finishWait();
+        }
+        return available() > 0;
+    }
+}
@@ -0,0 +1,64 @@
+#include "SocketOptions.h"
+#include "utils.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace sereno
+{
+    /* \brief Set an integer socket option, logging a warning on failure
+     * \param sock the socket
+     * \param level the option level
+     * \param option the option
+     * \param value the option value
+     * \param name the option name to log
+     * \return true on success, false otherwise */
+    static bool setOption(SOCKET sock, int level, int option, int value, const char* name)
+    {
+        if(setsockopt(sock, level, option, &value, sizeof(value)) == SOCKET_ERROR)
+        {
+            WARNING << "Could not set the socket option " << name << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool SocketOptions::applyToListener(SOCKET sock, int domain) const
+    {
+        bool res = true;
+
+        //Accepted sockets inherit the buffer sizes from their listener
+        if(rcvBuf >= 0)
+            res = setOption(sock, SOL_SOCKET, SO_RCVBUF, rcvBuf, "SO_RCVBUF") && res;
+        if(sndBuf >= 0)
+            res = setOption(sock, SOL_SOCKET, SO_SNDBUF, sndBuf, "SO_SNDBUF") && res;
+        if(busyPoll >= 0)
+            res = setOption(sock, SOL_SOCKET, SO_BUSY_POLL, busyPoll, "SO_BUSY_POLL") && res;
+        if((domain == AF_INET || domain == AF_INET6) && deferAccept >= 0)
+            res = setOption(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, deferAccept, "TCP_DEFER_ACCEPT") && res;
+
+        return res;
+    }
+
+    bool SocketOptions::applyToClient(SOCKET sock, int domain) const
+    {
+        bool res = true;
+
+        if(busyPoll >= 0)
+            res = setOption(sock, SOL_SOCKET, SO_BUSY_POLL, busyPoll, "SO_BUSY_POLL") && res;
+
+        if(domain == AF_INET || domain == AF_INET6)
+        {
+            if(noDelay)
+                res = setOption(sock, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") && res;
+            if(quickAck)
+                res = setOption(sock, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK") && res;
+#ifdef SO_ZEROCOPY
+            if(zeroCopy)
+                res = setOption(sock, SOL_SOCKET, SO_ZEROCOPY, 1, "SO_ZEROCOPY") && res;
+#endif
+        }
+
+        return res;
+    }
+}
@@ -0,0 +1,64 @@
+#include "ThreadConfig.h"
+#include "utils.h"
+
+#include <sched.h>
+
+namespace sereno
+{
+    ThreadConfig::ThreadConfig()
+    {
+        const char* names[THREAD_CLASS_COUNT] = {"srvAccept", "srvRead", "srvWrite", "srvHandle", "srvClient"};
+        for(uint32_t i = 0; i < THREAD_CLASS_COUNT; i++)
+        {
+            m_spread[i] = false;
+            m_names[i]  = names[i];
+        }
+    }
+
+    void ThreadConfig::setCPUs(ThreadClass cls, const std::vector<int>& cpus, bool spread)
+    {
+        m_cpus[cls]   = cpus;
+        m_spread[cls] = spread;
+    }
+
+    void ThreadConfig::setName(ThreadClass cls, const std::string& name)
+    {
+        m_names[cls] = name;
+    }
+
+    bool ThreadConfig::apply(ThreadClass cls, uint32_t index, pthread_t thread) const
+    {
+        bool res = true;
+
+        //Name
+        if(m_names[cls].size() > 0)
+        {
+            std::string name = m_names[cls];
+            if(cls == THREAD_HANDLER || cls == THREAD_CLIENT)
+                name += std::to_string(index);
+            if(pthread_setname_np(thread, name.substr(0, 15).c_str()) != 0)
+                res = false;
+        }
+
+        //Affinity
+        const std::vector<int>& cpus = m_cpus[cls];
+        if(cpus.size() > 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if(m_spread[cls])
+                CPU_SET(cpus[index % cpus.size()], &set);
+            else
+                for(int cpu : cpus)
+                    CPU_SET(cpu, &set);
+
+            if(pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+            {
+                WARNING << "Could not set the CPU affinity of the thread " << m_names[cls] << index << "\n";
+                res = false;
+            }
+        }
+
+        return res;
+    }
+}
@@ -0,0 +1,196 @@
+#include "TrafficCapture.h"
+#include "utils.h"
+
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sereno
+{
+    /* \brief The file header of each segment */
+    static const char     CAPTURE_MAGIC[8]    = {'S', 'R', 'N', 'C', 'A', 'P', '0', '1'};
+    static const uint64_t CAPTURE_HEADER_SIZE = sizeof(CAPTURE_MAGIC);
+
+    /* \brief Get the path of a segment
+     * \param directory the capture directory
+     * \param id the segment ID
+     * \return the segment file path */
+    static std::string segmentPath(const std::string& directory, uint32_t id)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/capture-%05u.log", id);
+        return directory + name;
+    }
+
+    /* \brief Align a size on 8 bytes */
+    static uint64_t align8(uint64_t size)
+    {
+        return (size + 7) & ~(uint64_t)7;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*--------------------------------TrafficCapture------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    TrafficCapture::TrafficCapture(const std::string& directory, uint64_t segmentSize) : m_directory(directory), m_segmentSize(segmentSize)
+    {}
+
+    TrafficCapture::~TrafficCapture()
+    {
+        close();
+    }
+
+    bool TrafficCapture::append(CaptureRecordType type, uint32_t clientID, const uint8_t* data, uint32_t size)
+    {
+        if(m_failed)
+            return false;
+
+        //Keep room for the end marker
+        uint64_t recordSize = align8(sizeof(CaptureRecordHeader) + size);
+        if(m_memory == NULL || m_offset + recordSize + sizeof(CaptureRecordHeader) > m_mappedSize)
+        {
+            close();
+            if(!openSegment(CAPTURE_HEADER_SIZE + recordSize + sizeof(CaptureRecordHeader)))
+            {
+                m_failed = true;
+                return false;
+            }
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        CaptureRecordHeader* header = (CaptureRecordHeader*)(m_memory + m_offset);
+        header->timestamp = (uint64_t)now.tv_sec*1000000000 + now.tv_nsec;
+        header->clientID  = clientID;
+        header->size      = size;
+        header->type      = type;
+        header->reserved  = 0;
+        if(size > 0)
+            memcpy(m_memory + m_offset + sizeof(CaptureRecordHeader), data, size);
+        m_offset += recordSize;
+        return true;
+    }
+
+    void TrafficCapture::close()
+    {
+        if(m_memory == NULL)
+            return;
+
+        //The end marker (zeroed by ftruncate) is kept after the last record
+        munmap(m_memory, m_mappedSize);
+        if(ftruncate(m_fd, m_offset + sizeof(CaptureRecordHeader)) != 0)
+            WARNING << "Could not truncate the capture segment\n";
+        ::close(m_fd);
+        m_memory = NULL;
+        m_fd     = -1;
+    }
+
+    bool TrafficCapture::openSegment(uint64_t minSize)
+    {
+        m_mappedSize = std::max(m_segmentSize, minSize);
+        std::string path = segmentPath(m_directory, m_segmentID++);
+        m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(m_fd == -1 || ftruncate(m_fd, m_mappedSize) != 0)
+        {
+            ERROR << "Could not create the capture segment " << path << "\n";
+            if(m_fd != -1)
+                ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+
+        m_memory = (uint8_t*)mmap(NULL, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(m_memory == MAP_FAILED)
+        {
+            ERROR << "Could not map the capture segment " << path << "\n";
+            m_memory = NULL;
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+
+        memcpy(m_memory, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        m_offset = CAPTURE_HEADER_SIZE;
+        return true;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*-----------------------------TrafficCaptureReader---------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    TrafficCaptureReader::TrafficCaptureReader(const std::string& directory) : m_directory(directory)
+    {}
+
+    TrafficCaptureReader::~TrafficCaptureReader()
+    {
+        closeSegment();
+    }
+
+    bool TrafficCaptureReader::next(CaptureRecord& record)
+    {
+        while(true)
+        {
+            if(m_memory == NULL && !openSegment())
+                return false;
+
+            if(m_offset + sizeof(CaptureRecordHeader) <= m_mappedSize)
+            {
+                const CaptureRecordHeader* header = (const CaptureRecordHeader*)(m_memory + m_offset);
+                if(header->type != CAPTURE_END && m_offset + sizeof(CaptureRecordHeader) + header->size <= m_mappedSize)
+                {
+                    record.timestamp = header->timestamp;
+                    record.clientID  = header->clientID;
+                    record.type      = header->type;
+                    record.size      = header->size;
+                    record.data      = m_memory + m_offset + sizeof(CaptureRecordHeader);
+                    m_offset += align8(sizeof(CaptureRecordHeader) + header->size);
+                    return true;
+                }
+            }
+
+            //End of this segment
+            closeSegment();
+        }
+    }
+
+    bool TrafficCaptureReader::openSegment()
+    {
+        std::string path = segmentPath(m_directory, m_segmentID);
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+            return false;
+        m_segmentID++;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < CAPTURE_HEADER_SIZE)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        m_mappedSize = st.st_size;
+        m_memory     = (uint8_t*)mmap(NULL, m_mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(m_memory == MAP_FAILED || memcmp(m_memory, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+        {
+            ERROR << "Invalid capture segment " << path << "\n";
+            if(m_memory != MAP_FAILED)
+                munmap(m_memory, m_mappedSize);
+            m_memory = NULL;
+            return false;
+        }
+
+        m_offset = CAPTURE_HEADER_SIZE;
+        return true;
+    }
+
+    void TrafficCaptureReader::closeSegment()
+    {
+        if(m_memory)
+            munmap(m_memory, m_mappedSize);
+        m_memory = NULL;
+    }
+}
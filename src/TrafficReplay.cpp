@@ -0,0 +1,119 @@
+#include "TrafficReplay.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+
+namespace sereno
+{
+    TrafficReplay::TrafficReplay(const std::string& directory, double speed) : m_directory(directory), m_speed(speed)
+    {}
+
+    bool TrafficReplay::toAddress(const SOCKADDR* addr, socklen_t addrLen)
+    {
+        return run([addr, addrLen](int& peer, SOCKET& serverSock)
+        {
+            peer = socket(addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if(peer == SOCKET_ERROR || connect(peer, addr, addrLen) == SOCKET_ERROR)
+            {
+                ERROR << "Could not connect to the Server to replay the capture\n";
+                if(peer != SOCKET_ERROR)
+                    ::close(peer);
+                return false;
+            }
+            return true;
+        },
+        [](int peer, SOCKET serverSock, const uint8_t* data, uint32_t size)
+        {
+            while(size > 0)
+            {
+                //The Server may close a replayed client (rate limit, framing error) : no SIGPIPE
+                ssize_t written = send(peer, data, size, MSG_NOSIGNAL);
+                if(written <= 0)
+                    return false;
+                data += written;
+                size -= written;
+            }
+            return true;
+        });
+    }
+
+    void TrafficReplay::pace(uint64_t start, uint64_t offset)
+    {
+        if(m_speed <= 0.0)
+            return;
+
+        uint64_t target  = start + (uint64_t)(offset / m_speed);
+        uint64_t current = now();
+        if(target > current)
+        {
+            struct timespec delay;
+            delay.tv_sec  = (target-current) / 1000000000;
+            delay.tv_nsec = (target-current) % 1000000000;
+            nanosleep(&delay, NULL);
+        }
+    }
+
+    uint64_t TrafficReplay::now()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+    }
+
+    void TrafficReplay::startDrain()
+    {
+        m_closeDrain  = false;
+        m_drainThread = std::thread([this]
+        {
+            uint8_t buf[16384];
+            while(!m_closeDrain)
+            {
+                std::vector<struct pollfd> drainPoll;
+                m_peerMutex.lock();
+                    for(int peer : m_peers)
+                        drainPoll.push_back({.fd = peer, .events = POLLIN});
+                m_peerMutex.unlock();
+
+                if(drainPoll.size() == 0)
+                {
+                    usleep(100);
+                    continue;
+                }
+
+                //Peers closed meanwhile make poll return POLLNVAL, which we ignore
+                if(poll(drainPoll.data(), drainPoll.size(), 10) <= 0)
+                    continue;
+                m_peerMutex.lock();
+                    for(auto& pfd : drainPoll)
+                        if((pfd.revents & POLLIN) && std::find(m_peers.begin(), m_peers.end(), pfd.fd) != m_peers.end())
+                            recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT);
+                m_peerMutex.unlock();
+            }
+        });
+    }
+
+    void TrafficReplay::stopDrain()
+    {
+        m_closeDrain = true;
+        if(m_drainThread.joinable())
+            m_drainThread.join();
+    }
+
+    void TrafficReplay::addPeer(int peer)
+    {
+        m_peerMutex.lock();
+            m_peers.push_back(peer);
+        m_peerMutex.unlock();
+    }
+
+    void TrafficReplay::removePeer(int peer)
+    {
+        m_peerMutex.lock();
+            m_peers.erase(std::remove(m_peers.begin(), m_peers.end(), peer), m_peers.end());
+            ::close(peer);
+        m_peerMutex.unlock();
+    }
+}
@@ -0,0 +1,105 @@
+#include "Transport.h"
+
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+namespace sereno
+{
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------SocketTransport------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    SocketTransport* SocketTransport::get()
+    {
+        static SocketTransport transport;
+        return &transport;
+    }
+
+    ssize_t SocketTransport::send(SOCKET sock, const uint8_t* data, uint32_t size)
+    {
+        //A peer which has gone away must not kill the process : no SIGPIPE
+        ssize_t written = ::send(sock, data, size, MSG_NOSIGNAL);
+        //Not a socket (e.g., a pipe)
+        if(written < 0 && errno == ENOTSOCK)
+            written = ::write(sock, data, size);
+        return written;
+    }
+
+    ssize_t SocketTransport::receive(SOCKET sock, uint8_t* data, uint32_t size)
+    {
+        return ::read(sock, data, size);
+    }
+
+    int32_t SocketTransport::available(SOCKET sock)
+    {
+        int count = 0;
+        if(ioctl(sock, FIONREAD, &count) == SOCKET_ERROR)
+            return -1;
+        return count;
+    }
+
+    void SocketTransport::shutdown(SOCKET sock)
+    {
+        ::shutdown(sock, SHUT_RDWR);
+    }
+
+    void SocketTransport::close(SOCKET sock)
+    {
+        ::close(sock);
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*-------------------------------MemoryTransport------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    MemoryTransport::MemoryTransport(Receiver receiver) : m_receiver(receiver)
+    {}
+
+    SOCKET MemoryTransport::open()
+    {
+        return m_nextID.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    MemoryTransportStats MemoryTransport::getStats() const
+    {
+        MemoryTransportStats stats;
+        stats.nbOpened = m_nextID - MEMORY_SOCKET_BASE;
+        stats.nbClosed = m_nbClosed;
+        stats.nbWrites = m_nbWrites;
+        stats.nbBytes  = m_nbBytes;
+        return stats;
+    }
+
+    ssize_t MemoryTransport::send(SOCKET sock, const uint8_t* data, uint32_t size)
+    {
+        m_nbWrites.fetch_add(1, std::memory_order_relaxed);
+        m_nbBytes.fetch_add(size, std::memory_order_relaxed);
+        if(m_receiver)
+            m_receiver(sock, data, size);
+        return size;
+    }
+
+    ssize_t MemoryTransport::receive(SOCKET sock, uint8_t* data, uint32_t size)
+    {
+        //The data are injected in the Server, never read
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int32_t MemoryTransport::available(SOCKET sock)
+    {
+        return 0;
+    }
+
+    void MemoryTransport::shutdown(SOCKET sock)
+    {
+        if(m_receiver)
+            m_receiver(sock, NULL, 0);
+    }
+
+    void MemoryTransport::close(SOCKET sock)
+    {
+        m_nbClosed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
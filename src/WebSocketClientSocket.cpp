@@ -0,0 +1,605 @@
+#include "WebSocketClientSocket.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERENO_WS_X86
+#endif
+
+namespace sereno
+{
+    /* \brief The GUID appended to the client key of the handshake (RFC 6455) */
+    static const char* WS_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    /* \brief The maximum size of the HTTP upgrade request */
+    static const uint32_t WS_MAX_HANDSHAKE_SIZE = 8192;
+
+    /* \brief The maximum payload size of a control frame */
+    static const uint32_t WS_MAX_CONTROL_SIZE = 125;
+
+    /*----------------------------------------------------------------------------*/
+    /*-----------------------------------Unmasking--------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief An unmasking kernel
+     * \param data the payload
+     * \param size the payload size
+     * \param mask the masking key rotated to the phase of data, as read from memory */
+    typedef void (*UnmaskKernel)(uint8_t* data, uint32_t size, uint32_t mask);
+
+    static void unmaskScalar(uint8_t* data, uint32_t size, uint32_t mask)
+    {
+        uint64_t mask64 = ((uint64_t)mask << 32) | mask;
+        uint32_t i      = 0;
+        for(; i+8 <= size; i+=8)
+        {
+            uint64_t v;
+            memcpy(&v, data+i, 8);
+            v ^= mask64;
+            memcpy(data+i, &v, 8);
+        }
+
+        const uint8_t* maskBytes = (const uint8_t*)&mask;
+        for(; i < size; i++)
+            data[i] ^= maskBytes[i & 3];
+    }
+
+#ifdef SERENO_WS_X86
+    __attribute__((target("sse2")))
+    static void unmaskSSE2(uint8_t* data, uint32_t size, uint32_t mask)
+    {
+        __m128i  mask128 = _mm_set1_epi32((int)mask);
+        uint32_t i       = 0;
+        for(; i+16 <= size; i+=16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data+i));
+            _mm_storeu_si128((__m128i*)(data+i), _mm_xor_si128(v, mask128));
+        }
+        unmaskScalar(data+i, size-i, mask);
+    }
+
+    __attribute__((target("avx2")))
+    static void unmaskAVX2(uint8_t* data, uint32_t size, uint32_t mask)
+    {
+        __m256i  mask256 = _mm256_set1_epi32((int)mask);
+        uint32_t i       = 0;
+        for(; i+32 <= size; i+=32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(data+i));
+            _mm256_storeu_si256((__m256i*)(data+i), _mm256_xor_si256(v, mask256));
+        }
+        unmaskSSE2(data+i, size-i, mask);
+    }
+#endif
+
+    /* \brief Get the best unmasking kernel of the CPU, chosen once
+     * \param name the kernel name, if not NULL */
+    static UnmaskKernel getUnmaskKernel(const char** name = NULL)
+    {
+        struct Selection
+        {
+            UnmaskKernel kernel = &unmaskScalar;
+            const char*  name   = "scalar";
+            Selection()
+            {
+#ifdef SERENO_WS_X86
+                __builtin_cpu_init();
+                if(__builtin_cpu_supports("avx2"))
+                {
+                    kernel = &unmaskAVX2;
+                    name   = "avx2";
+                }
+                else if(__builtin_cpu_supports("sse2"))
+                {
+                    kernel = &unmaskSSE2;
+                    name   = "sse2";
+                }
+#endif
+            }
+        };
+        static Selection selection;
+        if(name)
+            *name = selection.name;
+        return selection.kernel;
+    }
+
+    /* \brief Rotate the masking key to a payload offset
+     * \return the 4 mask bytes applying at offset phase, as read from memory */
+    static uint32_t rotateMask(const uint8_t* mask, uint32_t phase)
+    {
+        uint8_t rotated[4];
+        for(uint32_t i = 0; i < 4; i++)
+            rotated[i] = mask[(phase+i) & 3];
+        uint32_t m;
+        memcpy(&m, rotated, 4);
+        return m;
+    }
+
+    void webSocketUnmask(uint8_t* data, uint32_t size, const uint8_t* mask, uint32_t phase)
+    {
+        static UnmaskKernel kernel = getUnmaskKernel();
+        kernel(data, size, rotateMask(mask, phase));
+    }
+
+    void webSocketUnmaskScalar(uint8_t* data, uint32_t size, const uint8_t* mask, uint32_t phase)
+    {
+        unmaskScalar(data, size, rotateMask(mask, phase));
+    }
+
+    const char* webSocketUnmaskKernel()
+    {
+        const char* name;
+        getUnmaskKernel(&name);
+        return name;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*-----------------------------------Handshake--------------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    /* \brief Compute the SHA-1 digest of a string (for Sec-WebSocket-Accept only)
+     * \param input the string
+     * \param digest the 20 bytes digest */
+    static void sha1(const std::string& input, uint8_t digest[20])
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        std::string msg = input;
+        uint64_t    bitLength = (uint64_t)input.size()*8;
+        msg += (char)0x80;
+        while(msg.size() % 64 != 56)
+            msg += (char)0x00;
+        for(int i = 7; i >= 0; i--)
+            msg += (char)((bitLength >> (i*8)) & 0xFF);
+
+        auto rotl = [](uint32_t v, uint32_t n) {return (v << n) | (v >> (32-n));};
+        for(size_t block = 0; block < msg.size(); block += 64)
+        {
+            uint32_t w[80];
+            for(int i = 0; i < 16; i++)
+                w[i] = ((uint32_t)(uint8_t)msg[block+i*4] << 24) | ((uint32_t)(uint8_t)msg[block+i*4+1] << 16) |
+                       ((uint32_t)(uint8_t)msg[block+i*4+2] << 8) | (uint32_t)(uint8_t)msg[block+i*4+3];
+            for(int i = 16; i < 80; i++)
+                w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for(int i = 0; i < 80; i++)
+            {
+                uint32_t f, k;
+                if(i < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if(i < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if(i < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t t = rotl(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+
+        for(int i = 0; i < 5; i++)
+            for(int j = 0; j < 4; j++)
+                digest[i*4+j] = (h[i] >> (24-j*8)) & 0xFF;
+    }
+
+    /* \brief Encode bytes in base64
+     * \param data the bytes
+     * \param size the number of bytes
+     * \return the base64 string */
+    static std::string base64(const uint8_t* data, uint32_t size)
+    {
+        static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for(uint32_t i = 0; i < size; i += 3)
+        {
+            uint32_t v = (uint32_t)data[i] << 16;
+            if(i+1 < size) v |= (uint32_t)data[i+1] << 8;
+            if(i+2 < size) v |= data[i+2];
+            out += alphabet[(v >> 18) & 0x3F];
+            out += alphabet[(v >> 12) & 0x3F];
+            out += (i+1 < size ? alphabet[(v >> 6) & 0x3F] : '=');
+            out += (i+2 < size ? alphabet[v & 0x3F] : '=');
+        }
+        return out;
+    }
+
+    /* \brief Lowercase a string */
+    static std::string toLower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {return std::tolower(c);});
+        return s;
+    }
+
+    /* \brief Remove the leading and trailing spaces of a string */
+    static std::string trim(const std::string& s)
+    {
+        size_t begin = s.find_first_not_of(" \t");
+        size_t end   = s.find_last_not_of(" \t");
+        return begin == std::string::npos ? std::string() : s.substr(begin, end-begin+1);
+    }
+
+    /* \brief Write a frame header (server frames are not masked)
+     * \param header the header buffer (>= 10 bytes)
+     * \param opcode the frame opcode
+     * \param fin is it the last frame of its message?
+     * \param size the payload size
+     * \return the header size */
+    static uint32_t writeFrameHeader(uint8_t* header, uint8_t opcode, bool fin, uint32_t size)
+    {
+        header[0] = (fin ? 0x80 : 0x00) | (opcode & 0x0F);
+        if(size < 126)
+        {
+            header[1] = size;
+            return 2;
+        }
+        if(size <= 0xFFFF)
+        {
+            header[1] = 126;
+            header[2] = (size >> 8) & 0xFF;
+            header[3] = size & 0xFF;
+            return 4;
+        }
+        header[1] = 127;
+        for(int i = 0; i < 8; i++)
+            header[2+i] = ((uint64_t)size >> (56-i*8)) & 0xFF;
+        return 10;
+    }
+
+    /*----------------------------------------------------------------------------*/
+    /*----------------------------WebSocketClientSocket---------------------------*/
+    /*----------------------------------------------------------------------------*/
+
+    bool WebSocketClientSocket::sendMessage(std::shared_ptr<uint8_t> data, uint32_t size, uint8_t opcode, uint32_t fragmentSize, uint8_t priority)
+    {
+        return sendMessage(Buffer::wrap(std::move(data), size), opcode, fragmentSize, priority);
+    }
+
+    bool WebSocketClientSocket::sendMessage(Buffer data, uint8_t opcode, uint32_t fragmentSize, uint8_t priority)
+    {
+        if(m_state != WS_STATE_OPEN)
+            return false;
+
+        if(data.size() == 0)
+        {
+            pushFrame(opcode, NULL, 0, priority);
+            return true;
+        }
+
+        pushChunked(std::move(data), fragmentSize, [opcode](uint8_t* header, uint32_t offset, uint32_t chunkSize, uint32_t totalSize)
+        {
+            return writeFrameHeader(header, offset == 0 ? opcode : WS_CONTINUATION, offset+chunkSize == totalSize, chunkSize);
+        }, priority);
+        return true;
+    }
+
+    bool WebSocketClientSocket::sendPing(const uint8_t* data, uint32_t size)
+    {
+        if(m_state != WS_STATE_OPEN)
+            return false;
+        pushFrame(WS_PING, data, std::min(size, WS_MAX_CONTROL_SIZE));
+        return true;
+    }
+
+    bool WebSocketClientSocket::sendClose(uint16_t code, const std::string& reason)
+    {
+        State open = WS_STATE_OPEN;
+        if(!m_state.compare_exchange_strong(open, WS_STATE_CLOSING))
+            return false;
+
+        uint8_t payload[WS_MAX_CONTROL_SIZE];
+        payload[0]    = code >> 8;
+        payload[1]    = code & 0xFF;
+        uint32_t size = std::min<uint32_t>(reason.size(), WS_MAX_CONTROL_SIZE-2);
+        memcpy(payload+2, reason.data(), size);
+        pushFrame(WS_CLOSE, payload, size+2);
+        return true;
+    }
+
+    bool WebSocketClientSocket::nextMessage(uint8_t*& data, uint32_t& size, uint8_t*& msg, uint32_t& msgSize)
+    {
+        //The message returned by the last call is consumed
+        if(m_delivered)
+        {
+            m_message.clear();
+            m_delivered = false;
+        }
+
+        while(m_state != WS_STATE_CLOSED)
+        {
+            if(m_state == WS_STATE_HANDSHAKE)
+            {
+                if(size == 0)
+                    return false;
+                parseHandshake(data, size);
+                continue;
+            }
+
+            if(!m_inPayload && (size == 0 || !parseHeader(data, size)))
+                return false;
+
+            //Fast path : the whole payload of a single frame message is here, deliver it in place
+            bool isData = m_opcode < WS_CLOSE;
+            if(isData && m_fin && m_message.empty() && m_phase == 0 && m_remaining <= size)
+            {
+                msg     = data;
+                msgSize = (uint32_t)m_remaining;
+                webSocketUnmask(data, msgSize, m_mask);
+                data       += msgSize;
+                size       -= msgSize;
+                m_remaining = 0;
+                m_inPayload = false;
+                return true;
+            }
+
+            //Otherwise accumulate the payload
+            uint32_t received = (uint32_t)std::min<uint64_t>(size, m_remaining);
+            webSocketUnmask(data, received, m_mask, m_phase);
+            std::vector<uint8_t>& payload = (isData ? m_message : m_control);
+            payload.insert(payload.end(), data, data+received);
+            data        += received;
+            size        -= received;
+            m_remaining -= received;
+            m_phase     += received;
+            if(m_remaining > 0)
+                return false;
+
+            m_inPayload = false;
+            if(!isData)
+            {
+                handleControl();
+                m_control.clear();
+                continue;
+            }
+            if(!m_fin)
+                continue;
+
+            m_fragmented = false;
+            m_delivered  = true;
+            msg          = m_message.data();
+            msgSize      = m_message.size();
+            return true;
+        }
+        return false;
+    }
+
+    void WebSocketClientSocket::parseHandshake(uint8_t*& data, uint32_t& size)
+    {
+        size_t previous = m_request.size();
+        m_request.append((const char*)data, size);
+        size_t end = m_request.find("\r\n\r\n", previous >= 3 ? previous-3 : 0);
+        if(end == std::string::npos)
+        {
+            data += size;
+            size  = 0;
+            if(m_request.size() > WS_MAX_HANDSHAKE_SIZE)
+            {
+                WARNING_RATE_LIMITED(1000) << "WebSocket handshake too large\n";
+                pushResponse("HTTP/1.1 431 Request Header Fields Too Large\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+                m_state = WS_STATE_CLOSED;
+                shutdownAfterWrite();
+            }
+            return;
+        }
+
+        //Keep the bytes following the request : they are the first frames
+        uint32_t consumed = end + 4 - previous;
+        data += consumed;
+        size -= consumed;
+        std::string request = m_request.substr(0, end);
+        std::string().swap(m_request);
+
+        //Request line : GET <path> HTTP/1.1
+        size_t lineEnd = request.find("\r\n");
+        std::string requestLine = request.substr(0, lineEnd);
+        size_t pathBegin = requestLine.find(' ');
+        size_t pathEnd   = requestLine.rfind(' ');
+        bool   valid     = requestLine.compare(0, 4, "GET ") == 0 && pathEnd > pathBegin;
+        if(valid)
+            m_path = requestLine.substr(pathBegin+1, pathEnd-pathBegin-1);
+
+        //Headers
+        std::string key;
+        bool        upgrade = false;
+        std::string version;
+        while(lineEnd != std::string::npos)
+        {
+            size_t lineBegin = lineEnd+2;
+            lineEnd = request.find("\r\n", lineBegin);
+            std::string line = request.substr(lineBegin, lineEnd == std::string::npos ? std::string::npos : lineEnd-lineBegin);
+            size_t colon = line.find(':');
+            if(colon == std::string::npos)
+                continue;
+
+            std::string name  = toLower(trim(line.substr(0, colon)));
+            std::string value = trim(line.substr(colon+1));
+            if(name == "sec-websocket-key")
+                key = value;
+            else if(name == "upgrade")
+                upgrade = toLower(value).find("websocket") != std::string::npos;
+            else if(name == "sec-websocket-version")
+                version = value;
+        }
+
+        if(!valid || !upgrade || key.empty() || version != "13")
+        {
+            WARNING_RATE_LIMITED(1000) << "Invalid WebSocket handshake\n";
+            pushResponse("HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+            m_state = WS_STATE_CLOSED;
+            shutdownAfterWrite();
+            return;
+        }
+
+        uint8_t digest[20];
+        sha1(key + WS_GUID, digest);
+        pushResponse("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " +
+                     base64(digest, 20) + "\r\n\r\n");
+        m_state = WS_STATE_OPEN;
+    }
+
+    bool WebSocketClientSocket::parseHeader(uint8_t*& data, uint32_t& size)
+    {
+        auto headerSize = [](const uint8_t* h)
+        {
+            uint8_t length = h[1] & 0x7F;
+            return 2 + (length == 126 ? 2 : (length == 127 ? 8 : 0)) + ((h[1] & 0x80) ? 4 : 0);
+        };
+
+        //Read the header in place if complete, otherwise gather it in m_header
+        const uint8_t* header = NULL;
+        if(m_headerSize == 0 && size >= 2 && size >= (uint32_t)headerSize(data))
+        {
+            header = data;
+            uint32_t hSize = headerSize(data);
+            data += hSize;
+            size -= hSize;
+        }
+        else
+        {
+            uint32_t copied = std::min<uint32_t>(size, 2 - std::min<uint32_t>(m_headerSize, 2));
+            memcpy(m_header+m_headerSize, data, copied);
+            m_headerSize += copied;
+            data         += copied;
+            size         -= copied;
+            if(m_headerSize < 2)
+                return false;
+
+            uint32_t hSize = headerSize(m_header);
+            copied = std::min<uint32_t>(size, hSize - m_headerSize);
+            memcpy(m_header+m_headerSize, data, copied);
+            m_headerSize += copied;
+            data         += copied;
+            size         -= copied;
+            if(m_headerSize < hSize)
+                return false;
+            header       = m_header;
+            m_headerSize = 0;
+        }
+
+        bool     fin    = (header[0] & 0x80) != 0;
+        uint8_t  opcode = header[0] & 0x0F;
+        uint8_t  length = header[1] & 0x7F;
+        uint64_t payloadSize = length;
+        const uint8_t* ptr = header+2;
+        if(length == 126)
+        {
+            payloadSize = ((uint64_t)ptr[0] << 8) | ptr[1];
+            ptr += 2;
+        }
+        else if(length == 127)
+        {
+            payloadSize = 0;
+            for(int i = 0; i < 8; i++)
+                payloadSize = (payloadSize << 8) | ptr[i];
+            ptr += 8;
+        }
+
+        //Client frames have to be masked and do not use extensions
+        if((header[0] & 0x70) != 0 || (header[1] & 0x80) == 0)
+        {
+            fail(WS_CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        memcpy(m_mask, ptr, 4);
+
+        if(opcode >= WS_CLOSE)
+        {
+            if((opcode != WS_CLOSE && opcode != WS_PING && opcode != WS_PONG) || !fin || payloadSize > WS_MAX_CONTROL_SIZE)
+            {
+                fail(WS_CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+        }
+        else
+        {
+            if(opcode > WS_BINARY || (opcode == WS_CONTINUATION) != m_fragmented)
+            {
+                fail(WS_CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+            if(m_message.size() + payloadSize > maxMessageSize)
+            {
+                fail(WS_CLOSE_TOO_BIG);
+                return false;
+            }
+            if(opcode != WS_CONTINUATION)
+                m_messageOpcode = opcode;
+            m_fragmented = !fin;
+        }
+
+        m_opcode    = opcode;
+        m_fin       = fin;
+        m_remaining = payloadSize;
+        m_phase     = 0;
+        m_inPayload = true;
+        return true;
+    }
+
+    void WebSocketClientSocket::handleControl()
+    {
+        if(m_opcode == WS_PING)
+        {
+            if(m_state == WS_STATE_OPEN)
+                pushFrame(WS_PONG, m_control.data(), m_control.size());
+        }
+        else if(m_opcode == WS_CLOSE)
+        {
+            //Answer with the same status code, or end the closing handshake we started
+            State open = WS_STATE_OPEN;
+            if(m_state.compare_exchange_strong(open, WS_STATE_CLOSED))
+                pushFrame(WS_CLOSE, m_control.data(), std::min<uint32_t>(m_control.size(), 2));
+            m_state = WS_STATE_CLOSED;
+            shutdownAfterWrite();
+        }
+    }
+
+    void WebSocketClientSocket::pushFrame(uint8_t opcode, const uint8_t* data, uint32_t size, uint8_t priority)
+    {
+        UniqueBuffer frame = UniqueBuffer::allocate(size+10);
+        uint32_t headerSize = writeFrameHeader(frame.data(), opcode, true, size);
+        if(size > 0)
+            memcpy(frame.data()+headerSize, data, size);
+        frame.resize(headerSize+size);
+        pushPacket(frame.share(), priority);
+    }
+
+    void WebSocketClientSocket::pushResponse(const std::string& response)
+    {
+        UniqueBuffer buf = UniqueBuffer::allocate(response.size());
+        memcpy(buf.data(), response.data(), response.size());
+        pushPacket(buf.share(), PRIORITY_CONTROL);
+    }
+
+    void WebSocketClientSocket::fail(uint16_t code)
+    {
+        WARNING_RATE_LIMITED(1000) << "WebSocket protocol error, closing the connection (" << code << ")\n";
+        if(m_state.exchange(WS_STATE_CLOSED) == WS_STATE_OPEN)
+        {
+            uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)(code & 0xFF)};
+            pushFrame(WS_CLOSE, payload, 2);
+        }
+        shutdownAfterWrite();
+    }
+}
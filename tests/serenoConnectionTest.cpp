@@ -0,0 +1,212 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Server.h"
+#include "ClientConnection.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The test configuration, see printUsage */
+struct TestConfig
+{
+    uint32_t port        = 19100; /*!< The loopback port of the Server*/
+    uint32_t connections = 4;     /*!< The connections of the pool*/
+    uint32_t requests    = 1000;  /*!< The requests pipelined on each connection*/
+};
+
+/* \brief The echo Server : answers each request with its payload, and each message with correlation ID 0 by a pushed message */
+class EchoServer : public Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>
+{
+    public:
+        EchoServer(uint32_t port) : Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>(2, port)
+        {}
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            if(size < sizeof(uint32_t))
+                return;
+            uint32_t correlationID;
+            memcpy(&correlationID, data, sizeof(uint32_t));
+
+            //A message : push another one, with an ID no request waits for
+            if(correlationID == 0)
+                correlationID = 0xffffffff;
+
+            client->pushPacket(ClientConnection::buildFrame(correlationID, data + sizeof(uint32_t), size - sizeof(uint32_t)));
+        }
+};
+
+/* \brief Wait for a condition
+ * \param condition the condition to wait for
+ * \param timeoutMS the timeout in milliseconds
+ * \return true if the condition became true, false on timeout */
+template <typename F>
+static bool waitFor(F&& condition, uint32_t timeoutMS = 10000)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while(!condition())
+    {
+        if(std::chrono::steady_clock::now() > end)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/* \brief Check a condition, report it on failure
+ * \param condition the condition
+ * \param what the checked property
+ * \return condition */
+static bool check(bool condition, const char* what)
+{
+    if(!condition)
+        ERROR << "Check failed : " << what << "\n";
+    return condition;
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --port=P         loopback port of the Server (19100)\n"
+          << "  --connections=N  connections of the pool, at least 2 (4)\n"
+          << "  --requests=N     requests pipelined on each connection (1000)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, TestConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "port")             config.port        = value;
+        else if(key == "connections") config.connections = std::max(2.0, value);
+        else if(key == "requests")    config.requests    = std::max(1.0, value);
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief ClientConnection / ConnectionPool loopback test. Pipelines requests with distinct payloads on several connections to an
+ * echo Server<ClientSocket> (LengthPrefixFraming) and checks that every response matches its request, the responses larger than a
+ * receive block included. Then checks the pushed messages, and that a closed connection refuses the requests and leaves the pool.
+ * Usage : serenoConnectionTest [--option=value ...], see printUsage. Exit status 0 on success */
+int main(int argc, char** argv)
+{
+    TestConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    EchoServer server(config.port);
+    if(!server.launch())
+    {
+        ERROR << "Could not launch the Server on the port " << config.port << "\n";
+        return EXIT_FAILURE;
+    }
+
+    ConnectionPool pool;
+    if(!pool.launch())
+    {
+        server.closeServer();
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(config.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    bool success = true;
+    std::vector<std::shared_ptr<ClientConnection>> connections;
+    for(uint32_t i = 0; i < config.connections; i++)
+    {
+        std::shared_ptr<ClientConnection> connection = pool.connect((SOCKADDR*)&addr, sizeof(addr));
+        if(!check(connection != NULL, "connect"))
+        {
+            pool.close();
+            server.closeServer();
+            return EXIT_FAILURE;
+        }
+        connections.push_back(connection);
+    }
+
+    //Pipelined requests, sent before the connections are even established : each response has to match its own request
+    std::atomic<uint32_t> nbMatched{0};
+    std::atomic<uint32_t> nbFailed{0};
+    for(uint32_t r = 0; r < config.requests; r++)
+    {
+        for(uint32_t c = 0; c < connections.size(); c++)
+        {
+            std::string payload = "request " + std::to_string(c) + "/" + std::to_string(r) + std::string(r % 97, 'x');
+            connections[c]->request((const uint8_t*)payload.data(), payload.size(),
+                                    [payload, &nbMatched, &nbFailed](bool ok, const uint8_t* data, uint32_t size)
+                                    {
+                                        if(ok && size == payload.size() && memcmp(data, payload.data(), size) == 0)
+                                            nbMatched++;
+                                        else
+                                            nbFailed++;
+                                    });
+        }
+    }
+    uint32_t expected = config.requests*connections.size();
+    success &= check(waitFor([&] {return nbMatched + nbFailed == expected;}), "every request gets a response");
+    success &= check(nbMatched == expected && nbFailed == 0, "every response matches its request");
+    for(auto& connection : connections)
+        success &= check(connection->getNbPending() == 0, "no request left pending");
+
+    //Responses larger than a block of the receive pool, between small ones : the receive buffer grows, then goes back to the pool
+    std::atomic<uint32_t> nbLarge{0};
+    for(uint32_t r = 0; r < 8; r++)
+    {
+        std::string payload = (r % 2 == 0) ? std::string(200000 + r, (char)('a'+r)) : "small " + std::to_string(r);
+        connections[0]->request((const uint8_t*)payload.data(), payload.size(),
+                                [payload, &nbLarge](bool ok, const uint8_t* data, uint32_t size)
+                                {
+                                    if(ok && size == payload.size() && memcmp(data, payload.data(), size) == 0)
+                                        nbLarge++;
+                                });
+    }
+    success &= check(waitFor([&] {return nbLarge == 8;}), "the responses larger than a receive block match their requests");
+
+    //Messages not answering a request
+    std::atomic<uint32_t> nbMessages{0};
+    connections[0]->setMessageCallback([&nbMessages](uint32_t correlationID, const uint8_t* data, uint32_t size)
+                                       {
+                                           if(correlationID == 0xffffffff && size == 5 && memcmp(data, "event", 5) == 0)
+                                               nbMessages++;
+                                       });
+    for(uint32_t i = 0; i < 10; i++)
+        success &= check(connections[0]->send(0, (const uint8_t*)"event", 5), "send");
+    success &= check(waitFor([&] {return nbMessages == 10;}), "the pushed messages reach the message callback");
+
+    //A closed connection refuses the requests
+    connections[1]->close();
+    success &= check(connections[1]->request((const uint8_t*)"late", 4, [](bool ok, const uint8_t* data, uint32_t size) {}) == 0,
+                     "a closed connection refuses the requests");
+    success &= check(waitFor([&] {return pool.getNbConnections() == connections.size()-1;}), "the pool drops the closed connection");
+
+    pool.close();
+    server.closeServer();
+
+    printf("%s : %u/%u responses matched, %u pushed messages\n", (success ? "ok" : "FAILED"), nbMatched.load(), expected, nbMessages.load());
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,435 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "Server.h"
+#include "Compression.h"
+#include "MessageRouter.h"
+#include "ScratchArena.h"
+#include "Transport.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief Wait for a condition
+ * \param condition the condition to wait for
+ * \param timeoutMS the timeout in milliseconds
+ * \return true if the condition became true, false on timeout */
+template <typename F>
+static bool waitFor(F&& condition, uint32_t timeoutMS = 10000)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while(!condition())
+    {
+        if(std::chrono::steady_clock::now() > end)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/* \brief Check a condition, report it on failure
+ * \param condition the condition
+ * \param what the checked property
+ * \return condition */
+static bool check(bool condition, const char* what)
+{
+    if(!condition)
+        ERROR << "Check failed : " << what << "\n";
+    return condition;
+}
+
+/* \brief Build a LengthPrefixFraming message
+ * \param payload the message payload
+ * \return [size][payload] */
+static std::vector<uint8_t> lengthPrefixed(const std::vector<uint8_t>& payload)
+{
+    uint32_t             size = payload.size();
+    std::vector<uint8_t> frame(sizeof(uint32_t) + size);
+    memcpy(frame.data(), &size, sizeof(uint32_t));
+    if(size > 0)
+        memcpy(frame.data() + sizeof(uint32_t), payload.data(), size);
+    return frame;
+}
+
+/* \brief Inject bytes on a MemoryTransport connection */
+template <typename S>
+static bool inject(MemoryTransport& transport, S& server, SOCKET sock, const std::vector<uint8_t>& data)
+{
+    return transport.inject(server, sock, data.data(), data.size());
+}
+
+/* \brief Receive the messages of a StreamingLengthPrefixFraming through StaticDispatch (no virtual call) */
+class StreamingServer : public Server<ClientSocket, FramingIs<StreamingLengthPrefixFraming<1024>>, DispatchIs<StaticDispatch<StreamingServer>>>
+{
+    friend struct StaticDispatch<StreamingServer>;
+    public:
+        StreamingServer() : Server<ClientSocket, FramingIs<StreamingLengthPrefixFraming<1024>>, DispatchIs<StaticDispatch<StreamingServer>>>(1, 0)
+        {}
+
+        std::atomic<uint32_t> nbMessages{0};   /*!< The whole messages received*/
+        std::atomic<uint64_t> messageBytes{0}; /*!< The bytes of the whole messages*/
+        std::atomic<uint32_t> nbBegins{0};     /*!< The streamed messages started*/
+        std::atomic<uint32_t> nbEnds{0};       /*!< The streamed messages ended*/
+        std::atomic<uint64_t> chunkBytes{0};   /*!< The bytes of the streamed messages*/
+        std::atomic<uint64_t> chunkSum{0};     /*!< The sum of the streamed bytes*/
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            messageBytes += size;
+            nbMessages++;
+        }
+
+        void onFrameBegin(uint32_t bufID, ClientSocket* client, uint32_t size) {nbBegins++;}
+
+        void onFrameChunk(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            uint64_t sum = 0;
+            for(uint32_t i = 0; i < size; i++)
+                sum += data[i];
+            chunkSum   += sum;
+            chunkBytes += size;
+        }
+
+        void onFrameEnd(uint32_t bufID, ClientSocket* client) {nbEnds++;}
+};
+
+/* \brief Collect the records of a DelimiterFraming */
+class DelimiterServer : public Server<ClientSocket, FramingIs<DelimiterFraming<'\n', 64>>>
+{
+    public:
+        DelimiterServer() : Server<ClientSocket, FramingIs<DelimiterFraming<'\n', 64>>>(1, 0)
+        {}
+
+        std::vector<std::string> getRecords()
+        {
+            std::lock_guard<std::mutex> lock(m_recordMutex);
+            return m_records;
+        }
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            std::lock_guard<std::mutex> lock(m_recordMutex);
+            m_records.push_back(std::string((const char*)data, size));
+        }
+    private:
+        std::mutex               m_recordMutex; /*!< Protects m_records*/
+        std::vector<std::string> m_records;     /*!< The records received*/
+};
+
+/* \brief Collect the messages of a CompressedFraming<LengthPrefixFraming<>> */
+class CompressedServer : public Server<ClientSocket, FramingIs<CompressedFraming<LengthPrefixFraming<>>>>
+{
+    public:
+        CompressedServer() : Server<ClientSocket, FramingIs<CompressedFraming<LengthPrefixFraming<>>>>(1, 0)
+        {}
+
+        std::vector<std::vector<uint8_t>> getMessages()
+        {
+            std::lock_guard<std::mutex> lock(m_messageMutex);
+            return m_messages;
+        }
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            std::lock_guard<std::mutex> lock(m_messageMutex);
+            m_messages.push_back(std::vector<uint8_t>(data, data+size));
+        }
+    private:
+        std::mutex                        m_messageMutex; /*!< Protects m_messages*/
+        std::vector<std::vector<uint8_t>> m_messages;     /*!< The messages received, decompressed*/
+};
+
+/* \brief The messages of the routed protocol */
+struct __attribute__((packed)) PingMsg
+{
+    static const uint8_t TYPE_ID = 1;
+    uint32_t             value;
+};
+
+struct __attribute__((packed)) MoveMsg
+{
+    static const uint8_t TYPE_ID = 4;
+    uint8_t              entity;
+    float                x, y;
+};
+SERENO_MESSAGE_FIELD_AT(MoveMsg, x, 1);
+
+/* \brief Route the messages of a LengthPrefixFraming to typed handlers */
+class RouterServer : public Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>
+{
+    public:
+        RouterServer() : Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>(1, 0)
+        {
+            m_router.on<PingMsg>([this](ClientSocket* client, const MessageView<PingMsg>& msg)
+            {
+                pingSum += msg->value;
+                pingTail += msg.tailSize;
+            });
+            m_router.on<MoveMsg>([this](ClientSocket* client, const MessageView<MoveMsg>& msg)
+            {
+                if(msg->entity == 7 && msg->x == 1.5f && msg->y == -2.0f)
+                    nbMoves++;
+            });
+        }
+
+        std::atomic<uint32_t> pingSum{0};     /*!< The sum of the PingMsg values*/
+        std::atomic<uint32_t> pingTail{0};    /*!< The tail bytes of the PingMsg*/
+        std::atomic<uint32_t> nbMoves{0};     /*!< The MoveMsg received with the expected fields*/
+        std::atomic<uint32_t> nbRejected{0};  /*!< The messages the router did not dispatch*/
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            if(!m_router.dispatch(client, data, size))
+                nbRejected++;
+        }
+    private:
+        MessageRouter<ClientSocket, uint8_t, PingMsg, MoveMsg> m_router; /*!< The dispatch table*/
+};
+
+/* \brief Answer each message with its bytes reversed, built in the scratch arena of the handler and sent without copy */
+class ScratchServer : public Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>
+{
+    public:
+        ScratchServer() : Server<ClientSocket, FramingIs<LengthPrefixFraming<>>>(1, 0)
+        {}
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            ScratchArena&          arena = getScratchArena(bufID);
+            ScratchVector<uint8_t> reply(arena);
+            reply.reserve(size);
+            for(uint32_t i = size; i > 0; i--)
+                reply.push_back(data[i-1]);
+            client->pushPacket(arena.promote(reply.data(), reply.size()));
+        }
+};
+
+/* \brief StaticDispatch and StreamingLengthPrefixFraming : small messages are whole, large ones are streamed, headers may be split */
+static bool testStreaming()
+{
+    MemoryTransport transport;
+    StreamingServer server;
+    if(!check(server.launch(), "the streaming Server launches"))
+        return false;
+    ClientSocket* client = transport.connect(server);
+    if(!check(client != NULL, "the streaming Server adopts a connection"))
+    {
+        server.closeServer();
+        return false;
+    }
+
+    std::vector<uint8_t> small = lengthPrefixed(std::vector<uint8_t>(100, 1));
+    std::vector<uint8_t> large = lengthPrefixed(std::vector<uint8_t>(5000, 3));
+    std::vector<uint8_t> split = lengthPrefixed(std::vector<uint8_t>(10, 2));
+
+    bool success = inject(transport, server, client->socket, small);
+    success &= inject(transport, server, client->socket, std::vector<uint8_t>(large.begin(), large.begin()+2));
+    success &= inject(transport, server, client->socket, std::vector<uint8_t>(large.begin()+2, large.begin()+3000));
+    success &= inject(transport, server, client->socket, std::vector<uint8_t>(large.begin()+3000, large.end()));
+    success &= inject(transport, server, client->socket, std::vector<uint8_t>(split.begin(), split.begin()+3));
+    success &= inject(transport, server, client->socket, std::vector<uint8_t>(split.begin()+3, split.end()));
+    success  = check(success, "the streaming Server accepts the injected data");
+
+    success &= check(waitFor([&] {return server.nbMessages == 2 && server.nbEnds == 1;}), "two whole messages and one streamed message");
+    success &= check(server.messageBytes == 110, "the whole messages have their size");
+    success &= check(server.nbBegins == 1 && server.chunkBytes == 5000 && server.chunkSum == 5000*3,
+                     "the streamed message is delivered once, every byte of it");
+    server.closeServer();
+    return success;
+}
+
+/* \brief DelimiterFraming : records split between reads are gathered, too long records close the client */
+static bool testDelimiter()
+{
+    MemoryTransport transport;
+    DelimiterServer server;
+    if(!check(server.launch(), "the delimiter Server launches"))
+        return false;
+    ClientSocket* client = transport.connect(server);
+    ClientSocket* flood  = transport.connect(server);
+    if(!check(client != NULL && flood != NULL, "the delimiter Server adopts two connections"))
+    {
+        server.closeServer();
+        return false;
+    }
+
+    const char* first  = "ab\ncd";
+    const char* second = "ef\n\n";
+    bool success = transport.inject(server, client->socket, (const uint8_t*)first, strlen(first));
+    success &= transport.inject(server, client->socket, (const uint8_t*)second, strlen(second));
+    success  = check(success, "the delimiter Server accepts the injected data");
+
+    success &= check(waitFor([&] {return server.getRecords().size() == 3;}), "three records");
+    std::vector<std::string> records = server.getRecords();
+    success &= check(records.size() == 3 && records[0] == "ab" && records[1] == "cdef" && records[2] == "",
+                     "the records are delivered in order, without their delimiter");
+
+    std::vector<uint8_t> tooLong(100, 'x');
+    inject(transport, server, flood->socket, tooLong);
+    success &= check(waitFor([&] {return transport.getStats().nbClosed == 1;}), "a record longer than MaxRecordSize closes its client");
+    server.closeServer();
+    return success;
+}
+
+/* \brief CompressedFraming : messages pass through until compression is enabled, then are decompressed. A corrupted one closes the client */
+static bool testCompressed()
+{
+    MemoryTransport  transport;
+    CompressedServer server;
+    if(!check(server.launch(), "the compressed Server launches"))
+        return false;
+    ClientSocket* client = transport.connect(server);
+    if(!check(client != NULL, "the compressed Server adopts a connection"))
+    {
+        server.closeServer();
+        return false;
+    }
+
+    std::vector<uint8_t> plain = {'h', 'e', 'l', 'l', 'o'};
+    bool success = check(inject(transport, server, client->socket, lengthPrefixed(plain)), "the compressed Server accepts a plain message");
+    success &= check(waitFor([&] {return server.getMessages().size() == 1;}) && server.getMessages()[0] == plain,
+                     "messages are delivered as is while compression is not enabled");
+
+    if(!StreamCompressor::isAvailable())
+    {
+        INFO << "serenoServer is built without compression : the decompression checks are skipped\n";
+        server.closeServer();
+        return success;
+    }
+
+    //The peer side of the stream
+    StreamCompressor     peer;
+    std::vector<uint8_t> large(4000);
+    for(uint32_t i = 0; i < large.size(); i++)
+        large[i] = 'a' + i%7;
+    std::vector<uint8_t> small = {'s', 'm', 'a', 'l', 'l'};
+    UniqueBuffer         largeEncoded = peer.encode(large.data(), large.size());
+    UniqueBuffer         smallEncoded = peer.encode(small.data(), small.size());
+    success &= check(largeEncoded.size() < large.size(), "the peer compresses the large message");
+
+    success &= check(client->enableCompression(), "compression is enabled on the client");
+    success &= inject(transport, server, client->socket, lengthPrefixed(std::vector<uint8_t>(largeEncoded.data(), largeEncoded.data()+largeEncoded.size())));
+    success &= inject(transport, server, client->socket, lengthPrefixed(std::vector<uint8_t>(smallEncoded.data(), smallEncoded.data()+smallEncoded.size())));
+    success &= check(waitFor([&] {return server.getMessages().size() == 3;}), "the compressed messages are delivered");
+    std::vector<std::vector<uint8_t>> messages = server.getMessages();
+    success &= check(messages.size() == 3 && messages[1] == large && messages[2] == small, "the messages are decompressed");
+
+    std::vector<uint8_t> corrupted = {COMPRESSION_DEFLATE, 0xff, 0xff, 0xff, 0xff};
+    inject(transport, server, client->socket, lengthPrefixed(corrupted));
+    success &= check(waitFor([&] {return transport.getStats().nbClosed == 1;}), "a corrupted message closes its client");
+    success &= check(server.getMessages().size() == 3, "a corrupted message is not delivered");
+    server.closeServer();
+    return success;
+}
+
+/* \brief MessageRouter : messages reach the handler of their type, unknown types and truncated messages are rejected */
+static bool testRouter()
+{
+    MemoryTransport transport;
+    RouterServer    server;
+    if(!check(server.launch(), "the router Server launches"))
+        return false;
+    ClientSocket* client = transport.connect(server);
+    if(!check(client != NULL, "the router Server adopts a connection"))
+    {
+        server.closeServer();
+        return false;
+    }
+
+    std::vector<uint8_t> ping(1 + sizeof(PingMsg) + 3, 0);
+    PingMsg pingMsg;
+    pingMsg.value = 41;
+    ping[0] = PingMsg::TYPE_ID;
+    memcpy(ping.data()+1, &pingMsg, sizeof(PingMsg));
+
+    std::vector<uint8_t> move(1 + sizeof(MoveMsg));
+    MoveMsg moveMsg;
+    moveMsg.entity = 7;
+    moveMsg.x      = 1.5f;
+    moveMsg.y      = -2.0f;
+    move[0] = MoveMsg::TYPE_ID;
+    memcpy(move.data()+1, &moveMsg, sizeof(MoveMsg));
+
+    std::vector<uint8_t> unknown   = {2, 0, 0, 0, 0};
+    std::vector<uint8_t> outside   = {200};
+    std::vector<uint8_t> truncated = {MoveMsg::TYPE_ID, 7};
+
+    bool success = true;
+    for(const std::vector<uint8_t>* msg : {&ping, &move, &unknown, &outside, &truncated})
+        success &= inject(transport, server, client->socket, lengthPrefixed(*msg));
+    success  = check(success, "the router Server accepts the injected data");
+
+    success &= check(waitFor([&] {return server.nbRejected == 3;}), "unknown types and truncated messages are rejected");
+    success &= check(server.pingSum == 41 && server.pingTail == 3, "the PingMsg handler reads the message and its tail");
+    success &= check(server.nbMoves == 1, "the MoveMsg handler reads its fields in place");
+    server.closeServer();
+    return success;
+}
+
+/* \brief ScratchVector : a reply built in the scratch arena is promoted and written once the arena is reset */
+static bool testScratch()
+{
+    std::mutex           receivedMutex;
+    std::vector<uint8_t> received;
+    MemoryTransport transport([&](SOCKET sock, const uint8_t* data, uint32_t size)
+    {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        received.insert(received.end(), data, data+size);
+    });
+    auto getReceived = [&]()
+    {
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        return received;
+    };
+
+    ScratchServer server;
+    if(!check(server.launch(), "the scratch Server launches"))
+        return false;
+    ClientSocket* client = transport.connect(server);
+    if(!check(client != NULL, "the scratch Server adopts a connection"))
+    {
+        server.closeServer();
+        return false;
+    }
+
+    std::vector<uint8_t> first  = {1, 2, 3};
+    std::vector<uint8_t> second(200000);
+    for(uint32_t i = 0; i < second.size(); i++)
+        second[i] = i%251;
+
+    std::vector<uint8_t> both = lengthPrefixed(first);
+    std::vector<uint8_t> next = lengthPrefixed(second);
+    both.insert(both.end(), next.begin(), next.end());
+    bool success = check(inject(transport, server, client->socket, both), "the scratch Server accepts the injected data");
+
+    std::vector<uint8_t> expected(first.rbegin(), first.rend());
+    expected.insert(expected.end(), second.rbegin(), second.rend());
+    success &= check(waitFor([&] {return getReceived().size() >= expected.size();}), "the replies are written");
+    success &= check(getReceived() == expected, "the replies built in the scratch arena are intact");
+    success &= check(server.getScratchArena(0).getStats().nbPromotions == 2, "the replies are promoted, not copied");
+    server.closeServer();
+    return success;
+}
+
+/* \brief Server policies test over MemoryTransport. Instantiates and checks StaticDispatch, StreamingLengthPrefixFraming, DelimiterFraming,
+ * CompressedFraming, MessageRouter and ScratchVector (WebSocketFraming is instantiated by tools/serenoWebSocketBench).
+ * Usage : serenoPoliciesTest. Exit status 0 on success */
+int main(int argc, char** argv)
+{
+    bool success = true;
+    success &= testStreaming();
+    success &= testDelimiter();
+    success &= testCompressed();
+    success &= testRouter();
+    success &= testScratch();
+
+    if(success)
+        INFO << "Every policy check passed\n";
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,125 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "Server.h"
+#include "Transport.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief Wait for a condition
+ * \param condition the condition to wait for
+ * \param timeoutMS the timeout in milliseconds
+ * \return true if the condition became true, false on timeout */
+template <typename F>
+static bool waitFor(F&& condition, uint32_t timeoutMS = 10000)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
+    while(!condition())
+    {
+        if(std::chrono::steady_clock::now() > end)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/* \brief Check a condition, report it on failure
+ * \param condition the condition
+ * \param what the checked property
+ * \return condition */
+static bool check(bool condition, const char* what)
+{
+    if(!condition)
+        ERROR << "Check failed : " << what << "\n";
+    return condition;
+}
+
+/* \brief Subscribe the sender of each message to the topic "news". A message starting with 'w' waits for the test to open the gate first */
+class TopicServer : public Server<ClientSocket>
+{
+    public:
+        TopicServer() : Server<ClientSocket>(1, 0)
+        {}
+
+        std::atomic<bool>     gateOpen{true};   /*!< Can the waiting messages subscribe?*/
+        std::atomic<uint32_t> nbWaiting{0};     /*!< The messages waiting for the gate*/
+        std::atomic<uint32_t> nbSubscribed{0};  /*!< The successful subscriptions*/
+        std::atomic<uint32_t> nbRefused{0};     /*!< The refused subscriptions*/
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            if(size > 0 && data[0] == 'w')
+            {
+                nbWaiting++;
+                while(!gateOpen)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            if(subscribe("news", client))
+                nbSubscribed++;
+            else
+                nbRefused++;
+        }
+};
+
+/* \brief Topic test over MemoryTransport. Checks that publications reach the subscribers, and that a handler still running
+ * for a client closed meanwhile cannot subscribe it again (it would be published to once deleted).
+ * Usage : serenoTopicsTest. Exit status 0 on success */
+int main(int argc, char** argv)
+{
+    std::atomic<uint64_t> nbReceived{0};
+    MemoryTransport transport([&](SOCKET sock, const uint8_t* data, uint32_t size) {nbReceived += size;});
+
+    TopicServer server;
+    if(!server.launch())
+    {
+        ERROR << "Could not launch the Server\n";
+        return EXIT_FAILURE;
+    }
+
+    bool success = true;
+    ClientSocket* subscriber = transport.connect(server);
+    ClientSocket* closed     = transport.connect(server);
+    if(!check(subscriber != NULL && closed != NULL, "the Server adopts two connections"))
+    {
+        server.closeServer();
+        return EXIT_FAILURE;
+    }
+
+    //A registered client subscribes and gets the publications
+    const uint8_t hello[] = {'h'};
+    success &= check(transport.inject(server, subscriber->socket, hello, sizeof(hello)), "the Server accepts a message");
+    success &= check(waitFor([&] {return server.nbSubscribed == 1;}), "a registered client subscribes");
+    success &= check(!server.subscribe("news", subscriber), "a client cannot subscribe twice");
+
+    //Its handler is blocked while the client is closed, then tries to subscribe it
+    SOCKET        closedID = closed->socket;
+    const uint8_t wait[]   = {'w'};
+    server.gateOpen = false;
+    success &= check(transport.inject(server, closedID, wait, sizeof(wait)), "the Server accepts a blocking message");
+    success &= check(waitFor([&] {return server.nbWaiting == 1;}), "the handler waits");
+    success &= check(transport.disconnect(server, closedID), "the client is disconnected");
+    success &= check(waitFor([&] {return transport.getStats().nbClosed == 1;}), "the read thread closes the client");
+    server.gateOpen = true;
+    success &= check(waitFor([&] {return server.nbRefused == 1;}), "a closed client cannot subscribe");
+
+    //The closed client is deleted with its last message : only the subscriber gets the publication
+    UniqueBuffer payload = UniqueBuffer::allocate(16);
+    memset(payload.data(), 0, payload.size());
+    uint32_t nbPushed = server.publish("news", payload.share());
+    success &= check(nbPushed == 1, "the publication is pushed to the registered subscriber only");
+    success &= check(waitFor([&] {return nbReceived == 16;}), "the subscriber receives the publication");
+    success &= check(server.getTopic("news")->getSubscribers()->size() == 1, "the topic has one subscriber");
+
+    server.closeServer();
+    if(success)
+        INFO << "Every topic check passed\n";
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
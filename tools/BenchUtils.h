@@ -0,0 +1,199 @@
+#ifndef  BENCHUTILS_INC
+#define  BENCHUTILS_INC
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "Server.h"
+
+/* \brief Get a monotonic time
+ * \return the time in nanoseconds */
+inline uint64_t benchNow()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+/* \brief The latency distribution of a benchmark run, in nanoseconds */
+struct LatencyStats
+{
+    uint64_t count = 0; /*!< The samples*/
+    double   mean  = 0; /*!< The mean*/
+    uint64_t p50   = 0; /*!< The median*/
+    uint64_t p99   = 0; /*!< The 99th percentile*/
+    uint64_t p999  = 0; /*!< The 99.9th percentile*/
+    uint64_t max   = 0; /*!< The largest sample*/
+};
+
+/* \brief Compute the distribution of latency samples
+ * \param samples the samples. Sorted by this function
+ * \return the distribution */
+inline LatencyStats computeLatencies(std::vector<uint64_t>& samples)
+{
+    LatencyStats stats;
+    if(samples.empty())
+        return stats;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for(uint64_t sample : samples)
+        sum += sample;
+    stats.count = samples.size();
+    stats.mean  = sum / samples.size();
+    stats.p50   = samples[(samples.size()-1)*50/100];
+    stats.p99   = samples[(samples.size()-1)*99/100];
+    stats.p999  = samples[(samples.size()-1)*999/1000];
+    stats.max   = samples.back();
+    return stats;
+}
+
+/* \brief Write a whole buffer to a blocking descriptor
+ * \return true on success, false on error */
+inline bool writeAll(int fd, const uint8_t* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* \brief Read a whole buffer from a blocking descriptor
+ * \return true on success, false on error or end of stream */
+inline bool readAll(int fd, uint8_t* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t n = ::read(fd, data, size);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* \brief A Server echoing each LengthPrefixFraming message to its sender, the reference handler of the benchmarks */
+class BenchEchoServer : public sereno::Server<sereno::ClientSocket, sereno::FramingIs<sereno::LengthPrefixFraming<>>>
+{
+    public:
+        using sereno::Server<sereno::ClientSocket, sereno::FramingIs<sereno::LengthPrefixFraming<>>>::Server;
+    protected:
+        void onMessage(uint32_t bufID, sereno::ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            sereno::UniqueBuffer echo = sereno::UniqueBuffer::allocate(sizeof(uint32_t) + size);
+            memcpy(echo.data(), &size, sizeof(uint32_t));
+            memcpy(echo.data() + sizeof(uint32_t), data, size);
+            client->pushPacket(echo.share());
+        }
+};
+
+/* \brief The result of a ping-pong run */
+struct PingPongResult
+{
+    LatencyStats latency;               /*!< The round trip times*/
+    double       messagesPerSecond = 0; /*!< The echoed messages per second, every connection included*/
+    bool         valid = true;          /*!< Did every connection get its messages back, in order?*/
+};
+
+/* \brief Send LengthPrefixFraming messages ([size][sequence number][padding]) on several connections, one thread each,
+ * and wait for their echo. Each connection sends window messages at once then reads their echoes
+ * \param connect open a blocking connection, returns -1 on error
+ * \param connections the connections
+ * \param messages the messages per connection
+ * \param size the message size, without the size prefix (at least 8)
+ * \param window the messages in flight per connection. 1 measures the round trip time alone
+ * \return the round trip times and the throughput */
+inline PingPongResult runPingPong(const std::function<int()>& connect, uint32_t connections, uint32_t messages, uint32_t size,
+                                  uint32_t window = 1)
+{
+    size   = std::max<uint32_t>(size, sizeof(uint64_t));
+    window = std::max<uint32_t>(window, 1);
+
+    std::vector<std::vector<uint64_t>> samples(connections);
+    std::vector<int>                   fds(connections, -1);
+    std::vector<char>                  valid(connections, 1);
+    for(uint32_t c = 0; c < connections; c++)
+        fds[c] = connect();
+
+    uint64_t start = benchNow();
+    std::vector<std::thread> threads;
+    for(uint32_t c = 0; c < connections; c++)
+    {
+        threads.emplace_back([&, c]()
+        {
+            int fd = fds[c];
+            if(fd < 0)
+            {
+                valid[c] = 0;
+                return;
+            }
+
+            uint32_t             frameSize = sizeof(uint32_t) + size;
+            std::vector<uint8_t> out(window*frameSize, 0xab);
+            std::vector<uint8_t> in(window*frameSize);
+            std::vector<uint64_t> sendTimes(window);
+            samples[c].reserve(messages);
+
+            for(uint64_t seq = 0; seq < messages; seq += window)
+            {
+                uint32_t batch = std::min<uint64_t>(window, messages - seq);
+                for(uint32_t i = 0; i < batch; i++)
+                {
+                    uint64_t id = seq + i;
+                    memcpy(out.data() + i*frameSize, &size, sizeof(uint32_t));
+                    memcpy(out.data() + i*frameSize + sizeof(uint32_t), &id, sizeof(uint64_t));
+                }
+
+                uint64_t sendTime = benchNow();
+                if(!writeAll(fd, out.data(), batch*frameSize) || !readAll(fd, in.data(), batch*frameSize))
+                {
+                    valid[c] = 0;
+                    return;
+                }
+                uint64_t recvTime = benchNow();
+
+                for(uint32_t i = 0; i < batch; i++)
+                {
+                    uint64_t id;
+                    memcpy(&id, in.data() + i*frameSize + sizeof(uint32_t), sizeof(uint64_t));
+                    if(id != seq + i)
+                        valid[c] = 0;
+                    samples[c].push_back(recvTime - sendTime);
+                }
+            }
+        });
+    }
+    for(std::thread& t : threads)
+        t.join();
+    uint64_t duration = benchNow() - start;
+
+    PingPongResult        result;
+    std::vector<uint64_t> all;
+    for(uint32_t c = 0; c < connections; c++)
+    {
+        all.insert(all.end(), samples[c].begin(), samples[c].end());
+        result.valid &= (valid[c] != 0);
+        if(fds[c] >= 0)
+            ::close(fds[c]);
+    }
+    result.latency           = computeLatencies(all);
+    result.messagesPerSecond = all.size() / (duration / 1e9);
+    return result;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include "Compression.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The benchmark configuration, see printUsage */
+struct BenchConfig
+{
+    uint32_t messages  = 100000; /*!< The messages to compress*/
+    int      level     = 6;      /*!< The zlib level*/
+    uint32_t threshold = 128;    /*!< The raw threshold, in bytes*/
+    uint32_t entities  = 64;     /*!< The entities the state updates describe*/
+    uint32_t seed      = 42;     /*!< The seed of the generator*/
+};
+
+/* \brief The result of one run */
+struct BenchResult
+{
+    CompressionStats sender;   /*!< The counters of the compressing side*/
+    CompressionStats receiver; /*!< The counters of the decompressing side*/
+    bool             valid = true; /*!< Did every message decode to its original?*/
+};
+
+/* \brief Generate state updates of a simulation as JSON text : the same keys and slowly changing values, which is the traffic
+ * stream compression targets. A few messages are small acknowledgements, below the usual thresholds
+ * \param config the benchmark configuration
+ * \return the messages */
+static std::vector<std::string> generateMessages(const BenchConfig& config)
+{
+    std::mt19937                          rng(config.seed);
+    std::uniform_real_distribution<float> step(-0.05f, 0.05f);
+    std::vector<float>                    positions(3*config.entities, 0.0f);
+    std::vector<std::string>              messages;
+    messages.reserve(config.messages);
+
+    char field[256];
+    for(uint32_t i = 0; i < config.messages; i++)
+    {
+        if(i % 8 == 7)
+        {
+            snprintf(field, sizeof(field), "{\"type\":\"ack\",\"seq\":%u}", i);
+            messages.push_back(field);
+            continue;
+        }
+
+        //A batch of entities per update
+        std::string msg = "{\"type\":\"state\",\"seq\":" + std::to_string(i) + ",\"entities\":[";
+        uint32_t    nb  = 4 + rng() % 12;
+        for(uint32_t j = 0; j < nb; j++)
+        {
+            uint32_t id = rng() % config.entities;
+            for(uint32_t k = 0; k < 3; k++)
+                positions[3*id+k] += step(rng);
+            snprintf(field, sizeof(field), "%s{\"id\":%u,\"name\":\"entity_%u\",\"position\":[%.3f,%.3f,%.3f],\"visible\":true}",
+                     (j == 0 ? "" : ","), id, id, positions[3*id], positions[3*id+1], positions[3*id+2]);
+            msg += field;
+        }
+        msg += "]}";
+        messages.push_back(msg);
+    }
+    return messages;
+}
+
+/* \brief Add the counters of a pair of streams to a result
+ * \param result the result
+ * \param sender the compressing side
+ * \param receiver the decompressing side */
+static void accumulate(BenchResult& result, const StreamCompressor& sender, const StreamCompressor& receiver)
+{
+    CompressionStats s = sender.getStats();
+    CompressionStats r = receiver.getStats();
+    result.sender.nbCompressed        += s.nbCompressed;
+    result.sender.nbRaw               += s.nbRaw;
+    result.sender.inBytes             += s.inBytes;
+    result.sender.outBytes            += s.outBytes;
+    result.sender.compressNS          += s.compressNS;
+    result.receiver.nbDecompressed    += r.nbDecompressed;
+    result.receiver.decompressedBytes += r.decompressedBytes;
+    result.receiver.decompressNS      += r.decompressNS;
+}
+
+/* \brief Compress then decompress every message
+ * \param messages the messages
+ * \param config the stream configuration
+ * \param streaming true : one stream for every message (a connection). false : a new stream per message (no shared history)
+ * \return the counters of both sides */
+static BenchResult run(const std::vector<std::string>& messages, const CompressionConfig& config, bool streaming)
+{
+    BenchResult result;
+    std::unique_ptr<StreamCompressor> sender(new StreamCompressor(config));
+    std::unique_ptr<StreamCompressor> receiver(new StreamCompressor(config));
+
+    for(const std::string& msg : messages)
+    {
+        if(!streaming)
+        {
+            accumulate(result, *sender, *receiver);
+            sender.reset(new StreamCompressor(config));
+            receiver.reset(new StreamCompressor(config));
+        }
+
+        UniqueBuffer encoded = sender->encode((const uint8_t*)msg.data(), msg.size());
+        uint8_t*     decoded;
+        uint32_t     decodedSize;
+        if(!receiver->decode(encoded.data(), encoded.size(), decoded, decodedSize) ||
+           decodedSize != msg.size() || memcmp(decoded, msg.data(), decodedSize) != 0)
+            result.valid = false;
+    }
+
+    accumulate(result, *sender, *receiver);
+    return result;
+}
+
+/* \brief Print one result line
+ * \param name the run name
+ * \param result the result */
+static void printResult(const char* name, const BenchResult& result)
+{
+    double mb = result.sender.inBytes / (1024.0*1024.0);
+    printf("%-12s %10lu %10lu %12lu %12lu %8.2f %14.2f %16.2f %s\n", name,
+           (unsigned long)result.sender.nbCompressed, (unsigned long)result.sender.nbRaw,
+           (unsigned long)result.sender.inBytes, (unsigned long)result.sender.outBytes, result.sender.ratio(),
+           result.sender.compressNS/1e6/mb, result.receiver.decompressNS/1e6/mb, (result.valid ? "ok" : "MISMATCH"));
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --messages=N   messages to compress (100000)\n"
+          << "  --level=L      zlib level, 1..9 (6)\n"
+          << "  --threshold=B  messages smaller than B bytes are sent raw (128)\n"
+          << "  --entities=N   entities described by the state updates (64)\n"
+          << "  --seed=N       generator seed (42)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "messages")       config.messages  = std::max(1.0, value);
+        else if(key == "level")     config.level     = std::max(1.0, std::min(9.0, value));
+        else if(key == "threshold") config.threshold = value;
+        else if(key == "entities")  config.entities  = std::max(1.0, value);
+        else if(key == "seed")      config.seed      = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief Stream compression benchmark. Compresses generated state updates with one stream per connection (the history is shared
+ * between the messages, see StreamCompressor) and with a new stream per message, decompresses them and checks the round trip.
+ * Reports the compression ratio and the CPU cost (thread CPU time) per MB of input.
+ * Usage : serenoCompressionBench [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(!StreamCompressor::isAvailable())
+    {
+        ERROR << "serenoServer was built without zlib : nothing to measure\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> messages = generateMessages(config);
+    CompressionConfig stream;
+    stream.level     = config.level;
+    stream.threshold = config.threshold;
+
+    CompressionConfig raw = stream;
+    raw.threshold = UINT32_MAX;
+
+    BenchResult rawResult        = run(messages, raw, true);
+    BenchResult streamResult     = run(messages, stream, true);
+    BenchResult perMessageResult = run(messages, stream, false);
+
+    printf("%-12s %10s %10s %12s %12s %8s %14s %16s %s\n", "mode", "compressed", "raw", "in_bytes", "out_bytes", "ratio",
+           "compress_ms/MB", "decompress_ms/MB", "check");
+    printResult("raw", rawResult);
+    printResult("stream", streamResult);
+    printResult("per-message", perMessageResult);
+
+    return (rawResult.valid && streamResult.valid && perMessageResult.valid) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
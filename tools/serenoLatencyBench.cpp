@@ -0,0 +1,154 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "BenchUtils.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The benchmark configuration, see printUsage */
+struct BenchConfig
+{
+    uint32_t connections = 8;     /*!< The client connections*/
+    uint32_t messages    = 20000; /*!< The messages per connection*/
+    uint32_t size        = 64;    /*!< The message size*/
+    uint32_t handlers    = 2;     /*!< The handle messages threads*/
+    uint32_t cpus        = 0;     /*!< The CPUs the Server is pinned on (0, 1, ...). 0 == every CPU*/
+    uint32_t basePort    = 19200; /*!< The port of the first run, the next runs use the next ports*/
+};
+
+/* \brief Open a loopback TCP connection
+ * \param port the Server port
+ * \return the socket, -1 on error */
+static int connectTCP(uint32_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (SOCKADDR*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* \brief Run the ping-pong against an echo Server
+ * \param config the benchmark configuration
+ * \param threads the threading configuration of the Server
+ * \param port the Server port
+ * \return the result */
+static PingPongResult run(const BenchConfig& config, const ThreadConfig& threads, uint32_t port)
+{
+    BenchEchoServer server(config.handlers, port);
+    server.setThreadConfig(threads);
+    if(!server.launch())
+    {
+        ERROR << "Could not launch the Server on the port " << port << "\n";
+        PingPongResult result;
+        result.valid = false;
+        return result;
+    }
+
+    PingPongResult result = runPingPong([port]() {return connectTCP(port);}, config.connections, config.messages, config.size);
+    server.closeServer();
+    return result;
+}
+
+/* \brief Print one result line
+ * \param name the run name
+ * \param result the result */
+static void printResult(const char* name, const PingPongResult& result)
+{
+    printf("%-12s %10lu %10.1f %10.1f %10.1f %10.1f %12.0f %s\n", name, (unsigned long)result.latency.count,
+           result.latency.p50/1e3, result.latency.p99/1e3, result.latency.p999/1e3, result.latency.max/1e3,
+           result.messagesPerSecond, (result.valid ? "ok" : "FAILED"));
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --connections=N  client connections (8)\n"
+          << "  --messages=N     messages per connection (20000)\n"
+          << "  --size=B         message size in bytes, at least 8 (64)\n"
+          << "  --handlers=N     handle messages threads of the Server (2)\n"
+          << "  --cpus=N         pin the Server on the CPUs 0..N-1, 0 == every CPU (0)\n"
+          << "  --base-port=P    port of the first run, the next runs use the next ports (19200)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "connections")    config.connections = std::max(1.0, value);
+        else if(key == "messages")  config.messages    = std::max(1.0, value);
+        else if(key == "size")      config.size        = std::max(8.0, value);
+        else if(key == "handlers")  config.handlers    = std::max(1.0, value);
+        else if(key == "cpus")      config.cpus        = value;
+        else if(key == "base-port") config.basePort    = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief Threading configuration benchmark. Measures the round trip time (p50 / p99 / p99.9) of small messages echoed by a Server
+ * over loopback TCP, one message in flight per connection, with :
+ *   - default : no affinity
+ *   - pinned  : the read, write and accept threads on CPU 0, the handlers and client writers spread on the other CPUs
+ * The client threads are not pinned. Usage : serenoLatencyBench [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t nbCPUs = config.cpus > 0 ? config.cpus : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> ioCPUs     = {0};
+    std::vector<int> workerCPUs;
+    for(uint32_t i = (nbCPUs > 1 ? 1 : 0); i < nbCPUs; i++)
+        workerCPUs.push_back(i);
+
+    ThreadConfig defaultThreads;
+    ThreadConfig pinnedThreads;
+    pinnedThreads.setCPUs(THREAD_ACCEPT,  ioCPUs);
+    pinnedThreads.setCPUs(THREAD_READ,    ioCPUs);
+    pinnedThreads.setCPUs(THREAD_WRITE,   ioCPUs);
+    pinnedThreads.setCPUs(THREAD_HANDLER, workerCPUs, true);
+    pinnedThreads.setCPUs(THREAD_CLIENT,  workerCPUs);
+
+    PingPongResult defaultResult = run(config, defaultThreads, config.basePort);
+    PingPongResult pinnedResult  = run(config, pinnedThreads,  config.basePort+1);
+
+    printf("%-12s %10s %10s %10s %10s %10s %12s %s\n", "threads", "messages", "p50_us", "p99_us", "p999_us", "max_us", "msgs/s", "check");
+    printResult("default", defaultResult);
+    printResult("pinned", pinnedResult);
+
+    return (defaultResult.valid && pinnedResult.valid) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
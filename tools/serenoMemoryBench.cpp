@@ -0,0 +1,202 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "BenchUtils.h"
+#include "Transport.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The benchmark configuration, see printUsage */
+struct BenchConfig
+{
+    uint32_t churn       = 200000;  /*!< The connections opened then closed by the churn run*/
+    uint32_t connections = 1000;    /*!< The connections of the message runs*/
+    uint32_t messages    = 2000000; /*!< The messages of each message run*/
+    uint32_t size        = 64;      /*!< The message size*/
+    uint32_t handlers    = 4;       /*!< The handle messages threads*/
+    uint32_t injectors   = 1;       /*!< The threads injecting the messages*/
+    uint32_t timeoutS    = 60;      /*!< The maximum duration of each run, in seconds*/
+};
+
+/* \brief A Server counting its messages, and echoing them if asked to */
+class CountingServer : public Server<ClientSocket>
+{
+    public:
+        CountingServer(uint32_t nbHandlers) : Server<ClientSocket>(nbHandlers, 0)
+        {}
+
+        std::atomic<uint64_t> nbHandled{0}; /*!< The messages handled*/
+        std::atomic<bool>     echo{false};  /*!< Should the messages be echoed?*/
+    protected:
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            if(echo.load(std::memory_order_relaxed))
+            {
+                UniqueBuffer copy = UniqueBuffer::allocate(size);
+                memcpy(copy.data(), data, size);
+                client->pushPacket(copy.share());
+            }
+            nbHandled.fetch_add(1, std::memory_order_relaxed);
+        }
+};
+
+/* \brief Wait for a condition
+ * \param condition the condition to wait for
+ * \param timeoutS the timeout in seconds
+ * \return true if the condition became true, false on timeout */
+template <typename F>
+static bool waitFor(F&& condition, uint32_t timeoutS)
+{
+    uint64_t end = benchNow() + (uint64_t)timeoutS*1000000000;
+    while(!condition())
+    {
+        if(benchNow() > end)
+            return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
+/* \brief Inject messages on connections from several threads, round robin over the connections
+ * \param server the Server
+ * \param transport the transport of the connections
+ * \param ids the connections
+ * \param config the benchmark configuration
+ * \return the messages injected */
+static uint64_t injectMessages(CountingServer& server, MemoryTransport& transport, const std::vector<SOCKET>& ids, const BenchConfig& config)
+{
+    std::atomic<uint64_t>    nbInjected{0};
+    std::vector<std::thread> threads;
+    for(uint32_t t = 0; t < config.injectors; t++)
+    {
+        threads.emplace_back([&, t]()
+        {
+            std::vector<uint8_t> msg(config.size, 0xab);
+            uint64_t             nb = 0;
+            for(uint64_t i = t; i < config.messages; i += config.injectors)
+                nb += transport.inject(server, ids[i % ids.size()], msg.data(), msg.size());
+            nbInjected += nb;
+        });
+    }
+    for(std::thread& t : threads)
+        t.join();
+    return nbInjected;
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --churn=N        connections opened then closed (200000)\n"
+          << "  --connections=N  connections of the message runs (1000)\n"
+          << "  --messages=N     messages per message run (2000000)\n"
+          << "  --size=B         message size in bytes (64)\n"
+          << "  --handlers=N     handle messages threads of the Server (4)\n"
+          << "  --injectors=N    threads injecting the messages (1)\n"
+          << "  --timeout=S      maximum duration of each run, in seconds (60)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "churn")            config.churn       = value;
+        else if(key == "connections") config.connections = std::max(1.0, value);
+        else if(key == "messages")    config.messages    = std::max(1.0, value);
+        else if(key == "size")        config.size        = std::max(1.0, value);
+        else if(key == "handlers")    config.handlers    = std::max(1.0, value);
+        else if(key == "injectors")   config.injectors   = std::max(1.0, value);
+        else if(key == "timeout")     config.timeoutS    = std::max(1.0, value);
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief Handler and queue benchmark over MemoryTransport : no socket, no system call on the data path. Reports
+ *   - churn   : connections opened and closed per second (adoption, registration, close by the read thread)
+ *   - inbound : messages handled per second (injection, handler queues, framing, onMessage)
+ *   - echo    : messages handled and written back per second (plus the outbound queues and the client writing threads)
+ * Usage : serenoMemoryBench [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    MemoryTransport transport;
+    CountingServer  server(config.handlers); //Listens on an ephemeral TCP port nobody connects to
+    if(!server.launch())
+    {
+        ERROR << "Could not launch the Server\n";
+        return EXIT_FAILURE;
+    }
+    bool success = true;
+
+    //Churn : the closes are done by the read thread, the run ends once every connection is closed
+    uint64_t start = benchNow();
+    for(uint32_t i = 0; i < config.churn; i++)
+    {
+        ClientSocket* client = transport.connect(server);
+        if(client)
+            transport.disconnect(server, client->socket);
+    }
+    success &= waitFor([&] {return transport.getStats().nbClosed >= config.churn;}, config.timeoutS);
+    double churnS = (benchNow() - start) / 1e9;
+
+    std::vector<SOCKET> ids;
+    for(uint32_t i = 0; i < config.connections; i++)
+    {
+        ClientSocket* client = transport.connect(server);
+        if(client)
+            ids.push_back(client->socket);
+    }
+    if(ids.empty())
+    {
+        server.closeServer();
+        return EXIT_FAILURE;
+    }
+
+    //Inbound : until every message is handled
+    start = benchNow();
+    uint64_t injected = injectMessages(server, transport, ids, config);
+    success &= waitFor([&] {return server.nbHandled >= injected;}, config.timeoutS);
+    double inboundS = (benchNow() - start) / 1e9;
+
+    //Echo : until every answer is written (the writes may gather several answers)
+    server.echo      = true;
+    server.nbHandled = 0;
+    uint64_t bytes   = transport.getStats().nbBytes;
+    start = benchNow();
+    injected = injectMessages(server, transport, ids, config);
+    success &= waitFor([&] {return transport.getStats().nbBytes - bytes >= injected*config.size;}, config.timeoutS);
+    double echoS = (benchNow() - start) / 1e9;
+
+    server.closeServer();
+
+    printf("%-8s %12s %10s %14s %10s\n", "run", "count", "seconds", "per_second", "MB/s");
+    printf("%-8s %12u %10.3f %14.0f %10s\n", "churn", config.churn, churnS, config.churn/churnS, "-");
+    printf("%-8s %12u %10.3f %14.0f %10.1f\n", "inbound", config.messages, inboundS, config.messages/inboundS,
+           (double)config.messages*config.size/inboundS/(1024.0*1024.0));
+    printf("%-8s %12u %10.3f %14.0f %10.1f\n", "echo", config.messages, echoS, config.messages/echoS,
+           (double)config.messages*config.size/echoS/(1024.0*1024.0));
+    if(!success)
+        ERROR << "A run did not complete within " << config.timeoutS << " seconds\n";
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,37 @@
+#include <cstdlib>
+#include <netdb.h>
+#include "TrafficReplay.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief Replay a capture written by Server::enableCapture against a running Server
+ * Usage : serenoReplay <captureDirectory> <host> <port> [speed]. speed == 0 (default) : as fast as possible, 1 : recorded speed */
+int main(int argc, char** argv)
+{
+    if(argc < 4)
+    {
+        ERROR << "Usage : " << argv[0] << " <captureDirectory> <host> <port> [speed]\n";
+        return EXIT_FAILURE;
+    }
+
+    struct addrinfo  hints;
+    struct addrinfo* addr = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(argv[2], argv[3], &hints, &addr) != 0)
+    {
+        ERROR << "Could not resolve " << argv[2] << ":" << argv[3] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    TrafficReplay replay(argv[1], argc > 4 ? atof(argv[4]) : 0.0);
+    bool res = replay.toAddress(addr->ai_addr, addr->ai_addrlen);
+    freeaddrinfo(addr);
+
+    const ReplayStats& stats = replay.getStats();
+    INFO << "Replayed " << stats.nbRecords << " records (" << stats.nbBytes << " bytes, " << stats.nbClients << " clients) in "
+         << stats.duration << " s : " << (stats.duration > 0 ? stats.nbBytes/stats.duration/(1024*1024) : 0) << " MB/s\n";
+    return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
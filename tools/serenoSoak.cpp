@@ -0,0 +1,564 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "Server.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The soak test configuration, see printUsage */
+struct SoakConfig
+{
+    uint32_t connections     = 100000; /*!< The connections to open*/
+    uint32_t ports           = 4;      /*!< The listening ports (basePort, basePort+1, ...)*/
+    uint32_t basePort        = 19000;  /*!< The first listening port*/
+    uint32_t sourceIPs       = 8;      /*!< The source addresses (127.0.0.1, 127.0.0.2, ...)*/
+    uint32_t handlers        = 4;      /*!< The handle messages threads of the Server*/
+    double   activeFraction  = 0.01;   /*!< The fraction of the connections sending a message every sample during the active phase*/
+    uint32_t idleSeconds     = 10;     /*!< The duration of the idle phase (every connection open, no traffic)*/
+    uint32_t activeSeconds   = 20;     /*!< The duration of the active phase*/
+    uint32_t sampleMS        = 1000;   /*!< The sampling period*/
+    uint32_t window          = 512;    /*!< The connections being opened at once*/
+
+    double   maxRSSMB        = 0;      /*!< The RSS budget of the Server, in MB. 0 == not checked*/
+    uint32_t maxThreads      = 0;      /*!< The thread budget of the Server. 0 == not checked*/
+    double   maxIdleCPU      = 0;      /*!< The CPU budget of the Server during the idle phase, in percent of one core. 0 == not checked*/
+    double   minAcceptRate   = 0;      /*!< The minimum accept rate, in connections per second. 0 == not checked*/
+    double   minCloseRate    = 0;      /*!< The minimum close rate, in connections per second. 0 == not checked*/
+    uint32_t maxFailures     = 0;      /*!< The connections which may fail to open*/
+};
+
+/* \brief The counters of the Server process, shared with the soak process */
+struct SoakCounters
+{
+    std::atomic<uint64_t> accepted{0}; /*!< The clients created*/
+    std::atomic<uint64_t> closed{0};   /*!< The clients closed*/
+    std::atomic<uint64_t> messages{0}; /*!< The messages echoed*/
+    std::atomic<bool>     ready{false}; /*!< Is the Server listening?*/
+    std::atomic<bool>     stop{false};  /*!< Should the Server stop?*/
+};
+
+/* \brief A sample of the Server process */
+struct SoakSample
+{
+    double   time     = 0; /*!< The time since the start, in seconds*/
+    uint64_t accepted = 0; /*!< The clients created*/
+    uint64_t closed   = 0; /*!< The clients closed*/
+    uint64_t messages = 0; /*!< The messages echoed*/
+    double   rssMB    = 0; /*!< The resident memory, in MB*/
+    uint32_t threads  = 0; /*!< The number of threads*/
+    uint64_t cpuTicks = 0; /*!< The user + system CPU time, in clock ticks*/
+};
+
+/* \brief The echo Server under test, counting its clients */
+class SoakServer : public Server<ClientSocket>
+{
+    public:
+        SoakServer(uint32_t nbHandlers, uint32_t port, SoakCounters* counters) : Server<ClientSocket>(nbHandlers, port), m_counters(counters)
+        {}
+    protected:
+        ClientSocket* createClient(uint32_t listenerID)
+        {
+            m_counters->accepted++;
+            return new ClientSocket();
+        }
+
+        void closeClient(SOCKET client)
+        {
+            if(m_clientTable.find(client) != m_clientTable.end())
+                m_counters->closed++;
+            Server<ClientSocket>::closeClient(client);
+        }
+
+        void onMessage(uint32_t bufID, ClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            UniqueBuffer echo = UniqueBuffer::allocate(size);
+            memcpy(echo.data(), data, size);
+            client->pushPacket(echo.share());
+            m_counters->messages++;
+        }
+    private:
+        SoakCounters* m_counters; /*!< The shared counters*/
+};
+
+static double now()
+{
+    return AdmissionControl::now()*1e-9;
+}
+
+/* \brief Read a sample of a process from /proc
+ * \param pid the process
+ * \param counters the shared counters
+ * \param start the start time of the test
+ * \return the sample */
+static SoakSample sample(pid_t pid, const SoakCounters* counters, double start)
+{
+    SoakSample s;
+    s.time     = now() - start;
+    s.accepted = counters->accepted;
+    s.closed   = counters->closed;
+    s.messages = counters->messages;
+
+    char  path[64];
+    char  line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if(f)
+    {
+        while(fgets(line, sizeof(line), f))
+        {
+            unsigned long v;
+            if(sscanf(line, "VmRSS: %lu", &v) == 1)
+                s.rssMB = v/1024.0;
+            else if(sscanf(line, "Threads: %lu", &v) == 1)
+                s.threads = v;
+        }
+        fclose(f);
+    }
+
+    //utime and stime are the 14th and 15th fields, after the parenthesized command name
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    f = fopen(path, "r");
+    if(f)
+    {
+        std::string stat;
+        size_t      n;
+        while((n = fread(line, 1, sizeof(line), f)) > 0)
+            stat.append(line, n);
+        fclose(f);
+        size_t end = stat.rfind(')');
+        unsigned long utime = 0, stime = 0;
+        if(end != std::string::npos &&
+           sscanf(stat.c_str() + end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2)
+            s.cpuTicks = utime + stime;
+    }
+    return s;
+}
+
+/* \brief The soak process side : the connections and the samples */
+class SoakClient
+{
+    public:
+        SoakClient(const SoakConfig& config, pid_t server, SoakCounters* counters) : m_config(config), m_server(server), m_counters(counters)
+        {
+            m_start = now();
+            m_last  = sample(m_server, m_counters, m_start);
+            printf("time,phase,connections,accepted,closed,messages,rssMB,threads,cpuPercent\n");
+        }
+
+        /* \brief Open every connection
+         * \return the number of connections which could not be opened */
+        uint32_t open()
+        {
+            m_phase = "open";
+            std::vector<std::pair<int, uint32_t>> pending; //(socket, index)
+            uint32_t failures = 0;
+            uint32_t next     = 0;
+            double   deadline = now() + 60 + m_config.connections/1000.0;
+
+            while((next < m_config.connections || pending.size() > 0) && now() < deadline)
+            {
+                while(next < m_config.connections && pending.size() < m_config.window)
+                {
+                    int sock = connectOne(next);
+                    if(sock == SOCKET_ERROR)
+                        failures++;
+                    else
+                        pending.emplace_back(sock, next);
+                    next++;
+                }
+
+                std::vector<struct pollfd> pfds;
+                for(auto& it : pending)
+                    pfds.push_back({.fd = it.first, .events = POLLOUT});
+                poll(pfds.data(), pfds.size(), 10);
+
+                std::vector<std::pair<int, uint32_t>> stillPending;
+                for(uint32_t i = 0; i < pfds.size(); i++)
+                {
+                    if(pfds[i].revents == 0)
+                    {
+                        stillPending.push_back(pending[i]);
+                        continue;
+                    }
+                    int       err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if(err != 0)
+                    {
+                        WARNING_RATE_LIMITED(1000) << "Could not connect : " << strerror(err) << "\n";
+                        close(pfds[i].fd);
+                        failures++;
+                    }
+                    else
+                        m_sockets.push_back(pfds[i].fd);
+                }
+                pending.swap(stillPending);
+                tick();
+            }
+
+            for(auto& it : pending)
+            {
+                close(it.first);
+                failures++;
+            }
+
+            //Wait for the Server to register every connection
+            while(m_counters->accepted < m_sockets.size() && now() < deadline)
+            {
+                usleep(10000);
+                tick();
+            }
+            m_acceptRate = m_sockets.size() / std::max(now() - m_start, 1e-3);
+            return failures;
+        }
+
+        /* \brief Keep the connections open without traffic
+         * \param seconds the phase duration
+         * \return the CPU used by the Server, in percent of one core */
+        double idle(uint32_t seconds)
+        {
+            m_phase = "idle";
+            SoakSample first = sample(m_server, m_counters, m_start);
+            double     end   = now() + seconds;
+            while(now() < end)
+            {
+                usleep(10000);
+                tick();
+            }
+            SoakSample last = sample(m_server, m_counters, m_start);
+            return cpuPercent(first, last);
+        }
+
+        /* \brief Send a message on a fraction of the connections every sample period, and read the echoes
+         * \param seconds the phase duration */
+        void active(uint32_t seconds)
+        {
+            m_phase = "active";
+            uint32_t nbActive = std::min<uint32_t>(m_sockets.size(), m_sockets.size()*m_config.activeFraction);
+            uint32_t first    = 0;
+            double   end      = now() + seconds;
+            char     msg[16]  = "soak-message-16";
+            char     buf[4096];
+
+            while(now() < end)
+            {
+                double nextRound = now() + m_config.sampleMS*1e-3;
+                std::vector<struct pollfd> pfds;
+                for(uint32_t i = 0; i < nbActive; i++)
+                {
+                    int sock = m_sockets[(first + i) % m_sockets.size()];
+                    if(send(sock, msg, sizeof(msg), MSG_NOSIGNAL) > 0)
+                        pfds.push_back({.fd = sock, .events = POLLIN});
+                }
+                first = (first + nbActive) % std::max<size_t>(m_sockets.size(), 1);
+
+                //Read the echoes until the next round
+                while(now() < nextRound && pfds.size() > 0)
+                {
+                    if(poll(pfds.data(), pfds.size(), 10) > 0)
+                        for(auto& pfd : pfds)
+                            if(pfd.revents & POLLIN)
+                                while(recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+                    tick();
+                }
+                while(now() < nextRound)
+                {
+                    usleep(10000);
+                    tick();
+                }
+            }
+        }
+
+        /* \brief Close every connection
+         * \return the number of connections the Server did not close in time */
+        uint64_t closeAll()
+        {
+            m_phase = "close";
+            uint64_t closedBefore = m_counters->closed;
+            uint64_t target       = closedBefore + m_sockets.size();
+            double   deadline     = now() + 60 + m_sockets.size()/1000.0;
+            double   start        = now();
+            while(m_sockets.size() > 0)
+            {
+                close(m_sockets.back());
+                m_sockets.pop_back();
+                if(m_sockets.size() % 1000 == 0)
+                    tick();
+            }
+
+            while(m_counters->closed < target && now() < deadline)
+            {
+                usleep(10000);
+                tick();
+            }
+            m_closeRate = (m_counters->closed - closedBefore) / std::max(now() - start, 1e-3);
+            return target - std::min(target, m_counters->closed.load());
+        }
+
+        double getAcceptRate() const     {return m_acceptRate;}
+        double getCloseRate() const      {return m_closeRate;}
+        double getMaxRSSMB() const       {return m_maxRSSMB;}
+        uint32_t getMaxThreads() const   {return m_maxThreads;}
+        size_t getNbConnections() const  {return m_sockets.size();}
+    private:
+        /* \brief Start a non blocking connection
+         * \param index the connection index, choosing its source address and destination port
+         * \return the socket, SOCKET_ERROR on failure */
+        int connectOne(uint32_t index)
+        {
+            int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if(sock == SOCKET_ERROR)
+            {
+                ERROR_RATE_LIMITED(1000) << "Could not create a socket : " << strerror(errno) << "\n";
+                return SOCKET_ERROR;
+            }
+
+            //Choose the source port at connect time : the ports are then only unique per (source, destination) pair
+            int one = 1;
+#ifdef IP_BIND_ADDRESS_NO_PORT
+            setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+            SOCKADDR_IN src;
+            memset(&src, 0, sizeof(src));
+            src.sin_family      = AF_INET;
+            src.sin_addr.s_addr = htonl(INADDR_LOOPBACK + index % m_config.sourceIPs);
+            SOCKADDR_IN dst;
+            memset(&dst, 0, sizeof(dst));
+            dst.sin_family      = AF_INET;
+            dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            dst.sin_port        = htons(m_config.basePort + (index / m_config.sourceIPs) % m_config.ports);
+
+            if(bind(sock, (SOCKADDR*)&src, sizeof(src)) == SOCKET_ERROR ||
+               (connect(sock, (SOCKADDR*)&dst, sizeof(dst)) == SOCKET_ERROR && errno != EINPROGRESS))
+            {
+                WARNING_RATE_LIMITED(1000) << "Could not connect : " << strerror(errno) << "\n";
+                close(sock);
+                return SOCKET_ERROR;
+            }
+            return sock;
+        }
+
+        /* \brief Print a sample once per sample period */
+        void tick()
+        {
+            if(now() - m_start - m_last.time < m_config.sampleMS*1e-3)
+                return;
+
+            SoakSample s = sample(m_server, m_counters, m_start);
+            m_maxRSSMB   = std::max(m_maxRSSMB, s.rssMB);
+            m_maxThreads = std::max(m_maxThreads, s.threads);
+            printf("%.2f,%s,%zu,%lu,%lu,%lu,%.1f,%u,%.1f\n", s.time, m_phase, m_sockets.size(), s.accepted, s.closed, s.messages,
+                   s.rssMB, s.threads, cpuPercent(m_last, s));
+            fflush(stdout);
+            m_last = s;
+        }
+
+        /* \brief Get the CPU used by the Server between two samples
+         * \return the CPU use in percent of one core */
+        static double cpuPercent(const SoakSample& a, const SoakSample& b)
+        {
+            double dt = b.time - a.time;
+            if(dt <= 0)
+                return 0;
+            return 100.0*(b.cpuTicks - a.cpuTicks)/sysconf(_SC_CLK_TCK)/dt;
+        }
+
+        const SoakConfig& m_config;             /*!< The configuration*/
+        pid_t             m_server;             /*!< The Server process*/
+        SoakCounters*     m_counters;           /*!< The counters of the Server*/
+        std::vector<int>  m_sockets;            /*!< The open connections*/
+        const char*       m_phase = "start";    /*!< The current phase*/
+        double            m_start;              /*!< The start time*/
+        SoakSample        m_last;               /*!< The last printed sample*/
+        double            m_acceptRate = 0;     /*!< The accept rate of the open phase*/
+        double            m_closeRate  = 0;     /*!< The close rate of the close phase*/
+        double            m_maxRSSMB   = 0;     /*!< The largest RSS seen*/
+        uint32_t          m_maxThreads = 0;     /*!< The largest thread count seen*/
+};
+
+/* \brief Raise RLIMIT_NOFILE to hold a number of descriptors
+ * \param needed the number of descriptors
+ * \return the descriptors available */
+static rlim_t raiseFileLimit(rlim_t needed)
+{
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur >= needed)
+        return limit.rlim_cur;
+
+    //Raising the hard limit needs CAP_SYS_RESOURCE : fall back to the current hard limit
+    struct rlimit wanted = {needed, std::max(needed, limit.rlim_max)};
+    if(setrlimit(RLIMIT_NOFILE, &wanted) == 0)
+        return needed;
+    wanted.rlim_cur = wanted.rlim_max = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &wanted);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --connections=N      connections to open (100000)\n"
+          << "  --ports=N            listening ports, from --base-port (4)\n"
+          << "  --base-port=P        first listening port (19000)\n"
+          << "  --source-ips=N       source addresses 127.0.0.1.. (8)\n"
+          << "  --handlers=N         handle messages threads (4)\n"
+          << "  --active-fraction=F  connections sending a message each period of the active phase (0.01)\n"
+          << "  --idle-seconds=S     idle phase duration (10)\n"
+          << "  --active-seconds=S   active phase duration (20)\n"
+          << "  --sample-ms=MS       sampling period (1000)\n"
+          << "  --max-rss-mb=MB --max-threads=N --max-idle-cpu=PERCENT --min-accept-rate=N --min-close-rate=N --max-failures=N\n"
+          << "                       budgets (0 == not checked, except --max-failures)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, SoakConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "connections")          config.connections    = value;
+        else if(key == "ports")           config.ports          = std::max(1.0, value);
+        else if(key == "base-port")       config.basePort       = value;
+        else if(key == "source-ips")      config.sourceIPs      = std::max(1.0, std::min(254.0, value));
+        else if(key == "handlers")        config.handlers       = std::max(1.0, value);
+        else if(key == "active-fraction") config.activeFraction = std::max(0.0, std::min(1.0, value));
+        else if(key == "idle-seconds")    config.idleSeconds    = value;
+        else if(key == "active-seconds")  config.activeSeconds  = value;
+        else if(key == "sample-ms")       config.sampleMS       = std::max(10.0, value);
+        else if(key == "max-rss-mb")      config.maxRSSMB       = value;
+        else if(key == "max-threads")     config.maxThreads     = value;
+        else if(key == "max-idle-cpu")    config.maxIdleCPU     = value;
+        else if(key == "min-accept-rate") config.minAcceptRate  = value;
+        else if(key == "min-close-rate")  config.minCloseRate   = value;
+        else if(key == "max-failures")    config.maxFailures    = value;
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief Run the Server under test until the soak process stops it
+ * \return the exit status */
+static int runServer(const SoakConfig& config, SoakCounters* counters)
+{
+    SoakServer server(config.handlers, config.basePort, counters);
+    server.setListenBacklog(65535);
+    for(uint32_t i = 1; i < config.ports; i++)
+        server.addTCPListener(i, config.basePort + i);
+    if(!server.launch())
+        return EXIT_FAILURE;
+
+    counters->ready = true;
+    while(!counters->stop && getppid() != 1)
+        usleep(10000);
+    server.closeServer();
+    return EXIT_SUCCESS;
+}
+
+/* \brief Connection-scale soak test. A forked Server process listens on several loopback ports; this process opens the connections
+ * from several source addresses, keeps them idle then partly active, and closes them. Every sample period a CSV line gives the Server
+ * RSS, thread count and CPU use. Fails (exit status 1) if a budget is exceeded.
+ * Usage : serenoSoak [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    SoakConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    //Each process holds one end of every connection
+    rlim_t available = raiseFileLimit(config.connections + 1024);
+    if(available < config.connections + 1024)
+    {
+        WARNING << "RLIMIT_NOFILE is " << available << " : only " << (available > 1024 ? available - 1024 : 0) << " connections opened\n";
+        config.connections = (available > 1024 ? available - 1024 : 0);
+    }
+
+    SoakCounters* counters = (SoakCounters*)mmap(NULL, sizeof(SoakCounters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(counters == MAP_FAILED)
+    {
+        ERROR << "Could not map the shared counters\n";
+        return EXIT_FAILURE;
+    }
+    new(counters) SoakCounters();
+
+    pid_t server = fork();
+    if(server == 0)
+        _exit(runServer(config, counters));
+    if(server < 0)
+    {
+        ERROR << "Could not fork the Server\n";
+        return EXIT_FAILURE;
+    }
+
+    for(uint32_t i = 0; i < 500 && !counters->ready; i++)
+        usleep(10000);
+    if(!counters->ready)
+    {
+        ERROR << "The Server did not start\n";
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+        return EXIT_FAILURE;
+    }
+
+    SoakClient client(config, server, counters);
+    uint32_t   failures = client.open();
+    uint32_t   opened   = client.getNbConnections();
+    double     idleCPU  = client.idle(config.idleSeconds);
+    client.active(config.activeSeconds);
+    uint64_t   unclosed = client.closeAll();
+
+    counters->stop = true;
+    int status = 0;
+    waitpid(server, &status, 0);
+
+    INFO << "Opened " << opened << "/" << config.connections << " connections (" << failures << " failures) at "
+         << client.getAcceptRate() << " conn/s, closed at " << client.getCloseRate() << " conn/s (" << unclosed << " not closed). "
+         << "Max RSS " << client.getMaxRSSMB() << " MB, max threads " << client.getMaxThreads() << ", idle CPU " << idleCPU << " %\n";
+
+    bool res = true;
+    auto check = [&res](bool ok, const std::string& what)
+    {
+        if(!ok)
+        {
+            ERROR << "Budget exceeded : " << what << "\n";
+            res = false;
+        }
+    };
+    check(failures <= config.maxFailures, "connection failures " + std::to_string(failures));
+    check(unclosed == 0, std::to_string(unclosed) + " connections not closed by the Server");
+    check(config.maxRSSMB      == 0 || client.getMaxRSSMB()    <= config.maxRSSMB,      "RSS " + std::to_string(client.getMaxRSSMB()) + " MB");
+    check(config.maxThreads    == 0 || client.getMaxThreads()  <= config.maxThreads,    "threads " + std::to_string(client.getMaxThreads()));
+    check(config.maxIdleCPU    == 0 || idleCPU                 <= config.maxIdleCPU,    "idle CPU " + std::to_string(idleCPU) + " %");
+    check(config.minAcceptRate == 0 || client.getAcceptRate()  >= config.minAcceptRate, "accept rate " + std::to_string(client.getAcceptRate()));
+    check(config.minCloseRate  == 0 || client.getCloseRate()   >= config.minCloseRate,  "close rate " + std::to_string(client.getCloseRate()));
+    check(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, "the Server did not exit cleanly");
+
+    munmap(counters, sizeof(SoakCounters));
+    return res ? EXIT_SUCCESS : EXIT_FAILURE;
+}
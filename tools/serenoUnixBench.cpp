@@ -0,0 +1,160 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "BenchUtils.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The benchmark configuration, see printUsage */
+struct BenchConfig
+{
+    uint32_t    connections = 4;                         /*!< The client connections*/
+    uint32_t    messages    = 20000;                     /*!< The messages per connection and per run*/
+    uint32_t    size        = 64;                        /*!< The message size*/
+    uint32_t    window      = 64;                        /*!< The messages in flight per connection during the throughput runs*/
+    uint32_t    handlers    = 2;                         /*!< The handle messages threads*/
+    uint32_t    port        = 19300;                     /*!< The TCP port*/
+    std::string path        = "/tmp/serenoUnixBench.sock"; /*!< The UNIX socket path*/
+};
+
+/* \brief Open a loopback TCP connection
+ * \param port the Server port
+ * \return the socket, -1 on error */
+static int connectTCP(uint32_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (SOCKADDR*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* \brief Open a UNIX stream connection
+ * \param path the Server socket path
+ * \return the socket, -1 on error */
+static int connectUnix(const std::string& path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+    if(connect(fd, (SOCKADDR*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* \brief Print one result line
+ * \param name the run name
+ * \param result the result
+ * \param size the message size */
+static void printResult(const char* name, const PingPongResult& result, uint32_t size)
+{
+    printf("%-16s %10lu %10.1f %10.1f %10.1f %12.0f %10.1f %s\n", name, (unsigned long)result.latency.count,
+           result.latency.p50/1e3, result.latency.p99/1e3, result.latency.p999/1e3, result.messagesPerSecond,
+           result.messagesPerSecond*size/(1024.0*1024.0), (result.valid ? "ok" : "FAILED"));
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --connections=N  client connections (4)\n"
+          << "  --messages=N     messages per connection and per run (20000)\n"
+          << "  --size=B         message size in bytes, at least 8 (64)\n"
+          << "  --window=N       messages in flight per connection during the throughput runs (64)\n"
+          << "  --handlers=N     handle messages threads of the Server (2)\n"
+          << "  --port=P         TCP port (19300)\n"
+          << "  --path=PATH      UNIX socket path (/tmp/serenoUnixBench.sock)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "connections")   config.connections = std::max(1.0, value);
+        else if(key == "messages") config.messages    = std::max(1.0, value);
+        else if(key == "size")     config.size        = std::max(8.0, value);
+        else if(key == "window")   config.window      = std::max(1.0, value);
+        else if(key == "handlers") config.handlers    = std::max(1.0, value);
+        else if(key == "port")     config.port        = value;
+        else if(key == "path")     config.path        = arg.substr(eq+1);
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief UNIX domain socket vs TCP loopback benchmark. One echo Server listens on both; the same client load runs on each :
+ * one message in flight per connection (round trip time p50 / p99 / p99.9), then --window messages in flight (throughput).
+ * Usage : serenoUnixBench [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unlink(config.path.c_str());
+    BenchEchoServer server(config.handlers, config.port);
+    if(!server.addUnixSocket(config.path) || !server.launch())
+    {
+        ERROR << "Could not launch the Server on the port " << config.port << " and on " << config.path << "\n";
+        return EXIT_FAILURE;
+    }
+
+    uint32_t    port = config.port;
+    std::string path = config.path;
+    std::function<int()> tcpConnect  = [port]() {return connectTCP(port);};
+    std::function<int()> unixConnect = [path]() {return connectUnix(path);};
+
+    PingPongResult tcpLatency     = runPingPong(tcpConnect,  config.connections, config.messages, config.size);
+    PingPongResult unixLatency    = runPingPong(unixConnect, config.connections, config.messages, config.size);
+    PingPongResult tcpThroughput  = runPingPong(tcpConnect,  config.connections, config.messages, config.size, config.window);
+    PingPongResult unixThroughput = runPingPong(unixConnect, config.connections, config.messages, config.size, config.window);
+    server.closeServer();
+    unlink(config.path.c_str());
+
+    printf("%-16s %10s %10s %10s %10s %12s %10s %s\n", "run", "messages", "p50_us", "p99_us", "p999_us", "msgs/s", "MB/s", "check");
+    printResult("tcp-latency",     tcpLatency,     config.size);
+    printResult("unix-latency",    unixLatency,    config.size);
+    printResult("tcp-throughput",  tcpThroughput,  config.size);
+    printResult("unix-throughput", unixThroughput, config.size);
+
+    return (tcpLatency.valid && unixLatency.valid && tcpThroughput.valid && unixThroughput.valid) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
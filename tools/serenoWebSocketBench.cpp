@@ -0,0 +1,312 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "BenchUtils.h"
+#include "WebSocketClientSocket.h"
+#include "utils.h"
+
+using namespace sereno;
+
+/* \brief The benchmark configuration, see printUsage */
+struct BenchConfig
+{
+    uint32_t connections = 4;         /*!< The client connections*/
+    uint32_t messages    = 20000;     /*!< The messages per connection and per run*/
+    uint32_t size        = 64;        /*!< The message size*/
+    uint32_t window      = 64;        /*!< The messages in flight per connection*/
+    uint32_t handlers    = 2;         /*!< The handle messages threads*/
+    uint32_t basePort    = 19400;     /*!< The port of the raw TCP Server, the WebSocket Server uses the next one*/
+    uint32_t unmaskMB    = 256;       /*!< The bytes unmasked per kernel and per payload size, in MB*/
+};
+
+/* \brief A WebSocket Server echoing each data message to its sender */
+class WebSocketEchoServer : public Server<WebSocketClientSocket, FramingIs<WebSocketFraming>>
+{
+    public:
+        using Server<WebSocketClientSocket, FramingIs<WebSocketFraming>>::Server;
+    protected:
+        void onMessage(uint32_t bufID, WebSocketClientSocket* client, uint8_t* data, uint32_t size)
+        {
+            UniqueBuffer echo = UniqueBuffer::allocate(size);
+            memcpy(echo.data(), data, size);
+            client->sendMessage(echo.share(), client->getMessageOpcode());
+        }
+};
+
+/* \brief Open a loopback TCP connection
+ * \param port the Server port
+ * \return the socket, -1 on error */
+static int connectTCP(uint32_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (SOCKADDR*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* \brief Open a WebSocket connection : connect then do the upgrade handshake
+ * \param port the Server port
+ * \return the socket, -1 on error */
+static int connectWebSocket(uint32_t port)
+{
+    int fd = connectTCP(port);
+    if(fd < 0)
+        return -1;
+
+    static const char request[] = "GET /bench HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                                  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    if(!writeAll(fd, (const uint8_t*)request, sizeof(request)-1))
+    {
+        close(fd);
+        return -1;
+    }
+
+    //The response ends with an empty line. Read it byte per byte : the frames follow it
+    std::string response;
+    char        c;
+    while(response.size() < 4096 && (response.size() < 4 || response.compare(response.size()-4, 4, "\r\n\r\n") != 0))
+    {
+        if(!readAll(fd, (uint8_t*)&c, 1))
+        {
+            close(fd);
+            return -1;
+        }
+        response += c;
+    }
+    if(response.compare(0, 12, "HTTP/1.1 101") != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* \brief Get the size of a frame header
+ * \param size the payload size
+ * \param masked is the payload masked (client frames)?
+ * \return the header size */
+static uint32_t frameHeaderSize(uint32_t size, bool masked)
+{
+    return (size < 126 ? 2 : (size < 65536 ? 4 : 10)) + (masked ? 4 : 0);
+}
+
+/* \brief Run the ping-pong of runPingPong over WebSocket : masked binary frames, echoed in unmasked frames
+ * \param port the WebSocket Server port
+ * \param config the benchmark configuration
+ * \return the round trip times and the throughput */
+static PingPongResult runWebSocketPingPong(uint32_t port, const BenchConfig& config)
+{
+    uint32_t size   = config.size;
+    uint32_t window = config.window;
+    std::vector<std::vector<uint64_t>> samples(config.connections);
+    std::vector<char>                  valid(config.connections, 1);
+    std::vector<int>                   fds(config.connections);
+    for(uint32_t c = 0; c < config.connections; c++)
+        fds[c] = connectWebSocket(port);
+
+    uint64_t start = benchNow();
+    std::vector<std::thread> threads;
+    for(uint32_t c = 0; c < config.connections; c++)
+    {
+        threads.emplace_back([&, c]()
+        {
+            int fd = fds[c];
+            if(fd < 0)
+            {
+                valid[c] = 0;
+                return;
+            }
+
+            const uint8_t        mask[4]     = {0x37, 0xfa, 0x21, 0x3d};
+            uint32_t             outHeader   = frameHeaderSize(size, true);
+            uint32_t             inHeader    = frameHeaderSize(size, false);
+            std::vector<uint8_t> out(window*(outHeader + size));
+            std::vector<uint8_t> in(window*(inHeader + size));
+            std::vector<uint8_t> payload(size, 0xab);
+            samples[c].reserve(config.messages);
+
+            for(uint64_t seq = 0; seq < config.messages; seq += window)
+            {
+                uint32_t batch = std::min<uint64_t>(window, config.messages - seq);
+                for(uint32_t i = 0; i < batch; i++)
+                {
+                    uint8_t* frame = out.data() + i*(outHeader + size);
+                    frame[0] = 0x82; //FIN + binary
+                    if(size < 126)
+                        frame[1] = 0x80 | size;
+                    else if(size < 65536)
+                    {
+                        frame[1] = 0x80 | 126;
+                        frame[2] = size >> 8;
+                        frame[3] = size;
+                    }
+                    else
+                    {
+                        frame[1] = 0x80 | 127;
+                        for(uint32_t j = 0; j < 8; j++)
+                            frame[2+j] = (uint64_t)size >> (56 - 8*j);
+                    }
+                    memcpy(frame + outHeader - 4, mask, 4);
+
+                    uint64_t id = seq + i;
+                    memcpy(payload.data(), &id, sizeof(uint64_t));
+                    memcpy(frame + outHeader, payload.data(), size);
+                    webSocketUnmask(frame + outHeader, size, mask); //Masking and unmasking are the same XOR
+                }
+
+                uint64_t sendTime = benchNow();
+                if(!writeAll(fd, out.data(), batch*(outHeader + size)) || !readAll(fd, in.data(), batch*(inHeader + size)))
+                {
+                    valid[c] = 0;
+                    return;
+                }
+                uint64_t recvTime = benchNow();
+
+                for(uint32_t i = 0; i < batch; i++)
+                {
+                    uint8_t* frame = in.data() + i*(inHeader + size);
+                    uint64_t id;
+                    memcpy(&id, frame + inHeader, sizeof(uint64_t));
+                    if(frame[0] != 0x82 || id != seq + i)
+                        valid[c] = 0;
+                    samples[c].push_back(recvTime - sendTime);
+                }
+            }
+        });
+    }
+    for(std::thread& t : threads)
+        t.join();
+    uint64_t duration = benchNow() - start;
+
+    PingPongResult        result;
+    std::vector<uint64_t> all;
+    for(uint32_t c = 0; c < config.connections; c++)
+    {
+        all.insert(all.end(), samples[c].begin(), samples[c].end());
+        result.valid &= (valid[c] != 0);
+        if(fds[c] >= 0)
+            close(fds[c]);
+    }
+    result.latency           = computeLatencies(all);
+    result.messagesPerSecond = all.size() / (duration / 1e9);
+    return result;
+}
+
+/* \brief Measure an unmasking kernel
+ * \param unmask the kernel
+ * \param size the payload size
+ * \param totalMB the bytes to unmask, in MB
+ * \return the throughput in GB/s */
+static double measureUnmask(void (*unmask)(uint8_t*, uint32_t, const uint8_t*, uint32_t), uint32_t size, uint32_t totalMB)
+{
+    std::vector<uint8_t> payload(size + 1, 0x5a);
+    const uint8_t        mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    uint64_t             total   = (uint64_t)totalMB << 20;
+    uint64_t             rounds  = std::max<uint64_t>(1, total / size);
+
+    uint64_t start = benchNow();
+    for(uint64_t r = 0; r < rounds; r++)
+        unmask(payload.data() + (r & 1), size, mask, r & 3); //Unaligned half the time, as payloads following a frame header
+    uint64_t duration = benchNow() - start;
+    return (double)rounds*size / duration;
+}
+
+static void printUsage(const char* name)
+{
+    ERROR << "Usage : " << name << " [--option=value ...]\n"
+          << "  --connections=N  client connections (4)\n"
+          << "  --messages=N     messages per connection and per run (20000)\n"
+          << "  --size=B         message size in bytes, at least 8 (64)\n"
+          << "  --window=N       messages in flight per connection (64)\n"
+          << "  --handlers=N     handle messages threads of the Servers (2)\n"
+          << "  --base-port=P    raw TCP Server port, the WebSocket Server uses the next one (19400)\n"
+          << "  --unmask-mb=N    MB unmasked per kernel and per payload size (256)\n";
+}
+
+/* \brief Parse the command line
+ * \return true on success, false on an unknown option */
+static bool parseArgs(int argc, char** argv, BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t      eq  = arg.find('=');
+        if(arg.compare(0, 2, "--") != 0 || eq == std::string::npos)
+            return false;
+        std::string key   = arg.substr(2, eq-2);
+        double      value = atof(arg.c_str() + eq + 1);
+
+        if(key == "connections")    config.connections = std::max(1.0, value);
+        else if(key == "messages")  config.messages    = std::max(1.0, value);
+        else if(key == "size")      config.size        = std::max(8.0, value);
+        else if(key == "window")    config.window      = std::max(1.0, value);
+        else if(key == "handlers")  config.handlers    = std::max(1.0, value);
+        else if(key == "base-port") config.basePort    = value;
+        else if(key == "unmask-mb") config.unmaskMB    = std::max(1.0, value);
+        else
+            return false;
+    }
+    return true;
+}
+
+/* \brief WebSocket benchmark. Reports the throughput of the unmasking kernel chosen at run time (webSocketUnmask) against the
+ * scalar one for several payload sizes, then the end-to-end messages/s of an echo Server over WebSocket (WebSocketFraming,
+ * masked client frames) against the raw TCP path (LengthPrefixFraming) with the same load.
+ * Usage : serenoWebSocketBench [--option=value ...], see printUsage */
+int main(int argc, char** argv)
+{
+    BenchConfig config;
+    if(!parseArgs(argc, argv, config))
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %10s %14s %14s\n", "payload", "kernel", "kernel_GB/s", "scalar_GB/s");
+    for(uint32_t size : {16u, 125u, 1024u, 65536u, 1u << 20})
+        printf("%-10u %10s %14.2f %14.2f\n", size, webSocketUnmaskKernel(), measureUnmask(webSocketUnmask, size, config.unmaskMB),
+               measureUnmask(webSocketUnmaskScalar, size, config.unmaskMB));
+    printf("\n");
+
+    uint32_t tcpPort = config.basePort;
+    uint32_t wsPort  = config.basePort + 1;
+    BenchEchoServer     tcpServer(config.handlers, tcpPort);
+    WebSocketEchoServer wsServer(config.handlers, wsPort);
+    if(!tcpServer.launch() || !wsServer.launch())
+    {
+        ERROR << "Could not launch the Servers on the ports " << tcpPort << " and " << wsPort << "\n";
+        return EXIT_FAILURE;
+    }
+
+    PingPongResult tcpResult = runPingPong([tcpPort]() {return connectTCP(tcpPort);}, config.connections, config.messages, config.size,
+                                           config.window);
+    PingPongResult wsResult  = runWebSocketPingPong(wsPort, config);
+    tcpServer.closeServer();
+    wsServer.closeServer();
+
+    printf("%-10s %10s %12s %10s %10s %s\n", "path", "messages", "msgs/s", "p50_us", "p99_us", "check");
+    printf("%-10s %10lu %12.0f %10.1f %10.1f %s\n", "raw-tcp", (unsigned long)tcpResult.latency.count, tcpResult.messagesPerSecond,
+           tcpResult.latency.p50/1e3, tcpResult.latency.p99/1e3, (tcpResult.valid ? "ok" : "FAILED"));
+    printf("%-10s %10lu %12.0f %10.1f %10.1f %s\n", "websocket", (unsigned long)wsResult.latency.count, wsResult.messagesPerSecond,
+           wsResult.latency.p50/1e3, wsResult.latency.p99/1e3, (wsResult.valid ? "ok" : "FAILED"));
+
+    return (tcpResult.valid && wsResult.valid) ? EXIT_SUCCESS : EXIT_FAILURE;
+}